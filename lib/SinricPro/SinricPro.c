@@ -54,9 +54,58 @@ SinricProAction_t actions[] = {
 
 #define NUM_ACTIONS (sizeof(actions)/sizeof(SinricProAction_t))
 
+// largest payload built for a response or notification
+#ifndef SINRICPRO_PAYLOAD_SIZE
+#define SINRICPRO_PAYLOAD_SIZE 1024
+#endif
+// header, signature and trailer sent around the payload
+#define SINRICPRO_ENVELOPE_SIZE 160
+
+// round trip time at which the connection counts as degraded, see SinricProSetStandby
+#ifndef SINRICPRO_STANDBY_RTT_MS
+#define SINRICPRO_STANDBY_RTT_MS 1000
+#endif
+// how long a standby opened on demand is kept once the connection has recovered
+#ifndef SINRICPRO_STANDBY_HOLD_MS
+#define SINRICPRO_STANDBY_HOLD_MS (60*1000)
+#endif
+// offer permessage-deflate to the server, its compressor and decompressor need RAM
+#ifndef SINRICPRO_DEFLATE
+#define SINRICPRO_DEFLATE 0
+#endif
+
 SinrecProDeviceActionHandler_t userDefinedActionHandler = NULL;
 
-static WebSocketClient_p wsClient = NULL;
+static WebSocketClient_p wsClient = NULL;   // connection messages are sent over
+static WebSocketClient_p wsStandby = NULL;  // second connection ready to take over, NULL if none
+static SinricProStandby_t standbyMode = SINRICPRO_STANDBY_OFF;
+static uint32_t degradedAt = 0;             // when the connection was last seen degraded
+static bool connectRequested = false;
+
+// kept to create the standby connection
+static const char *sinricServer = NULL;
+static const char *sinricHostname = NULL;
+static uint16_t sinricPort = 0;
+static char additional_headers[300];
+
+// fields taken from each message, the value of action n is in slot MESSAGE_VALUES+n.
+// Full paths, so a key that is also used elsewhere in the message (value, type) is
+// only taken from where it belongs
+enum { MESSAGE_TIMESTAMP, MESSAGE_DEVICE_ID, MESSAGE_CLIENT_ID, MESSAGE_REPLY_TOKEN, MESSAGE_CREATED_AT, MESSAGE_ACTION, MESSAGE_VALUES };
+#define MESSAGE_FIELDS (MESSAGE_VALUES + NUM_ACTIONS)
+static json_field_t messageFields[MESSAGE_FIELDS] = {
+    { "timestamp", JSON_INTEGER },
+    { "payload.deviceId", JSON_TEXT },
+    { "payload.clientId", JSON_TEXT },
+    { "payload.replyToken", JSON_TEXT },
+    { "payload.createdAt", JSON_INTEGER },
+    { "payload.action", JSON_TEXT },
+};
+static char valuePaths[NUM_ACTIONS][32];    // "payload.value." and the action's value name
+static json_plan_t messagePlan;
+
+// replyToken of the last request acted on, a request can arrive over both connections
+static char lastReplyToken[64];
 
 static int64_t timestamp = 0;
 static int64_t timestampSecsBoot = 0;
@@ -84,13 +133,13 @@ static bool defaultActionHandler( char *deviceId, char *action, jsonValue_t valu
     return true;
 }
 
-static char *getSignature( char *payload )
+static char *getSignature( const char *payload, size_t len )
 {
     #define SHA256_HASH_SIZE 32
     static char signature[(SHA256_HASH_SIZE/3)*4+4+1];
     uint8_t out[SHA256_HASH_SIZE];
 
-    hmac_sha256( SinricProAppSecret, strlen(SinricProAppSecret), payload, strlen(payload), &out, sizeof(out) );
+    hmac_sha256( SinricProAppSecret, strlen(SinricProAppSecret), payload, len, &out, sizeof(out) );
     base64_encode( (char *)out, SHA256_HASH_SIZE, signature );
 
     //printf("signature=[%s](%d)\n",signature,strlen(signature));
@@ -102,12 +151,62 @@ static char *getSignature( char *payload )
     return signature;
 }
 
+static const char signedHeader[] = "{\"header\":{\"payloadVersion\":2,\"signatureVersion\":1},\"payload\":";
+
+/*  Starts a signed message, the payload is built with json_put straight into the frame
+ *  it will be sent in, after the constant header, so it is never copied.
+ */
+static bool startSigned( WebSocketClient_p client, wsReservation_t *reservation )
+{
+    char *message = wsReserve( client, SINRICPRO_PAYLOAD_SIZE + SINRICPRO_ENVELOPE_SIZE, reservation );
+
+    if ( message == NULL ) {
+        return false;
+    }
+    memcpy( message, signedHeader, sizeof(signedHeader)-1 );
+    json_put_start( message + sizeof(signedHeader)-1, SINRICPRO_PAYLOAD_SIZE );
+    return true;
+}
+
+/*  Finishes the payload started by startSigned, signs it exactly as it is, and sends
+ *  it with the signature and trailer added after it.
+ */
+static bool sendSigned( WebSocketClient_p client, wsReservation_t *reservation, wsPriority_t priority )
+{
+    static const char hmac[] = ",\"signature\":{\"HMAC\":\"";
+    static const char trailer[] = "\"}}";
+    char *payload = (char *)reservation->frame + reservation->headroom + sizeof(signedHeader)-1;
+
+    if ( !json_put_end() ) {
+        printf("PAYLOAD BUFFER OVERFLOW !!!\n");
+        wsRelease( reservation );
+        return false;
+    }
+    size_t len = json_put_len();
+    //printf("payload=[%s](%d)\n",payload,len);
+
+    // create signature...
+    char *signature = getSignature( payload, len );
+    size_t signature_len = strlen( signature );
+    char *end = payload + len;
+
+    memcpy( end, hmac, sizeof(hmac)-1 );
+    end += sizeof(hmac)-1;
+    memcpy( end, signature, signature_len );
+    end += signature_len;
+    memcpy( end, trailer, sizeof(trailer)-1 );
+    end += sizeof(trailer)-1;
+
+    //printf("Message\n[%.*s]\n",(int)(end-payload),payload);
+    return wsCommit( client, reservation, end - (char *)reservation->frame - reservation->headroom, false, priority );
+}
+
 static bool buildJsonPayload( char *action, char *clientId, int64_t createdAt, char *deviceId, char *replyToken, jsonValue_t value, char *valueName, jsonType_t valueType  )
 {
     json_put( "action", (jsonValue_t)action, JSON_TEXT );
     json_put( "clientId", (jsonValue_t)clientId, JSON_TEXT );
     json_put( "scope", (jsonValue_t)"device", JSON_TEXT );
-    json_put( "createdAt", (jsonValue_t)createdAt, JSON_INTEGER );
+    json_put( "createdAt", (jsonValue_t)(long long)createdAt, JSON_INTEGER );
     json_put( "deviceId", (jsonValue_t)deviceId, JSON_TEXT );
     json_put( "message", (jsonValue_t)"OK", JSON_TEXT );
     json_put( "replyToken", (jsonValue_t)replyToken, JSON_TEXT );
@@ -120,43 +219,62 @@ static bool buildJsonPayload( char *action, char *clientId, int64_t createdAt, c
     return true;
 }
 
+// True if the request was already acted on when it came over the other connection
+static bool duplicateRequest( const char *replyToken )
+{
+    if ( wsStandby == NULL ) {
+        return false;
+    }
+    if ( strncmp( replyToken, lastReplyToken, sizeof(lastReplyToken) ) == 0 ) {
+        printf("Duplicate request ignored\n");
+        return true;
+    }
+    strncpy( lastReplyToken, replyToken, sizeof(lastReplyToken)-1 );
+    return false;
+}
+
 static void handleWSmessage( WebSocketClient_p client,  char *msg, int len )
 {
     bool unknown = true;
-    jsonValue_t data;
+    jsonValue_t values[MESSAGE_FIELDS];
+    uint32_t found = 0;
     char *deviceId = NULL;
     char *clientId = NULL;
     char *replyToken = NULL;
     char *action = NULL;
-    char *value_text = NULL;
     int64_t createdAt = 0;
 
     printf("Message received\n");
 
+    // one pass over the message picks out every field we might need...
+    json_extract( &messagePlan, msg, values, &found );
+
     // if timestamp store and use as base time...
-    if  ( json_get( msg, "timestamp", JSON_INTEGER, &data ) ) {
+    if  ( found & 1u << MESSAGE_TIMESTAMP ) {
         timestampSecsBoot = to_ms_since_boot(get_absolute_time())/1000;
-        timestamp = data.integer;
-        printf( "timestamp: '%lld'\n", timestamp );    
+        timestamp = values[MESSAGE_TIMESTAMP].integer;
+        printf( "timestamp: '%lld'\n", (long long)timestamp );    
         time_t now = SinricProServerTime();
         printf("Current server time is %s",ctime(&now));            
         unknown = false;
     } 
     // if device message parse message for required data...
-    else if ( json_get( msg, "deviceId", JSON_TEXT, &data ) ) {
-        deviceId = strdup(data.text);
+    else if ( found & 1u << MESSAGE_DEVICE_ID ) {
+        deviceId = values[MESSAGE_DEVICE_ID].text;
         //printf( "deviceId: '%s'\n", (char *)deviceId );    
-        if ( json_get( msg, "clientId", JSON_TEXT, &data ) ) {
-            clientId = strdup(data.text);
+        if ( found & 1u << MESSAGE_CLIENT_ID ) {
+            clientId = values[MESSAGE_CLIENT_ID].text;
             //printf( "clientId: '%s'\n", (char *)clientId );    
-            if ( json_get( msg, "replyToken", JSON_TEXT, &data ) ) {
-                replyToken = strdup(data.text);
+            if ( found & 1u << MESSAGE_REPLY_TOKEN ) {
+                replyToken = values[MESSAGE_REPLY_TOKEN].text;
                 //printf( "replyToken: '%s'\n", (char *)replyToken );    
-                if ( json_get( msg, "createdAt", JSON_INTEGER, &data ) ) {
-                    createdAt = data.integer;
+                if ( duplicateRequest( replyToken ) ) {
+                    unknown = false;
+                } else if ( found & 1u << MESSAGE_CREATED_AT ) {
+                    createdAt = values[MESSAGE_CREATED_AT].integer;
                     //printf( "createdAt: '%lld'\n", *(int64_t *)createdAt );    
-                    if ( json_get( msg, "action", JSON_TEXT, &data ) ) {
-                        action = strdup(data.text);
+                    if ( found & 1u << MESSAGE_ACTION ) {
+                        action = values[MESSAGE_ACTION].text;
                         //printf( "action: '%s'\n", (char *)action );    
 
                         int actionNum = 0;
@@ -166,13 +284,8 @@ static void handleWSmessage( WebSocketClient_p client,  char *msg, int len )
                         }
 
                         if ( actionNum < NUM_ACTIONS && strcmp(actions[actionNum].deviceAction, action)==0 ) { 
-                            if ( json_get( msg, actions[actionNum].deviceValueName, actions[actionNum].deviceValueDataType, &data ) ) {
-                                jsonValue_t value = data;
-                                if ( actions[actionNum].deviceValueDataType == JSON_TEXT ) {
-                                    // make a copy
-                                    value_text = strdup(value.text);
-                                    value.text = value_text;
-                                }
+                            if ( found & 1u << ( MESSAGE_VALUES + actionNum ) ) {
+                                jsonValue_t value = values[MESSAGE_VALUES + actionNum];
 
                                 //printf("[%.*s](%d)\n",len,msg,len);
 
@@ -182,39 +295,19 @@ static void handleWSmessage( WebSocketClient_p client,  char *msg, int len )
                                     unknown = !defaultActionHandler( deviceId, action, value, actions[actionNum].deviceValueDataType );
                                 }
 
-                                char json_buffer[BUF_SIZE+1];
+                                wsReservation_t reservation;
+                                bool queued = false;
                                 createdAt = SinricProServerTime();
 
-                                // build "payload" so we can create signature...
-                                json_put_start( json_buffer, BUF_SIZE );
-                                buildJsonPayload( action, clientId, createdAt, deviceId, replyToken, value, actions[actionNum].deviceValueName, actions[actionNum].deviceValueDataType );
-                                json_put_end();
-                                //printf("payload=[%s](%d)\n",json_buffer,strlen(json_buffer));
-
-                                // create signature...
-                                char *signature = getSignature( json_buffer );
-
-                                // build full response...
-                                json_put_start( json_buffer, BUF_SIZE );
-                                json_put( "header", (jsonValue_t)NULL, JSON_OBJ );         
-                                json_put( "payloadVersion", (jsonValue_t)2, JSON_INTEGER );
-                                json_put( "signatureVersion", (jsonValue_t)1, JSON_INTEGER );
-                                json_put( NULL, (jsonValue_t)NULL, JSON_OBJ );
-                                json_put( "payload", (jsonValue_t)NULL, JSON_OBJ );         
-                                buildJsonPayload( action, clientId, createdAt, deviceId, replyToken, value, actions[actionNum].deviceValueName, actions[actionNum].deviceValueDataType );
-                                json_put( NULL, (jsonValue_t)NULL, JSON_OBJ );
-                                json_put( "signature", (jsonValue_t)NULL, JSON_OBJ );
-                                json_put( "HMAC", (jsonValue_t)signature, JSON_TEXT );
-                                json_put( NULL, (jsonValue_t)NULL, JSON_OBJ );
-                                json_put_end();
-
-                                //printf("Response\n[%s](%d)\n",json_buffer,strlen(json_buffer));
-
-                                // send response...
-                                if ( wsSendMessage( client, json_buffer, strlen(json_buffer) ) ) {
-                                    printf("Response sent\n");
+                                // build "payload" where it will be sent from, then sign and send it...
+                                if ( startSigned( client, &reservation ) ) {
+                                    buildJsonPayload( action, clientId, createdAt, deviceId, replyToken, value, actions[actionNum].deviceValueName, actions[actionNum].deviceValueDataType );
+                                    queued = sendSigned( client, &reservation, WS_PRIORITY_RESPONSE );
+                                }
+                                if ( queued ) {
+                                    printf("Response queued\n");
                                 } else {    
-                                    printf("Failed to send response\n");
+                                    printf("Failed to queue response\n");
                                 }
                             } else {
                                 printf("Data [%s] not found\n",actions[actionNum].deviceValueName);
@@ -228,17 +321,15 @@ static void handleWSmessage( WebSocketClient_p client,  char *msg, int len )
         }
     }
 
-    // if we don't recognise the message print it out...
+    // if we don't recognise the message print it out, extracting left terminators in it...
     if ( unknown ) {
+        for ( int i = 0 ; i < len ; i++ ) {
+            if ( msg[i] == '\0' ) {
+                msg[i] = ' ';
+            }
+        }
         printf("Message unknown or invalid\n[%.*s](%d)\n",len,msg,len);
     }
-
-    // free resources...
-    if ( deviceId ) free(deviceId);
-    if ( clientId ) free(clientId);
-    if ( replyToken ) free(replyToken);
-    if ( action ) free(action);
-    if ( value_text ) free(value_text);
 }
 
 static bool buildNotifyPayload( char *action, char *causeText, int64_t createdAt, char *deviceId, char *replyToken, jsonValue_t value, char *valueName, jsonType_t valueType  )
@@ -248,7 +339,7 @@ static bool buildNotifyPayload( char *action, char *causeText, int64_t createdAt
     json_put( "type", (jsonValue_t)causeText, JSON_TEXT );
     json_put( NULL, (jsonValue_t)NULL, JSON_OBJ );
     //json_put( "scope", (jsonValue_t)"device", JSON_TEXT );
-    json_put( "createdAt", (jsonValue_t)createdAt, JSON_INTEGER );
+    json_put( "createdAt", (jsonValue_t)(long long)createdAt, JSON_INTEGER );
     json_put( "deviceId", (jsonValue_t)deviceId, JSON_TEXT );
     json_put( "replyToken", (jsonValue_t)replyToken, JSON_TEXT );
     json_put( "type", (jsonValue_t)"event", JSON_TEXT );
@@ -259,6 +350,76 @@ static bool buildNotifyPayload( char *action, char *causeText, int64_t createdAt
     return true;
 }
 
+// Creates a client for the Sinric Pro server, used for the connection and its standby
+static WebSocketClient_p createClient( void )
+{
+    // sized for the largest message either way
+    const wsConfig_t config = {
+        .rx_capacity = WS_MAX_MESSAGE_SIZE,
+        .tx_capacity = SINRICPRO_PAYLOAD_SIZE + SINRICPRO_ENVELOPE_SIZE,
+    };
+    WebSocketClient_p client = wsCreate( sinricServer, sinricHostname, sinricPort, handleWSmessage, additional_headers, true, &config );
+    if ( client == NULL ) {
+        return NULL;
+    }
+
+    // a few small messages a minute, each one someone is waiting on
+    wsSetLatencyMode( client, true );
+    #if WS_DEFLATE && SINRICPRO_DEFLATE
+    // messages are verbose JSON with the same keys every time, so keep history between them
+    wsSetDeflate( client, WS_DEFLATE_WINDOW_BITS, true );
+    #endif
+    #if WS_TLS
+    // define SINRICPRO_CA_CERT as the PEM text of the server's CA to verify it
+    #ifdef SINRICPRO_CA_CERT
+    static const char caCert[] = SINRICPRO_CA_CERT;
+    wsSetTls( client, (const uint8_t *)caCert, sizeof(caCert) );
+    #else
+    wsSetTls( client, NULL, 0 );
+    #endif
+    #endif
+
+    return client;
+}
+
+static bool connectionDegraded( WebSocketClient_p client )
+{
+    int rtt = wsGetRtt( client, NULL );
+    return wsConnectState( client ) == TCP_DISCONNECTED || wsGetPingsMissed( client ) > 0 || rtt > SINRICPRO_STANDBY_RTT_MS;
+}
+
+/*  Moves messages to the standby as soon as the connection they use is lost,
+ *  and opens or closes an on demand standby as the connection's health changes.
+ */
+static void standbyService( void )
+{
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+
+    if ( !wsIsUpgraded( wsClient ) && wsIsUpgraded( wsStandby ) ) {
+        // wsClient changes in one store, a notify from the other core uses one connection or the other
+        WebSocketClient_p failed = wsClient;
+        wsClient = wsStandby;
+        wsStandby = failed;
+        degradedAt = now;
+        printf("SinricPro switched to the standby connection\n");
+    }
+
+    // otherwise both reconnect by themselves
+    if ( standbyMode != SINRICPRO_STANDBY_ON_DEGRADE || !connectRequested ) {
+        return;
+    }
+    if ( connectionDegraded( wsClient ) ) {
+        degradedAt = now;
+        if ( wsConnectState( wsStandby ) == TCP_DISCONNECTED ) {
+            printf("SinricPro connection degraded, connecting standby\n");
+            wsConnect( wsStandby );
+        }
+    } else if ( wsConnectState( wsStandby ) != TCP_DISCONNECTED && now - degradedAt > SINRICPRO_STANDBY_HOLD_MS ) {
+        printf("SinricPro connection recovered, closing standby\n");
+        wsDisconnect( wsStandby );
+    }
+}
+
 //===============================================================================================================
 
 /*! \brief Initialises parameters for connection to Sinric Pro
@@ -280,6 +441,20 @@ bool SinricProInit(const char *server, const char *hostname, uint16_t port, cons
     // save apo secret
     SinricProAppSecret = appSecret;
 
+    // the fields every message is scanned for, with the value of each action...
+    for ( size_t actionNum = 0 ; actionNum < NUM_ACTIONS ; actionNum++ ) {
+        int len = snprintf( valuePaths[actionNum], sizeof(valuePaths[actionNum]), "payload.value.%s", actions[actionNum].deviceValueName );
+        if ( len < 0 || len >= (int)sizeof(valuePaths[actionNum]) ) {
+            printf("Value name %s is too long\n", actions[actionNum].deviceValueName);
+            return false;
+        }
+        messageFields[MESSAGE_VALUES + actionNum].path = valuePaths[actionNum];
+        messageFields[MESSAGE_VALUES + actionNum].type = actions[actionNum].deviceValueDataType;
+    }
+    if ( !json_plan_compile( &messagePlan, messageFields, MESSAGE_FIELDS ) ) {
+        return false;
+    }
+
     const char *ip_address = strdup(localIPAddress);
     const char *mac_address = strdup(localMACAddress);
 
@@ -287,7 +462,6 @@ bool SinricProInit(const char *server, const char *hostname, uint16_t port, cons
     printf("mac address=[%s]\n",mac_address);
 
     // create additional web socket headers for Sinric Pro...
-    char additional_headers[300];
     sprintf(additional_headers,
         "appkey: %s\r\n"
         "deviceids: %s\r\n"
@@ -301,12 +475,56 @@ bool SinricProInit(const char *server, const char *hostname, uint16_t port, cons
         mac_address, ip_address,
         firmwareVersion );
 
+    sinricServer = strdup(server);
+    sinricHostname = hostname ? strdup(hostname) : NULL;
+    sinricPort = port;
+
     // create WebSocket client and connect...
-    wsClient = wsCreate( server, hostname, port, handleWSmessage, additional_headers, true );
+    wsClient = createClient();
 
     return( wsClient != NULL );
 }
 
+/*! \brief Keeps a second connection to take over if the first fails
+ *  \ingroup SinricPro.c
+ *
+ * With a standby the device isn't deaf while a lost connection is replaced,
+ * messages move to the standby as soon as the connection they were using
+ * closes, and the connection that failed reconnects to become the standby.
+ * SINRICPRO_STANDBY_ALWAYS keeps the standby connected all the time, which
+ * costs a second client's RAM and keepalive traffic. SINRICPRO_STANDBY_ON_DEGRADE
+ * only connects it once the connection misses a PONG, its round trip time
+ * passes SINRICPRO_STANDBY_RTT_MS or it is lost, and closes it again once the
+ * connection has been healthy for SINRICPRO_STANDBY_HOLD_MS. The server may
+ * send a request over both, the second is ignored.
+ *
+ * \param mode SINRICPRO_STANDBY_OFF, SINRICPRO_STANDBY_ALWAYS or SINRICPRO_STANDBY_ON_DEGRADE
+ * \return true if succesful
+ */
+bool SinricProSetStandby( SinricProStandby_t mode )
+{
+    standbyMode = mode;
+    if ( mode == SINRICPRO_STANDBY_OFF ) {
+        if ( wsStandby != NULL ) {
+            WebSocketClient_p standby = wsStandby;
+            wsStandby = NULL;
+            wsDestroy( standby );
+        }
+        return true;
+    }
+
+    if ( wsStandby == NULL ) {
+        wsStandby = createClient();
+        if ( wsStandby == NULL ) {
+            return false;
+        }
+    }
+    if ( mode == SINRICPRO_STANDBY_ALWAYS && connectRequested ) {
+        wsConnect( wsStandby );
+    }
+    return true;
+}
+
 /*! \brief Connects to Sinric Pro
  *  \ingroup SinricPro.c
  *
@@ -316,6 +534,10 @@ bool SinricProInit(const char *server, const char *hostname, uint16_t port, cons
 bool SinricProConnect( SinrecProDeviceActionHandler_t actionHandler )
 {
     userDefinedActionHandler = actionHandler;
+    connectRequested = true;
+    if ( wsStandby != NULL && standbyMode == SINRICPRO_STANDBY_ALWAYS ) {
+        wsConnect( wsStandby );
+    }
     return( wsConnect( wsClient ) );
 }
 
@@ -333,42 +555,20 @@ bool SinricProConnect( SinrecProDeviceActionHandler_t actionHandler )
 bool SinricProNotify( char *deviceId, char *action, SinricProCause_t cause, char *valueName, jsonValue_t value, jsonType_t valueType )
 {
     bool result = false;
-    char json_buffer[BUF_SIZE+1];
+    WebSocketClient_p client = wsClient;
+    wsReservation_t reservation;
     int64_t createdAt = SinricProServerTime();
     char *causeText = cause==PHYSICAL_INTERACTION?"PHYSICAL_INTERACTION":cause==PERIODIC_POLL?"PERIODIC_POLL":"UNKNOWN CAUSE";
 
-    // build "payload" so we can create signature...
-    json_put_start( json_buffer, BUF_SIZE );
-    buildNotifyPayload( action, causeText, createdAt, deviceId, deviceId, value, valueName, valueType );
-    json_put_end();
-
-    //printf("Notify payload=[%s](%d)\n",json_buffer,strlen(json_buffer));
-
-    // create signature...
-    char *signature = getSignature( json_buffer );
-
-    // build full response...
-    json_put_start( json_buffer, BUF_SIZE );
-    json_put( "header", (jsonValue_t)NULL, JSON_OBJ );         
-    json_put( "payloadVersion", (jsonValue_t)2, JSON_INTEGER );
-    json_put( "signatureVersion", (jsonValue_t)1, JSON_INTEGER );
-    json_put( NULL, (jsonValue_t)NULL, JSON_OBJ );
-    json_put( "payload", (jsonValue_t)NULL, JSON_OBJ );         
-    buildNotifyPayload( action, causeText, createdAt, deviceId, deviceId, value, valueName, valueType );
-    json_put( NULL, (jsonValue_t)NULL, JSON_OBJ );
-    json_put( "signature", (jsonValue_t)NULL, JSON_OBJ );
-    json_put( "HMAC", (jsonValue_t)signature, JSON_TEXT );
-    json_put( NULL, (jsonValue_t)NULL, JSON_OBJ );
-    json_put_end();
-
-    //printf("Notify Request\n[%s](%d)\n",json_buffer,strlen(json_buffer));
-
-    // send request...
-    if ( wsSendMessage( wsClient, json_buffer, strlen(json_buffer) ) ) {
-        printf("Notify request [%s] sent\n", action);
-        result = true;
+    // build "payload" where it will be sent from, then sign and send it...
+    if ( startSigned( client, &reservation ) ) {
+        buildNotifyPayload( action, causeText, createdAt, deviceId, deviceId, value, valueName, valueType );
+        result = sendSigned( client, &reservation, WS_PRIORITY_NOTIFY );
+    }
+    if ( result ) {
+        printf("Notify request [%s] queued\n", action);
     } else {    
-        printf("Failed to send [%s] notify request\n", action);
+        printf("Failed to queue [%s] notify request\n", action);
     }
     
     return result;
@@ -383,6 +583,10 @@ bool SinricProNotify( char *deviceId, char *action, SinricProCause_t cause, char
 void SinricProHandler( void )
 {
     wsHandler( wsClient );
+    if ( wsStandby != NULL ) {
+        wsHandler( wsStandby );
+        standbyService();
+    }
 }
 
 /*! \brief Gets current time as sent by the Sinric Pro Server
@@ -8,8 +8,10 @@ extern "C" {
 
 typedef bool (*SinrecProDeviceActionHandler_t)( char *deviceID, char *action, jsonValue_t value, jsonType_t dataType );
 typedef enum SinricProCause_e { PHYSICAL_INTERACTION, PERIODIC_POLL } SinricProCause_t;
+typedef enum SinricProStandby_e { SINRICPRO_STANDBY_OFF, SINRICPRO_STANDBY_ALWAYS, SINRICPRO_STANDBY_ON_DEGRADE } SinricProStandby_t;
 
 bool SinricProInit(const char *server, const char *hostname, uint16_t port, const char *appKey, const char *appSecret, const char*deviceIDs, const char *firmwareVersion, const char *localIPAddress, const char *localMACAddress );
+bool SinricProSetStandby( SinricProStandby_t mode );
 bool SinricProConnect( SinrecProDeviceActionHandler_t actionHandler );
 bool SinricProNotify( char *deviceId, char *action, SinricProCause_t cause, char *valueName, jsonValue_t value, jsonType_t valueType );
 int64_t SinricProServerTime( void );
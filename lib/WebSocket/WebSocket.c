@@ -3,7 +3,7 @@
 /*  Web Socket Interface for the Raspberry Pi Pico W                         */
 /*                                                                           */
 /*  This is based the the Raspberry Pi Pico "examples".                      */
-/*  Only supports simple text type messages.                                 */
+/*  Supports text and binary messages.                                       */
 /*                                                                           */
 /*  Original author: Russell Rhodes, https://github.com/RussellRhodes        */
 /*                                                                           */
@@ -15,30 +15,24 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <strings.h>
+#include <stdatomic.h>
 
 #include "pico/stdlib.h"
 
+#include "pico/rand.h"
 #include "WebSocket.h"
+#include "wsTransport.h"
+#include "sha1.h"
+#include "base64.h"
 
-#ifdef WIZNET_BOARD
-    #include "wizchip_conf.h"
-    #include "wizchip_spi.h"
-    #include "httpClient.h"
-
-    #define err_t       int8_t
-    #define ERR_OK      0
-    #define ERR_ABRT    -13
-
-    #define ENABLE          true
-    #define DISABLE         false
-    #define HTTP_PORT       80
-#else 
-    #include "pico/cyw43_arch.h"
-    #include "lwip/pbuf.h"
-    #include "lwip/tcp.h"
+#if WS_DEFLATE
+    #include "deflate.h"
 #endif
 
-#define PING_TIMEOUT    (300*1000)
+#if (WS_QUEUE_DEPTH & (WS_QUEUE_DEPTH-1)) != 0
+#error "WS_QUEUE_DEPTH must be a power of 2"
+#endif
 
 /*  Web Socket Frame layout
  *
@@ -93,11 +87,101 @@ enum WebSocketOpCode {
     WEBSOCKET_OPCODE_PONG = 0xA
 };
 
+#define WS_MAX_HEADER_SIZE  14
+#define WS_MAX_CONTROL_SIZE 125
+#define WS_RSV1             0x4     // RSV field value with RSV1 set, marks a compressed message
+
+// Close status codes (RFC 6455 section 7.4.1)
+#define WS_CLOSE_NORMAL         1000
+#define WS_CLOSE_PROTOCOL_ERROR 1002
+#define WS_CLOSE_INVALID_DATA   1007
+#define WS_CLOSE_TOO_BIG        1009
+#define WS_CLOSE_INTERNAL_ERROR 1011
+
+enum WebSocketDecodeState {
+    WS_DECODE_HEADER,
+    WS_DECODE_PAYLOAD
+};
+
+enum WebSocketUpgradeState {
+    WS_UPGRADE_STATUS,              // waiting for the status line
+    WS_UPGRADE_HEADERS,             // reading header lines until the empty one
+    WS_UPGRADE_DONE,                // accepted, remaining bytes are frames
+    WS_UPGRADE_FAILED
+};
+
+#define WS_UPGRADE_LINE_SIZE    160     // longer header lines are truncated, none we check get near this
+#define WS_UPGRADE_MAX_SIZE     4096    // give up on a response with more header bytes than this
+#define WS_ACCEPT_SIZE          28      // base64 of a SHA1 hash
+
+enum WebSocketPayloadSink {
+    WS_SINK_CONTROL,                // control frame, kept in the decoder
+    WS_SINK_BUFFER,                 // data frame, reassembled into rx_buffer
+    WS_SINK_STREAM                  // data frame, passed to the stream handler as it arrives
+};
+
+// Outbound queue cell, holds a complete masked frame built by the producer
+typedef struct {
+    atomic_uint sequence;           // tells producers and the consumer whose turn the cell is
+    uint8_t *frame;
+    uint32_t len;
+    uint8_t deflate_opcode;         // non zero if frame holds a payload to compress and frame when sent
+    uint32_t queued_us;             // when the frame was queued, for the latency stats
+} WebSocketQueueCell_t;
+
+/*  Bounded multi-producer single-consumer queue, one per priority. Producers claim
+ *  a cell with a compare and swap so they can run on either core or in a callback,
+ *  the single consumer is the lwIP context (wsHandler on the WIZnet board).
+ */
+typedef struct {
+    WebSocketQueueCell_t cells[WS_QUEUE_DEPTH];
+    atomic_uint enqueue_pos;
+    atomic_uint dequeue_pos;        // only written by the consumer
+    atomic_uint drops;
+    atomic_uint high_water;
+} WebSocketQueue_t;
+
+// Resumable frame decoder, keeps partial frames between receive callbacks
+typedef struct {
+    enum WebSocketDecodeState state;
+    uint8_t  header_bytes[WS_MAX_HEADER_SIZE];
+    uint8_t  header_len;            // header bytes received so far
+    uint8_t  header_need;           // header bytes required, grows once the length/mask fields are known
+    WebsocketPacketHeader_t header;
+    uint64_t payload_received;      // payload bytes consumed for the current frame
+    enum WebSocketPayloadSink sink; // where the current frame's payload is placed
+    uint8_t  message_opcode;        // opcode of the message being reassembled, CONTINUE if none
+    uint32_t message_len;           // message bytes reassembled so far
+    uint16_t close_code;            // non zero if the connection must be failed
+    bool     message_compressed;    // the message being reassembled had RSV1 set
+    bool     check_utf8;            // the message is text to be checked as it arrives
+    uint32_t utf8_state;            // character split between pieces of the message, see wsUtf8Validate
+    uint8_t  control[WS_MAX_CONTROL_SIZE+1];
+} WebSocketDecoder_t;
+
+/*  Resumable parser for the HTTP upgrade response, takes the response a byte at
+ *  a time so it can be split anywhere between receive callbacks.
+ */
+typedef struct {
+    enum WebSocketUpgradeState state;
+    char     line[WS_UPGRADE_LINE_SIZE];
+    uint16_t line_len;
+    uint16_t total;                 // response bytes seen so far
+    uint16_t status;
+    bool     upgrade_ok;            // Upgrade: websocket
+    bool     connection_ok;         // Connection: upgrade
+    bool     accept_ok;             // Sec-WebSocket-Accept matched the key we sent
+    char     accept[WS_ACCEPT_SIZE+1];
+#if WS_DEFLATE
+    bool     has_extensions;
+    char     extensions[128];
+#endif
+} WebSocketUpgrade_t;
+
 typedef struct WebSocketClient_s {
-#ifdef WIZNET_BOARD
-        uint8_t send_buf[BUF_SIZE];
-        uint8_t recv_buf[BUF_SIZE];
-        char *remote_addr;
+        const wsTransport_t *transport;
+        void *transport_state;
+        char *server;
         char *hostname;
         uint16_t remote_port;
         int connected;
@@ -106,30 +190,233 @@ typedef struct WebSocketClient_s {
         wsMessagehandler messageHandler;
         bool auto_reconnect;
         uint32_t lastPing;
-#else
-        struct tcp_pcb *tcp_pcb;
-        ip_addr_t remote_addr;
-        char *hostname;
-        uint8_t en[BUF_SIZE];
-        uint8_t rx_buffer[BUF_SIZE];
-        int buffer_len;
-        int rx_buffer_len;
-        int sent_len;
-        int connected;
-        u16_t remote_port;
-        bool upgraded;
-        char *additional_headers;
-        wsMessagehandler messageHandler;
-        bool auto_reconnect;
-        uint32_t lastPing;
+        uint8_t *rx_buffer;             // rx_capacity+1 bytes, for messages that can't be delivered in place,
+                                        // allocated when first needed and freed with the connection
+        uint32_t rx_capacity;
+        uint32_t tx_capacity;
+        uint32_t max_message_size;
+        wsStreamHandler streamHandler;
+        wsBinaryHandler binaryHandler;
+        WebSocketUpgrade_t upgrade;
+        WebSocketDecoder_t decoder;
+        WebSocketQueue_t queue[WS_PRIORITY_COUNT];
+        bool low_latency;               // send as soon as a frame is queued, Nagle off
+        bool receiving;                 // between wsTransportReceive and wsTransportReceiveDone
+        bool disconnect_requested;      // wsDisconnect called, stay closed until wsConnect
+        atomic_int cork;                // frames are held in the queues while non zero
+        uint32_t keepalive_interval;    // ms between our PINGs, 0 if disabled
+        uint8_t keepalive_misses;       // unanswered PINGs before the peer is declared dead
+        uint8_t pings_missed;
+        bool ping_outstanding;
+        uint32_t ping_seq;              // sent as the PING payload, echoed in the PONG
+        uint32_t ping_sent_ms;
+        uint64_t ping_sent_us;
+        int32_t rtt_us;                 // smoothed round trip time, -1 until measured
+        int32_t rtt_var_us;             // smoothed mean deviation of the round trip time
+        uint32_t reconnect_min;         // first reconnect delay, ms
+        uint32_t reconnect_max;         // longest reconnect delay, ms
+        uint32_t connect_timeout;       // ms allowed from connect to upgrade, 0 for no limit
+        uint8_t reconnect_failures;     // attempts since the last stable connection
+        bool reconnect_pending;
+        uint32_t reconnect_at;
+        uint32_t connect_started;
+        uint32_t upgraded_at;
+        bool down;                      // no upgraded connection since down_since
+        uint32_t down_since;
+        uint16_t peer_close_code;       // status from the server's CLOSE frame, 0 if none
+        wsReconnectStats_t reconnect_stats;
+        wsStats_t stats;                // counters only ever increase, see wsGetStats
+        wsStats_t stats_base;           // counters at the last reset
+        uint32_t state_since;           // time connected last changed
+        uint32_t connected_at;          // time the upgrade request was sent
+#if WS_DEFLATE
+        uint8_t deflate_window_bits;    // window offered, 0 if permessage-deflate isn't wanted
+        bool deflate_context_takeover;  // offer to keep history between messages
+        uint8_t deflate_request_bits;   // set by wsSetDeflate, applied while disconnected
+        bool deflate_request_takeover;
+        bool deflate_active;            // negotiated for this connection
+        bool deflate_reset_tx;          // client_no_context_takeover agreed
+        bool deflate_reset_rx;          // server_no_context_takeover agreed
+        uint8_t deflate_tx_bits;        // window the server accepts from us
+        deflate_t *deflater;
+        inflate_t *inflater;
+        uint8_t *inflate_buffer;        // decompressed message, rx_capacity+1 bytes
 #endif
+        // the strings follow in the same allocation
 } WebSocketClient_t;
 
-static uint64_t wsBuildPacket(char* buffer, uint64_t bufferLen, enum WebSocketOpCode opcode, char* payload, uint64_t payloadLen, int mask) 
+/*  Largest frame one message can become, and the most heap a client can hold: the
+ *  client block and its receive buffer, the transport's state, every queue full of
+ *  the largest frames plus one held by each transmit slot, and the permessage-deflate
+ *  state if a window is set (bits not 0). wsRamWorstCase adds the strings.
+ */
+#if WS_DEFLATE
+#define WS_FRAME_MAX(tx, bits)      ( WS_MAX_HEADER_SIZE + ( (bits) ? DEFLATE_BOUND(tx) : (tx) ) )
+#define WS_DEFLATE_RAM(rx, bits)    ( (bits) ? (rx) + 1 + DEFLATE_RAM(bits) + INFLATE_RAM(bits) : 0 )
+#else
+#define WS_FRAME_MAX(tx, bits)      ( WS_MAX_HEADER_SIZE + (tx) )
+#define WS_DEFLATE_RAM(rx, bits)    ( 0 * (bits) )
+#endif
+#define WS_CLIENT_RAM(rx, tx, bits, transport_size) \
+    ( sizeof(WebSocketClient_t) + (rx) + 1 + (transport_size) + WS_DEFLATE_RAM(rx, bits) + \
+      WS_QUEUE_DEPTH * ( WS_MAX_HEADER_SIZE + WS_MAX_CONTROL_SIZE ) + \
+      ( (WS_PRIORITY_COUNT-1) * WS_QUEUE_DEPTH + WS_TX_SLOTS ) * WS_FRAME_MAX(tx, bits) )
+
+#ifdef WS_RAM_BUDGET
+_Static_assert( WS_CLIENT_RAM( WS_MAX_MESSAGE_SIZE, WS_MAX_SEND_SIZE, WS_DEFLATE ? WS_DEFLATE_WINDOW_BITS : 0, WS_TRANSPORT_STATE_MAX ) <= WS_RAM_BUDGET,
+                "WebSocket client worst case RAM exceeds WS_RAM_BUDGET" );
+#endif
+
+/*  Masks (or unmasks) len bytes from src into dst, dst may equal src. offset is
+ *  the position of src within the payload so masking can resume mid frame. Works
+ *  a 32 bit word at a time once dst is aligned, the Cortex-M0+ can't do unaligned
+ *  word accesses so src and dst must share the same alignment for the fast path.
+ */
+static void wsMask( uint8_t *dst, const uint8_t *src, uint32_t len, const uint8_t maskBytes[4], uint32_t offset )
+{
+    typedef uint32_t __attribute__((__may_alias__)) word_t;
+    uint32_t phase = offset & 3;
+
+    if ( ((uintptr_t)src & 3) == ((uintptr_t)dst & 3) ) {
+        // bytes up to the first aligned word
+        while ( len > 0 && ((uintptr_t)dst & 3) != 0 ) {
+            *dst++ = *src++ ^ maskBytes[phase];
+            phase = (phase + 1) & 3;
+            len--;
+        }
+
+        // mask rotated to the current phase, laid out in memory order
+        uint8_t rotated[4] = { maskBytes[phase], maskBytes[(phase+1)&3], maskBytes[(phase+2)&3], maskBytes[(phase+3)&3] };
+        uint32_t mask;
+        memcpy( &mask, rotated, sizeof(mask) );
+
+        word_t *d = (word_t *)dst;
+        const word_t *s = (const word_t *)src;
+        while ( len >= 16 ) {
+            d[0] = s[0] ^ mask;
+            d[1] = s[1] ^ mask;
+            d[2] = s[2] ^ mask;
+            d[3] = s[3] ^ mask;
+            d += 4;
+            s += 4;
+            len -= 16;
+        }
+        while ( len >= 4 ) {
+            *d++ = *s++ ^ mask;
+            len -= 4;
+        }
+        dst = (uint8_t *)d;
+        src = (const uint8_t *)s;
+    } else {
+        // alignment can never match, no word access possible
+        while ( len >= 4 ) {
+            dst[0] = src[0] ^ maskBytes[phase];
+            dst[1] = src[1] ^ maskBytes[(phase+1)&3];
+            dst[2] = src[2] ^ maskBytes[(phase+2)&3];
+            dst[3] = src[3] ^ maskBytes[(phase+3)&3];
+            dst += 4;
+            src += 4;
+            len -= 4;
+        }
+    }
+
+    // remaining bytes
+    while ( len > 0 ) {
+        *dst++ = *src++ ^ maskBytes[phase];
+        phase = (phase + 1) & 3;
+        len--;
+    }
+}
+
+/*  Checks len bytes continue valid UTF-8 (RFC 3629, no overlong forms, surrogates or
+ *  code points past U+10FFFF). *state carries a character split across calls, 0 at
+ *  the start of a message and again once the message ends on a whole character. ASCII
+ *  is skipped a 32 bit word at a time once aligned, so ASCII JSON costs little more
+ *  than reading it.
+ */
+static bool wsUtf8Validate( uint32_t *state, const uint8_t *data, uint32_t len )
+{
+    typedef uint32_t __attribute__((__may_alias__)) word_t;
+    const uint8_t *end = data + len;
+    // continuation bytes still needed, and the range allowed for the next one
+    uint32_t need = *state & 0xFF;
+    uint8_t lo = (uint8_t)( *state >> 8 );
+    uint8_t hi = (uint8_t)( *state >> 16 );
+
+    while ( data < end ) {
+        if ( need == 0 ) {
+            if ( ((uintptr_t)data & 3) == 0 ) {
+                while ( end - data >= 8 && ( ( ((const word_t *)data)[0] | ((const word_t *)data)[1] ) & 0x80808080 ) == 0 ) {
+                    data += 8;
+                }
+                if ( data == end ) {
+                    break;
+                }
+            }
+            uint8_t c = *data++;
+            if ( c < 0x80 ) {
+                continue;
+            }
+            // the second byte's range rules out overlong forms, surrogates and anything past U+10FFFF
+            lo = 0x80;
+            hi = 0xBF;
+            if ( c < 0xC2 ) {
+                return false;
+            } else if ( c < 0xE0 ) {
+                need = 1;
+            } else if ( c < 0xF0 ) {
+                need = 2;
+                if ( c == 0xE0 ) {
+                    lo = 0xA0;
+                } else if ( c == 0xED ) {
+                    hi = 0x9F;
+                }
+            } else if ( c < 0xF5 ) {
+                need = 3;
+                if ( c == 0xF0 ) {
+                    lo = 0x90;
+                } else if ( c == 0xF4 ) {
+                    hi = 0x8F;
+                }
+            } else {
+                return false;
+            }
+        } else {
+            uint8_t c = *data++;
+            if ( c < lo || c > hi ) {
+                return false;
+            }
+            lo = 0x80;
+            hi = 0xBF;
+            need--;
+        }
+    }
+
+    *state = need == 0 ? 0 : need | (uint32_t)lo << 8 | (uint32_t)hi << 16;
+    return true;
+}
+
+static uint32_t wsFrameSize( uint64_t payloadLen, int mask )
+{
+    uint32_t size = 2 + ( mask ? 4 : 0 );
+
+    if ( payloadLen >= 0x10000 ) {
+        size += 8;
+    } else if ( payloadLen >= 126 ) {
+        size += 2;
+    }
+
+    return size + (uint32_t)payloadLen;
+}
+
+/*  Writes the header of a single (FIN) frame carrying payloadLen bytes, returns
+ *  the header length. When mask is set a new key is chosen and returned in maskBytes.
+ */
+static uint32_t wsBuildHeader(uint8_t* buffer, enum WebSocketOpCode opcode, uint64_t payloadLen, int mask, uint8_t maskBytes[4])
 {
     WebsocketPacketHeader_t header;
 
-    int payloadIndex = 2;
+    uint32_t payloadIndex = 2;
     
     // Fill in meta.bits
     header.meta.bits.FIN = 1;
@@ -149,80 +436,100 @@ static uint64_t wsBuildPacket(char* buffer, uint64_t bufferLen, enum WebSocketOp
     buffer[0] = header.meta.bytes.byte0;
     buffer[1] = header.meta.bytes.byte1;
 
-    // Generate mask
-    header.mask.maskKey = (uint32_t)rand();
-
     // Fill in payload length
-    if(header.meta.bits.PAYLOADLEN == 126 && buffer!=NULL) {
-            buffer[2] = (payloadLen >> 8) & 0xFF;
-            buffer[3] = payloadLen & 0xFF;
+    if(header.meta.bits.PAYLOADLEN == 126) {
+        buffer[2] = (payloadLen >> 8) & 0xFF;
+        buffer[3] = payloadLen & 0xFF;
         payloadIndex = 4;
-     }
-
-    if(header.meta.bits.PAYLOADLEN == 127 && buffer!=NULL) {
-         buffer[2] = (payloadLen >> 56) & 0xFF;
-         buffer[3] = (payloadLen >> 48) & 0xFF;
-         buffer[4] = (payloadLen >> 40) & 0xFF;
-         buffer[5] = (payloadLen >> 32) & 0xFF;
-         buffer[6] = (payloadLen >> 24) & 0xFF;
-         buffer[7] = (payloadLen >> 16) & 0xFF;
-         buffer[8] = (payloadLen >> 8)  & 0xFF;
-         buffer[9] = payloadLen & 0xFF;
+    }
+
+    if(header.meta.bits.PAYLOADLEN == 127) {
+        buffer[2] = (payloadLen >> 56) & 0xFF;
+        buffer[3] = (payloadLen >> 48) & 0xFF;
+        buffer[4] = (payloadLen >> 40) & 0xFF;
+        buffer[5] = (payloadLen >> 32) & 0xFF;
+        buffer[6] = (payloadLen >> 24) & 0xFF;
+        buffer[7] = (payloadLen >> 16) & 0xFF;
+        buffer[8] = (payloadLen >> 8)  & 0xFF;
+        buffer[9] = payloadLen & 0xFF;
         payloadIndex = 10;
     }
 
-    // Insert masking key
-    if(header.meta.bits.MASK && buffer!=NULL) {
-        buffer[payloadIndex] = header.mask.maskBytes[0];
-        buffer[payloadIndex + 1] = header.mask.maskBytes[1];
-        buffer[payloadIndex + 2] = header.mask.maskBytes[2];
-        buffer[payloadIndex + 3] = header.mask.maskBytes[3];
+    // Generate and insert masking key
+    if(header.meta.bits.MASK) {
+        header.mask.maskKey = (uint32_t)rand();
+        memcpy(maskBytes, header.mask.maskBytes, 4);
+        memcpy(buffer + payloadIndex, header.mask.maskBytes, 4);
         payloadIndex += 4;
     }
 
+    return payloadIndex;
+}
+
+static uint64_t wsBuildPacket(char* buffer, uint64_t bufferLen, enum WebSocketOpCode opcode, char* payload, uint64_t payloadLen, int mask) 
+{
+    uint8_t maskBytes[4];
+
     // Ensure the buffer can handle the packet
-    if((payloadLen + payloadIndex) > bufferLen) {
+    if(wsFrameSize(payloadLen, mask) > bufferLen) {
         printf("WEBSOCKET BUFFER OVERFLOW \r\n");
         return 1;
     }
 
-    // Copy in payload
-    if ( buffer!=NULL ) {
-        // memcpy(buffer + payloadIndex, payload, payloadLen);
-        for(int i = 0; i < payloadLen; i++) {
-            // mask bytes if required
-            if(header.meta.bits.MASK) {
-                buffer[payloadIndex + i] = payload[i] ^ header.mask.maskBytes[i%4];
-            } else {
-                buffer[payloadIndex + i] = payload[i];
-            }
+    uint32_t payloadIndex = wsBuildHeader((uint8_t *)buffer, opcode, payloadLen, mask, maskBytes);
+
+    // Copy in payload, masking if required
+    if ( payloadLen>0 ) {
+        if(mask) {
+            wsMask( (uint8_t *)buffer + payloadIndex, (const uint8_t *)payload, (uint32_t)payloadLen, maskBytes, 0 );
+        } else {
+            memcpy(buffer + payloadIndex, payload, payloadLen);
         }
     }
 
     return (payloadIndex + payloadLen);
+}
+
+static uint8_t wsHeaderSize( const uint8_t *buffer )
+{
+    uint8_t size = 2;
+    uint8_t payloadLen = buffer[1] & 0x7F;
+
+    if ( payloadLen == 126 ) {
+        size += 2;
+    } else if ( payloadLen == 127 ) {
+        size += 8;
+    }
+    if ( buffer[1] & 0x80 ) {
+        size += 4;
+    }
 
+    return size;
 }
 
-static bool wsParsePacket(WebsocketPacketHeader_t *header, char* buffer, uint32_t len)
+static bool wsParseHeader(WebsocketPacketHeader_t *header, const uint8_t* buffer, uint32_t len)
 {
-    if ( header != NULL && buffer!= NULL && len>=2 ) {
+    if ( header != NULL && buffer!= NULL && len>=2 && len>=wsHeaderSize(buffer) ) {
 
         memset( (void*)header, 0, sizeof(*header) );
 
-        header->meta.bytes.byte0 = (uint8_t) buffer[0];
-        header->meta.bytes.byte1 = (uint8_t) buffer[1];
+        header->meta.bytes.byte0 = buffer[0];
+        header->meta.bytes.byte1 = buffer[1];
 
         // Payload length
         int payloadIndex = 2;
         header->length = header->meta.bits.PAYLOADLEN;
 
         if(header->meta.bits.PAYLOADLEN == 126) {
-            header->length = buffer[2] << 8 | buffer[3];
+            header->length = (uint64_t)buffer[2] << 8 | buffer[3];
             payloadIndex = 4;
         }
         
         if(header->meta.bits.PAYLOADLEN == 127) {
-            header->length = buffer[6] << 24 | buffer[7] << 16 | buffer[8] << 8 | buffer[9];
+            header->length = 0;
+            for ( int i = 2 ; i < 10 ; i++ ) {
+                header->length = header->length << 8 | buffer[i];
+            }
             payloadIndex = 10;
         }
 
@@ -233,11 +540,6 @@ static bool wsParsePacket(WebsocketPacketHeader_t *header, char* buffer, uint32_
             header->mask.maskBytes[2] = buffer[payloadIndex + 2];
             header->mask.maskBytes[3] = buffer[payloadIndex + 3];
             payloadIndex = payloadIndex + 4;    
-            
-            // Decrypt    
-            for(uint64_t i = 0; i < header->length; i++) {
-                    buffer[payloadIndex + i] = buffer[payloadIndex + i] ^ header->mask.maskBytes[i%4];
-            }
         }
 
         // Payload start
@@ -250,406 +552,1445 @@ static bool wsParsePacket(WebsocketPacketHeader_t *header, char* buffer, uint32_
 
 }
 
-#ifndef WIZNET_BOARD
-
-static err_t wsSent(void *arg, struct tcp_pcb *tpcb, u16_t len) {
-    WebSocketClient_t *state = (WebSocketClient_t*)arg;
-    return ERR_OK;
+static void wsDecoderReset( WebSocketDecoder_t *decoder )
+{
+    decoder->state = WS_DECODE_HEADER;
+    decoder->header_len = 0;
+    decoder->header_need = 2;
+    decoder->payload_received = 0;
+    decoder->sink = WS_SINK_CONTROL;
+    decoder->message_opcode = WEBSOCKET_OPCODE_CONTINUE;
+    decoder->message_len = 0;
+    decoder->close_code = 0;
+    decoder->message_compressed = false;
+    decoder->check_utf8 = false;
+    decoder->utf8_state = 0;
 }
 
-#endif
+static void wsQueueInit( WebSocketQueue_t *queue )
+{
+    for ( unsigned i = 0 ; i < WS_QUEUE_DEPTH ; i++ ) {
+        atomic_init( &queue->cells[i].sequence, i );
+        queue->cells[i].frame = NULL;
+    }
+    atomic_init( &queue->enqueue_pos, 0 );
+    atomic_init( &queue->dequeue_pos, 0 );
+    atomic_init( &queue->drops, 0 );
+    atomic_init( &queue->high_water, 0 );
+}
 
-bool wsSendOpCode( WebSocketClient_p client, enum WebSocketOpCode opCode )
+// Adds a frame to the queue, safe from any context, returns false if the queue is full
+static bool wsQueuePush( WebSocketQueue_t *queue, uint8_t *frame, uint32_t len, uint8_t deflate_opcode )
 {
-    WebSocketClient_t *state = (WebSocketClient_t *)client;
-    bool result = false;
+    WebSocketQueueCell_t *cell;
+    unsigned pos = atomic_load_explicit( &queue->enqueue_pos, memory_order_relaxed );
+
+    for (;;) {
+        cell = &queue->cells[pos & (WS_QUEUE_DEPTH-1)];
+        unsigned sequence = atomic_load_explicit( &cell->sequence, memory_order_acquire );
+        int diff = (int)(sequence - pos);
+        if ( diff == 0 ) {
+            // the cell is free for this lap, claim it (pos is reloaded if another producer won)
+            if ( atomic_compare_exchange_weak_explicit( &queue->enqueue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed ) ) {
+                break;
+            }
+        } else if ( diff < 0 ) {
+            // the consumer hasn't released the cell from the previous lap
+            return false;
+        } else {
+            pos = atomic_load_explicit( &queue->enqueue_pos, memory_order_relaxed );
+        }
+    }
 
-    #ifdef WIZNET_BOARD
-    int buffer_len = wsBuildPacket((char *)state->send_buf, BUF_SIZE, opCode, NULL, 0, 1);
-    result = ( httpc_send_body(state->send_buf, buffer_len) == buffer_len );
-    #else
-    state->buffer_len = wsBuildPacket((char *)state->en, BUF_SIZE, opCode, NULL, 0, 1);
-    result = ( tcp_write(state->tcp_pcb, state->en, state->buffer_len, TCP_WRITE_FLAG_COPY) == ERR_OK );
-    #endif
+    cell->frame = frame;
+    cell->len = len;
+    cell->deflate_opcode = deflate_opcode;
+    cell->queued_us = (uint32_t)to_us_since_boot(get_absolute_time());
+    atomic_store_explicit( &cell->sequence, pos + 1, memory_order_release );
+
+    // an atomic max, so a producer racing this one can't overwrite a deeper mark with its own
+    unsigned depth = pos + 1 - atomic_load_explicit( &queue->dequeue_pos, memory_order_relaxed );
+    unsigned high = atomic_load_explicit( &queue->high_water, memory_order_relaxed );
+    while ( depth > high && !atomic_compare_exchange_weak_explicit( &queue->high_water, &high, depth,
+                                                                    memory_order_relaxed, memory_order_relaxed ) ) {
+    }
 
-    return result;
+    return true;
 }
 
-#ifdef WIZNET_BOARD
-static err_t wsConnected(void *arg, err_t err)
-#else
-static err_t wsConnected(void *arg, struct tcp_pcb *tpcb, err_t err)
-#endif
+// Returns the oldest frame without removing it, or NULL if none is ready, consumer only
+static WebSocketQueueCell_t *wsQueuePeek( WebSocketQueue_t *queue )
 {
-    WebSocketClient_t *state = (WebSocketClient_t*)arg;
-    if (err != ERR_OK) {
-        printf("WebSocket connect failed %d\n", err);
-        return ERR_ABRT;
-    }
- 
-    uint32_t now = to_ms_since_boot(get_absolute_time());
-    state->upgraded = false;
-    state->lastPing = now;
+    unsigned pos = atomic_load_explicit( &queue->dequeue_pos, memory_order_relaxed );
+    WebSocketQueueCell_t *cell = &queue->cells[pos & (WS_QUEUE_DEPTH-1)];
 
-    printf("Requesting WebSocket upgrade...\n");
-    // Write HTTP GET Request with Websocket upgrade
-    #ifdef WIZNET_BOARD
-    uint8_t *buffer = state->send_buf;
-    #else
-    uint8_t *buffer = state->en;
-    #endif
-    // Use hostname for Host header if available, otherwise use IP
-    const char *host_header = state->hostname ? state->hostname :
-    #ifdef WIZNET_BOARD
-        state->remote_addr;
-    #else
-        ip4addr_ntoa(&state->remote_addr);
-    #endif
-    int len = sprintf( (char *)buffer,
-        "GET / HTTP/1.1\r\n"
-        "Host: %s:%d\r\n"
-        "Upgrade: websocket\r\n"
-        "Connection: Upgrade\r\n"
-        "Sec-WebSocket-Key: x3JJHMbDL1EzLkh9GBhXDw==\r\n"
-        "Sec-WebSocket-Version: 13\r\n"
-        "%s\r\n",
-        host_header, state->remote_port,
-        state->additional_headers?state->additional_headers:"");
+    if ( atomic_load_explicit( &cell->sequence, memory_order_acquire ) != pos + 1 ) {
+        return NULL;
+    }
+    return cell;
+}
 
-    #ifdef WIZNET_BOARD
-    //printf("[%.*s](%d)\n",len,state->send_buf,len);
-    // Send HTTP requset as message body
-    httpc_send_body(buffer, len); 
-    #else
-    state->buffer_len = len;
-    //printf("[%.*s]\n",state->buffer_len,state->en);
-    err = tcp_write(state->tcp_pcb, state->en, state->buffer_len, TCP_WRITE_FLAG_COPY);
-    #endif 
+// Releases the cell returned by wsQueuePeek back to the producers, consumer only
+static void wsQueuePop( WebSocketQueue_t *queue )
+{
+    unsigned pos = atomic_load_explicit( &queue->dequeue_pos, memory_order_relaxed );
+    WebSocketQueueCell_t *cell = &queue->cells[pos & (WS_QUEUE_DEPTH-1)];
 
-    state->connected = TCP_CONNECTED;
-    return ERR_OK;
+    cell->frame = NULL;
+    atomic_store_explicit( &queue->dequeue_pos, pos + 1, memory_order_relaxed );
+    atomic_store_explicit( &cell->sequence, pos + WS_QUEUE_DEPTH, memory_order_release );
 }
 
-#ifndef WIZNET_BOARD
+// Discards every queued frame, consumer only
+static void wsQueueFlush( WebSocketQueue_t *queue )
+{
+    WebSocketQueueCell_t *cell;
 
-static err_t wsPoll(void *arg, struct tcp_pcb *tpcb) {
-    return ERR_OK;
+    while ( (cell = wsQueuePeek( queue )) != NULL ) {
+        free( cell->frame );
+        wsQueuePop( queue );
+    }
 }
 
-#endif
+#if WS_DEFLATE
+/*  Compresses a queued payload into a frame with RSV1 set, done as it is sent so
+ *  the history shared with the server follows the order frames go out. If the
+ *  extension wasn't negotiated on this connection the payload is framed as is.
+ *  Returns false if out of memory, the cell is left to try again.
+ */
+static bool wsDeflateCell( WebSocketClient_t *state, WebSocketQueueCell_t *cell )
+{
+    uint8_t *frame = (uint8_t *)malloc( WS_MAX_HEADER_SIZE + DEFLATE_BOUND(cell->len) );
+    uint32_t frame_len;
 
-static err_t wsClose(void *arg) {
-    WebSocketClient_t *state = (WebSocketClient_t*)arg;
-    err_t err = ERR_ABRT;
-
-    #ifdef WIZNET_BOARD
-    httpc_disconnect();
-    #else
-    if (state->tcp_pcb != NULL) {
-        tcp_arg(state->tcp_pcb, NULL);
-        tcp_poll(state->tcp_pcb, NULL, 0);
-        tcp_sent(state->tcp_pcb, NULL);
-        tcp_recv(state->tcp_pcb, NULL);
-        tcp_err(state->tcp_pcb, NULL);
-        err = tcp_close(state->tcp_pcb);
-        if (err != ERR_OK) {
-            printf("WebSocket close failed %d, calling abort\n", err);
-            tcp_abort(state->tcp_pcb);
-            err = ERR_ABRT;
-        }
-        state->tcp_pcb = NULL;
+    if ( frame == NULL ) {
+        return false;
     }
-    #endif
-
-    state->connected = TCP_DISCONNECTED;
-    state->upgraded = false;
 
-    if ( state->auto_reconnect ) {
-        // Reconnect
-        wsConnect( (WebSocketClient_p)state );
+    if ( state->deflate_active ) {
+        // compress after room for the largest header, then build the header in front of it
+        uint8_t *payload = frame + WS_MAX_HEADER_SIZE;
+        int payload_len = deflate_message( state->deflater, cell->frame, cell->len, payload, DEFLATE_BOUND(cell->len) );
+        uint32_t header_len = wsFrameSize( payload_len, 1 ) - payload_len;
+        uint8_t *start = payload - header_len;
+        frame_len = wsBuildPacket((char *)start, header_len + payload_len, cell->deflate_opcode, (char *)payload, payload_len, 1);
+        start[0] |= WS_RSV1 << 4;
+        memmove( frame, start, frame_len );
+        if ( state->deflate_reset_tx ) {
+            deflate_reset( state->deflater, state->deflate_tx_bits );
+        }
+    } else {
+        frame_len = wsBuildPacket((char *)frame, wsFrameSize( cell->len, 1 ), cell->deflate_opcode, (char *)cell->frame, cell->len, 1);
     }
 
-    return err;
+    free( cell->frame );
+    cell->frame = frame;
+    cell->len = frame_len;
+    cell->deflate_opcode = 0;
+    return true;
 }
 
-#ifndef WIZNET_BOARD
+/*  Takes up the window and takeover wsSetDeflate asked for, only while no connection
+ *  is using them. Nothing is allocated until a server accepts the offer.
+ */
+static void wsDeflateApply( WebSocketClient_t *state )
+{
+    state->deflate_window_bits = state->deflate_request_bits;
+    state->deflate_context_takeover = state->deflate_request_takeover;
+}
 
-static void wsError(void *arg, err_t err) {
-    WebSocketClient_t *state = (WebSocketClient_t*)arg;
-    state->connected = TCP_DISCONNECTED;
-    state->upgraded = false;
-    if (err != ERR_ABRT) {
-        printf("WebSocket Client Error %d\n", err);
-    } else {
-        printf("WebSocket Client Error abort %d\n", err);
-    }
+// Frees the compressor and decompressor, they belong to the connection that negotiated them
+static void wsDeflateRelease( WebSocketClient_t *state )
+{
+    state->deflate_active = false;
+    deflate_destroy( state->deflater );
+    inflate_destroy( state->inflater );
+    free( state->inflate_buffer );
+    state->deflater = NULL;
+    state->inflater = NULL;
+    state->inflate_buffer = NULL;
+}
+#endif
 
-    wsClose( state );
+// Maps an opcode to its wsStats_t frame counter, opcodes the decoder rejects aren't counted
+static int wsStatsIndex( uint8_t opcode )
+{
+    return opcode >= WEBSOCKET_OPCODE_CLOSE ? opcode - WEBSOCKET_OPCODE_CLOSE + WS_STATS_CLOSE : opcode;
 }
 
-#endif
+// Changes the connection state, adding the time spent in the old one to the stats
+static void wsSetState( WebSocketClient_t *state, int connected )
+{
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    state->stats.state_ms[state->connected] += now - state->state_since;
+    state->state_since = now;
+    state->connected = connected;
+}
 
-#ifdef WIZNET_BOARD
-err_t wsReceive(void *arg, err_t err) 
-#else
-err_t wsReceive(void *arg, struct tcp_pcb *tpcb, struct pbuf *p, err_t err) 
-#endif
+/*  Moves queued frames on to the connection, highest priority first, stopping as
+ *  soon as the transport won't take the head frame so lower priorities never
+ *  overtake it, then sends them in one flush. Must be called from the
+ *  transport's context (wsHandler or one of the wsTransport callbacks).
+ */
+static void wsWriteQueued( WebSocketClient_t *state )
 {
-    WebSocketClient_t *state = (WebSocketClient_t*)arg;
-    bool reply_pong = false;
-    uint8_t *buffer = NULL;
-    int buffer_len = 0;
+    const wsTransport_t *transport = state->transport;
+    bool written = false;
 
-#ifndef WIZNET_BOARD
-    if (!p) {
-        // return tcp_result(arg, -1);
+    if ( !state->upgraded || state->connected != TCP_CONNECTED ) {
+        return;
     }
-    // this method is callback from lwIP, so cyw43_arch_lwip_begin is not required, however you
-    // can use this method to cause an assertion in debug mode, if this method is called when
-    // cyw43_arch_lwip_begin IS needed
-    cyw43_arch_lwip_check();
-    state->rx_buffer_len = 0;
+    uint32_t now_us = (uint32_t)to_us_since_boot(get_absolute_time());
 
-    if(p == NULL) {
-        // Close
-        wsClose(arg);
-        return ERR_OK;
-    }
+    for ( int priority = 0 ; priority < WS_PRIORITY_COUNT ; priority++ ) {
+        WebSocketQueue_t *queue = &state->queue[priority];
+        WebSocketQueueCell_t *cell;
 
-    if (p->tot_len > 0) {
-        for (struct pbuf *q = p; q != NULL; q = q->next) {
-            if((state->rx_buffer_len + q->len) < BUF_SIZE) {
-                memcpy(state->rx_buffer + state->rx_buffer_len, (uint8_t *)q->payload, q->len );
-                state->rx_buffer_len += q->len;
+        while ( (cell = wsQueuePeek( queue )) != NULL ) {
+            #if WS_DEFLATE
+            if ( cell->deflate_opcode != 0 && !wsDeflateCell( state, cell ) ) {
+                goto done;
             }
-        }
-
-        buffer_len = state->rx_buffer_len;
-        buffer = state->rx_buffer;
-#else 
-        buffer_len = httpc_recv(state->recv_buf, httpc_isReceived);
-        buffer = state->recv_buf;
-#endif        
-
-        if ( state->upgraded  ) {
-            WebsocketPacketHeader_t header;
-            wsParsePacket(&header, (char *)buffer, buffer_len);
-
-            switch( header.meta.bits.OPCODE ) {
-                case WEBSOCKET_OPCODE_PING:
-                    // send pong
-                    uint32_t now = to_ms_since_boot(get_absolute_time());
-                    printf("WebSocket received PING (@ %d s)\n", (int)(now-state->lastPing)/1000);
-                    state->lastPing = now;
-                    reply_pong = true;
-                    break;
-                case WEBSOCKET_OPCODE_CLOSE:
-                    // close connection
-                    int64_t error = -1;
-                    if ( header.length == 2 ) {
-                        error = ((uint8_t *)buffer + header.start)[0]<<8 | ((uint8_t *)buffer + header.start)[1];
-                    }
-                    printf("WebSocket connection close (%lld)\n",error);
-                    break;
-                case WEBSOCKET_OPCODE_TEXT:
-                    printf("WebSocket received data (Op Code %d)\n",header.meta.bits.OPCODE);
-                    buffer += header.start;
-                    buffer_len = header.length;
-                    break;
-                case WEBSOCKET_OPCODE_BIN:
-                case WEBSOCKET_OPCODE_CONTINUE:
-                default:
-                    printf("WebSocket eceived unknown or unsupported data (Op Code %d)\n",header.meta.bits.OPCODE);
-                    break;
+            #endif
+            // control frames are tiny and a CLOSE must survive the close that follows, so copy those
+            bool copy = ( priority == WS_PRIORITY_CONTROL );
+            if ( !transport->writable( state->transport_state, cell->len ) || ( !copy && wsTxSlotsFree( state ) == 0 ) ) {
+                goto done;
             }
-            if ( header.meta.bits.OPCODE==WEBSOCKET_OPCODE_TEXT && buffer_len>0 ) {
-                //printf("tcp_recved [%.*s]\n",buffer_len,buffer);
-                if ( buffer_len>=2 && buffer[0]=='{' ) {
-                    if ( state->messageHandler ) {
-                        if ( buffer_len>=BUF_SIZE ) {
-                            buffer_len=BUF_SIZE-1;
-                        }
-                        buffer[buffer_len] = 0;
-                        (state->messageHandler)( (WebSocketClient_p)state, (char *)buffer, buffer_len);
-                    }
-                }
+            // the transport owns the frame once it is written
+            uint32_t len = cell->len;
+            uint8_t opcode = cell->frame[0] & 0x0F;
+            if ( !transport->write( state->transport_state, cell->frame, len, copy ) ) {
+                state->stats.write_failures++;
+                goto done;
             }
-        } else {
-            if ( strnstr((char *)buffer, "HTTP/1.1 101", buffer_len) != NULL &&
-                    strnstr((char *)buffer, "Connection: upgrade", buffer_len) != NULL &&
-                        strnstr((char *)buffer, "Upgrade: websocket", buffer_len) != NULL ) {
-                //printf("tcp_recved [%.*s]\n",buffer_len,buffer);
-                printf("WebSocket upgrade acknowladged\n");
-                state->upgraded = true;
-            }            
+            state->stats.tx_bytes += len;
+            state->stats.tx_frames[wsStatsIndex( opcode )]++;
+            state->stats.tx_latency_us += now_us - cell->queued_us;
+            written = true;
+            wsQueuePop( queue );
         }
-
-#ifndef WIZNET_BOARD        
-        tcp_recved(tpcb, p->tot_len);
     }
-    pbuf_free(p);
-#endif
 
-    if ( reply_pong ) {
-        // send pong
-        if ( wsSendOpCode( arg, WEBSOCKET_OPCODE_PONG ) ) {
-            printf("WebSocket sent PONG (%d)\n", buffer_len);
-        } else {    
-            printf("WebSocket PONG send failed!\n");
-        }
+done:
+    if ( written ) {
+        state->stats.tx_segments += transport->flush( state->transport_state );
+        state->stats.tx_flushes++;
     }
-
-    return ERR_OK;
 }
 
-#ifndef WIZNET_BOARD
-
-static err_t wsTCPConnect(void *arg) 
+// Writes queued frames unless the client is corked
+static void wsDrain( WebSocketClient_t *state )
 {
-    WebSocketClient_t *state = (WebSocketClient_t*)arg;
-    err_t err = ERR_ABRT;
+    if ( atomic_load_explicit( &state->cork, memory_order_acquire ) == 0 ) {
+        wsWriteQueued( state );
+    }
+}
 
-    if(state->connected != TCP_DISCONNECTED) return ERR_OK;
+// Queues a frame built by the caller, on failure it is freed and counted as a drop
+static bool wsQueueBuilt( WebSocketClient_t *state, wsPriority_t priority, uint8_t *frame, uint32_t frame_len, uint8_t deflate_opcode )
+{
+    WebSocketQueue_t *queue = &state->queue[priority];
 
-    state->tcp_pcb = tcp_new_ip_type(IP_GET_TYPE(&state->remote_addr));
-    if (!state->tcp_pcb) {
-        return ERR_ABRT;
+    if ( !wsQueuePush( queue, frame, frame_len, deflate_opcode ) ) {
+        free( frame );
+        atomic_fetch_add_explicit( &queue->drops, 1, memory_order_relaxed );
+        return false;
     }
 
-    tcp_arg(state->tcp_pcb, state);
-    tcp_poll(state->tcp_pcb, wsPoll, 1);
-    tcp_sent(state->tcp_pcb, wsSent);
-    tcp_recv(state->tcp_pcb, wsReceive);
-    tcp_err(state->tcp_pcb, wsError);
-
-    state->buffer_len = 0;
-    // cyw43_arch_lwip_begin/end should be used around calls into lwIP to ensure correct locking.
-    // You can omit them if you are in a callback from lwIP. Note that when using pico_cyw_arch_poll
-    // these calls are a no-op and can be omitted, but it is a good practice to use them in
-    // case you switch the cyw43_arch type later.
-    cyw43_arch_lwip_begin();
-    err = tcp_connect(state->tcp_pcb, &state->remote_addr, state->remote_port, wsConnected);
-    cyw43_arch_lwip_end();
-    state->connected = TCP_CONNECTING;
-    state->upgraded = false;
+    // rather than waiting for the next poll, replies to what is being received go together when it's done
+    if ( state->low_latency && !state->receiving && state->transport->kick != NULL && atomic_load_explicit( &state->cork, memory_order_relaxed ) == 0 ) {
+        state->transport->kick( state->transport_state );
+    }
 
-    return err;
+    return true;
 }
 
-#endif
-
-//===============================================================================================================
-
-/*! \brief Initialises a WebSocket for connection
- *  \ingroup Websocket.c
- *
- * \param server ip address of target server
- * \param hostname hostname of target server (for Host header), can be NULL
- * \param port port on which to connect
- * \param messageHandler callback to handle received messages
- * \param additioonalHeaders additional headers to include in the connect
- * \param autoReconnect automatically reconnect if the connection is closed
- * \return handle to a WebSocket client
+/*  Builds a frame from one or more pieces and queues it for sending, may be called
+ *  from any context. Each piece is masked straight into the frame so callers don't
+ *  have to join them first, and the lwIP context only has to hand the frame over.
  */
-WebSocketClient_p wsCreate( const char *server, const char *hostname, uint16_t port, wsMessagehandler messageHandler, char *additionalHeaders, bool autoReconnect )
+static bool wsQueueFramev( WebSocketClient_t *state, wsPriority_t priority, enum WebSocketOpCode opCode, const wsIovec_t *iov, int iovcnt )
 {
-    WebSocketClient_t *state = (WebSocketClient_t *)calloc(1, sizeof(WebSocketClient_t));
-    if (!state) {
-        printf("Failed to allocate WebSocket client\n");
-        return NULL;
+    WebSocketQueue_t *queue = &state->queue[priority];
+    size_t len = 0;
+
+    for ( int i = 0 ; i < iovcnt ; i++ ) {
+        len += iov[i].len;
     }
 
-    #ifdef WIZNET_BOARD
-        state->remote_addr = strdup( server );
-    #else
-        ip4addr_aton(server, &state->remote_addr);
+    uint32_t frame_len = wsFrameSize( len, 1 );
+    uint32_t largest = frame_len;
+    uint8_t deflate_opcode = 0;
+    uint8_t *frame = NULL;
+
+    #if WS_DEFLATE
+    // data is compressed when it is sent, until then only the payload is kept
+    if ( state->deflate_active && ( opCode == WEBSOCKET_OPCODE_TEXT || opCode == WEBSOCKET_OPCODE_BIN ) ) {
+        deflate_opcode = opCode;
+        largest = WS_MAX_HEADER_SIZE + DEFLATE_BOUND(len);
+    }
     #endif
-    state->hostname = hostname ? strdup(hostname) : NULL;
-    state->remote_port = port;
-    state->messageHandler = messageHandler;
-    if ( additionalHeaders ) {
-        state->additional_headers = strdup(additionalHeaders);
+
+    if ( len <= state->tx_capacity && largest <= state->transport->max_frame ) {
+        frame = (uint8_t *)malloc( deflate_opcode ? len + 1 : frame_len );
+    }
+    if ( frame == NULL ) {
+        atomic_fetch_add_explicit( &queue->drops, 1, memory_order_relaxed );
+        return false;
     }
-    state->auto_reconnect = autoReconnect;
 
-    return( (WebSocketClient_p)state );
+    uint32_t header_len = 0;
+    uint8_t maskBytes[4];
+    if ( deflate_opcode ) {
+        frame_len = len;
+    } else {
+        header_len = wsBuildHeader( frame, opCode, len, 1, maskBytes );
+    }
+    for ( uint32_t i = 0, pos = header_len ; i < (uint32_t)iovcnt ; pos += iov[i].len, i++ ) {
+        if ( deflate_opcode ) {
+            memcpy( frame + pos, iov[i].base, iov[i].len );
+        } else {
+            // the mask carries on from where the previous piece finished
+            wsMask( frame + pos, (const uint8_t *)iov[i].base, iov[i].len, maskBytes, pos - header_len );
+        }
+    }
+    return wsQueueBuilt( state, priority, frame, frame_len, deflate_opcode );
 }
 
-/*! \brief Connects a client to the server
- *  \ingroup Websocket.c
- *
- * \param client handle of client to connect
- * \return true if succesful
- */
-bool wsConnect( WebSocketClient_p client )
+static bool wsQueueFrame( WebSocketClient_t *state, wsPriority_t priority, enum WebSocketOpCode opCode, char *payload, size_t len )
 {
-    bool result = false;
-    WebSocketClient_t *state = (WebSocketClient_t *)client;
-    #ifdef WIZNET_BOARD
-        uint8_t server_ip[4];
-        //printf("WebSocket parsing server ip address [%s]\n",state->remote_addr);
-        if ( sscanf(state->remote_addr, "%hhu.%hhu.%hhu.%hhu", &server_ip[0], &server_ip[1], &server_ip[2], &server_ip[3]) == 4 ) {
-            //printf("WebSocket parsed server ip address [%d][%d][%d][%d]\n", server_ip[0], server_ip[1], server_ip[2], server_ip[3]);
-            if ( httpc_init(0, server_ip, state->remote_port, state->send_buf, state->recv_buf) == HTTPC_TRUE) {
-                printf("WebSocket connecting to %s:%u\n", state->remote_addr, state->remote_port);
-                result = true;
-            } else {
-                printf("WebSocket HTTP Client initialise failed\n");
-            }
-        } else {
-            printf("WebSocket invalid server ip address [%s]",state->remote_addr);
-        }
-    #else
-        printf("WebSocket connecting to %s:%u\n", ip4addr_ntoa(&state->remote_addr), state->remote_port);
-        result = ( wsTCPConnect(state)==ERR_OK );
-    #endif
+    wsIovec_t iov = { payload, len };
+    return wsQueueFramev( state, priority, opCode, &iov, 1 );
+}
+
+bool wsSendOpCode( WebSocketClient_p client, enum WebSocketOpCode opCode )
+{
+    return wsQueueFrame( (WebSocketClient_t *)client, WS_PRIORITY_CONTROL, opCode, NULL, 0 );
+}
+
+// Queues a CLOSE and sends it straight away, corked or not, only from lwIP context (or wsHandler)
+static bool wsSendClose( WebSocketClient_t *state, uint16_t code )
+{
+    char payload[2] = { (char)(code >> 8), (char)(code & 0xFF) };
+    bool result = wsQueueFrame( state, WS_PRIORITY_CONTROL, WEBSOCKET_OPCODE_CLOSE, payload, sizeof(payload) );
+    wsWriteQueued( state );
     return result;
 }
 
-/*! \brief Destroys a client freeing resourcxes
- *  \ingroup Websocket.c
- *
- * \param client handle of client to connect
- * \return true if succesful
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+/*  Makes a fresh Sec-WebSocket-Key for this connection and works out the
+ *  Sec-WebSocket-Accept the server must answer with (RFC 6455 section 4.1).
  */
-bool wsDestroy( WebSocketClient_p client )
+static void wsUpgradeStart( WebSocketClient_t *state, char key[25] )
 {
-    WebSocketClient_t *state = (WebSocketClient_t *)client;
-    state->auto_reconnect = false;
-    wsClose( state );
-    #ifdef WIZNET_BOARD
-    if ( state->remote_addr ) {
-        free(state->remote_addr);
-    }
-    #endif
-    if ( state->hostname ) {
-        free(state->hostname);
-    }
-    if ( state->additional_headers ) {
-        free(state->additional_headers);
-    }
-    if ( client ) {
-        free( client );
+    uint8_t nonce[16];
+    for ( int i = 0; i < (int)sizeof(nonce); i += 4 ) {
+        uint32_t r = get_rand_32();
+        memcpy( nonce + i, &r, 4 );
     }
+    base64_encode( (const char *)nonce, sizeof(nonce), key );
 
-    return true;
+    char concat[24 + sizeof(WS_GUID)];
+    memcpy( concat, key, 24 );
+    memcpy( concat + 24, WS_GUID, sizeof(WS_GUID) - 1 );
+    SHA1_HASH hash;
+    Sha1Calculate( concat, sizeof(concat) - 1, &hash );
+
+    memset( &state->upgrade, 0, sizeof(state->upgrade) );
+    state->upgrade.state = WS_UPGRADE_STATUS;
+    base64_encode( (const char *)hash.bytes, SHA1_HASH_SIZE, state->upgrade.accept );
 }
 
-/*! \brief Returns the current connection state
- *  \ingroup Websocket.c
- *
- * \param client handle of client to connect
- * \return connection state TCP_DISCONNECTED, TCP_CONNECTING, or TCP_CONNECTED
+/*  The connection is up, sends the HTTP GET request asking for the upgrade.
  */
-int wsConnectState( WebSocketClient_p client )
+void wsTransportConnected( WebSocketClient_p client )
+{
+    WebSocketClient_t *state = (WebSocketClient_t*)client;
+ 
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    state->upgraded = false;
+    state->lastPing = now;
+    state->peer_close_code = 0;
+    wsDecoderReset( &state->decoder );
+    char key[25];
+    wsUpgradeStart( state, key );
+
+    printf("Requesting WebSocket upgrade...\n");
+    // Use hostname for Host header if available, otherwise use IP
+    const char *host_header = state->hostname ? state->hostname : state->server;
+    char extensions[192] = "";
+    #if WS_DEFLATE
+    state->deflate_active = false;
+    wsDeflateApply( state );
+    if ( state->deflate_window_bits != 0 ) {
+        int extensions_len = snprintf( extensions, sizeof(extensions),
+            "Sec-WebSocket-Extensions: permessage-deflate; client_max_window_bits=%d; server_max_window_bits=%d%s\r\n",
+            state->deflate_window_bits, state->deflate_window_bits,
+            state->deflate_context_takeover ? "" : "; client_no_context_takeover; server_no_context_takeover" );
+        if ( extensions_len < 0 || extensions_len >= (int)sizeof(extensions) ) {
+            printf("WebSocket permessage-deflate offer too long, not offered\n");
+            extensions[0] = '\0';
+        }
+    }
+    #endif
+    char fields[160];
+    int len = sprintf( fields,
+        ":%d\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Key: %s\r\n"
+        "Sec-WebSocket-Version: 13\r\n",
+        state->remote_port, key );
+
+    // Write HTTP GET Request with Websocket upgrade, the transport copies the pieces
+    const char *additional = state->additional_headers ? state->additional_headers : "";
+    wsIovec_t request[] = {
+        { "GET / HTTP/1.1\r\nHost: ", 22 },
+        { host_header, strlen(host_header) },
+        { fields, (size_t)len },
+        { extensions, strlen(extensions) },
+        { additional, strlen(additional) },
+        { "\r\n", 2 }
+    };
+    if ( state->transport->writev( state->transport_state, request, sizeof(request)/sizeof(request[0]) ) ) {
+        for ( size_t i = 0 ; i < sizeof(request)/sizeof(request[0]) ; i++ ) {
+            state->stats.tx_bytes += request[i].len;
+        }
+    } else {
+        printf("WebSocket upgrade request failed\n");
+        state->stats.write_failures++;
+    }
+    state->stats.tx_segments += state->transport->flush( state->transport_state );
+    state->stats.tx_flushes++;
+
+    state->stats.connect_ms = now - state->connect_started;
+    state->connected_at = now;
+    wsSetState( state, TCP_CONNECTED );
+}
+
+/*  Delay before the next connect attempt plus or minus WS_RECONNECT_JITTER percent.
+ */
+static uint32_t wsJitter( uint32_t delay )
+{
+    uint32_t spread = delay / 100 * WS_RECONNECT_JITTER;
+    if ( spread == 0 ) {
+        return delay;
+    }
+    return delay - spread + get_rand_32() % (2 * spread + 1);
+}
+
+/*  Picks when to try again after a connection is lost or an attempt fails. Network
+ *  errors and most close codes back off exponentially, a rejected login waits
+ *  WS_RECONNECT_AUTH_DELAY as retrying sooner won't change the answer, and 1013
+ *  (try again later) waits the longest backoff.
+ */
+static void wsReconnectSchedule( WebSocketClient_t *state, bool was_upgraded )
+{
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    uint16_t code = state->peer_close_code;
+    uint32_t delay;
+
+    // a connection that outlasted the longest backoff was healthy, start again from the shortest
+    if ( was_upgraded && now - state->upgraded_at >= state->reconnect_max ) {
+        state->reconnect_failures = 0;
+    }
+
+    if ( code == 1008 || (!was_upgraded && (state->upgrade.status == 401 || state->upgrade.status == 403)) ) {
+        delay = WS_RECONNECT_AUTH_DELAY;
+        state->reconnect_stats.auth_failures++;
+    } else if ( code == 1013 ) {
+        delay = state->reconnect_max;
+    } else {
+        delay = state->reconnect_min;
+        for ( int i = 0 ; i < state->reconnect_failures && delay < state->reconnect_max ; i++ ) {
+            delay *= 2;
+        }
+        if ( delay > state->reconnect_max ) {
+            delay = state->reconnect_max;
+        }
+    }
+    if ( state->reconnect_failures < UINT8_MAX ) {
+        state->reconnect_failures++;
+    }
+
+    delay = wsJitter( delay );
+    state->reconnect_stats.last_close_code = code;
+    state->reconnect_at = now + delay;
+    state->reconnect_pending = true;
+    printf("WebSocket reconnecting in %d ms\n", (int)delay);
+}
+
+/*  Frees rx_buffer and the permessage-deflate state between connections, not while
+ *  received data is being decoded.
+ */
+static void wsRxBufferRelease( WebSocketClient_t *state )
+{
+    if ( !state->receiving ) {
+        free( state->rx_buffer );
+        state->rx_buffer = NULL;
+        #if WS_DEFLATE
+        wsDeflateRelease( state );
+        #endif
+    }
+}
+
+static void wsClose( WebSocketClient_t *state )
+{
+    bool was_upgraded = state->upgraded;
+
+    state->transport->close( state->transport_state );
+
+    wsSetState( state, TCP_DISCONNECTED );
+    state->upgraded = false;
+    // control frames belong to this connection, anything else can wait for the next
+    wsQueueFlush( &state->queue[WS_PRIORITY_CONTROL] );
+    wsRxBufferRelease( state );
+
+    if ( was_upgraded ) {
+        state->down = true;
+        state->down_since = to_ms_since_boot(get_absolute_time());
+    }
+    if ( state->auto_reconnect && !state->disconnect_requested ) {
+        // reconnected from wsHandler, not from inside the lwIP callback that closed us
+        wsReconnectSchedule( state, was_upgraded );
+    }
+}
+
+/*  The connection failed or the server closed it.
+ */
+void wsTransportClosed( WebSocketClient_p client )
+{
+    wsClose( (WebSocketClient_t *)client );
+}
+
+/*  Sends a PING each keepalive interval, a PING still unanswered when the next is
+ *  due counts as missed and after keepalive_misses the connection is closed,
+ *  rather than waiting for TCP to notice a half open connection.
+ */
+static void wsKeepalive( WebSocketClient_t *state )
+{
+    if ( !state->upgraded || state->keepalive_interval == 0 ) {
+        return;
+    }
+
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    if ( (now - state->ping_sent_ms) < state->keepalive_interval ) {
+        return;
+    }
+
+    if ( state->ping_outstanding ) {
+        state->pings_missed++;
+        if ( state->pings_missed >= state->keepalive_misses ) {
+            printf("WebSocket %d PINGs unanswered, closing socket\n", state->pings_missed);
+            wsClose( state );
+            return;
+        }
+    }
+
+    state->ping_seq++;
+    char payload[4] = { (char)(state->ping_seq >> 24), (char)(state->ping_seq >> 16), (char)(state->ping_seq >> 8), (char)state->ping_seq };
+    if ( wsQueueFrame( state, WS_PRIORITY_CONTROL, WEBSOCKET_OPCODE_PING, payload, sizeof(payload) ) ) {
+        state->ping_outstanding = true;
+    }
+    state->ping_sent_ms = now;
+    state->ping_sent_us = to_us_since_boot(get_absolute_time());
+}
+
+/*  Any PONG shows the peer is alive, one echoing the latest PING also gives a
+ *  round trip sample, smoothed as TCP does (RFC 6298) with gains of 1/8 and 1/4.
+ */
+static void wsKeepalivePong( WebSocketClient_t *state, const uint8_t *payload, uint32_t payload_len )
+{
+    state->pings_missed = 0;
+
+    if ( !state->ping_outstanding || payload_len != 4 ) {
+        return;
+    }
+    uint32_t seq = (uint32_t)payload[0] << 24 | (uint32_t)payload[1] << 16 | (uint32_t)payload[2] << 8 | payload[3];
+    if ( seq != state->ping_seq ) {
+        return;
+    }
+    state->ping_outstanding = false;
+
+    int32_t sample = (int32_t)(to_us_since_boot(get_absolute_time()) - state->ping_sent_us);
+    if ( state->rtt_us < 0 ) {
+        state->rtt_us = sample;
+        state->rtt_var_us = sample / 2;
+    } else {
+        int32_t error = sample - state->rtt_us;
+        state->rtt_us += error / 8;
+        state->rtt_var_us += ( (error < 0 ? -error : error) - state->rtt_var_us ) / 4;
+    }
+}
+
+static void wsHandleFrame( WebSocketClient_t *state, enum WebSocketOpCode opcode, uint8_t *payload, uint32_t payload_len )
+{
+    switch( opcode ) {
+        case WEBSOCKET_OPCODE_PING: {
+            // send pong
+            uint32_t now = to_ms_since_boot(get_absolute_time());
+            printf("WebSocket received PING (@ %d s)\n", (int)(now-state->lastPing)/1000);
+            state->lastPing = now;
+            if ( wsSendOpCode( state, WEBSOCKET_OPCODE_PONG ) ) {
+                printf("WebSocket queued PONG\n");
+            } else {    
+                printf("WebSocket PONG queue failed!\n");
+            }
+            break;
+        }
+        case WEBSOCKET_OPCODE_PONG:
+            wsKeepalivePong( state, payload, payload_len );
+            break;
+        case WEBSOCKET_OPCODE_CLOSE: {
+            // close connection
+            int error = -1;
+            if ( payload_len >= 2 ) {
+                error = payload[0]<<8 | payload[1];
+            }
+            printf("WebSocket connection close (%d)\n",error);
+            state->peer_close_code = error > 0 ? (uint16_t)error : 0;
+            break;
+        }
+        case WEBSOCKET_OPCODE_TEXT:
+            printf("WebSocket received data (Op Code %d)\n",opcode);
+            //printf("tcp_recved [%.*s]\n",payload_len,payload);
+            if ( payload_len>=2 && payload[0]=='{' ) {
+                if ( state->messageHandler ) {
+                    payload[payload_len] = 0;
+                    (state->messageHandler)( (WebSocketClient_p)state, (char *)payload, payload_len);
+                }
+            }
+            break;
+        case WEBSOCKET_OPCODE_BIN:
+            if ( state->binaryHandler ) {
+                (state->binaryHandler)( (WebSocketClient_p)state, payload, payload_len );
+                break;
+            }
+            // fall through
+        default:
+            printf("WebSocket eceived unknown or unsupported data (Op Code %d)\n",opcode);
+            break;
+    }
+}
+
+static void wsFail( WebSocketDecoder_t *decoder, uint16_t code, const char *reason )
+{
+    printf("WebSocket %s, failing connection (%d)\n", reason, code);
+    decoder->close_code = code;
+}
+
+/*  Checks the next piece of a text message is UTF-8, final if the message ends with
+ *  it, failing the connection with 1007 if not. Anything else passes unchecked.
+ */
+static bool wsCheckText( WebSocketDecoder_t *decoder, const uint8_t *data, uint32_t len, bool final )
+{
+    #if WS_VALIDATE_UTF8
+    if ( decoder->check_utf8 && ( !wsUtf8Validate( &decoder->utf8_state, data, len ) || ( final && decoder->utf8_state != 0 ) ) ) {
+        wsFail( decoder, WS_CLOSE_INVALID_DATA, "invalid UTF-8 in text message" );
+        return false;
+    }
+    #endif
+    return true;
+}
+
+/*  Validates a newly decoded frame header and decides where its payload goes,
+ *  data frames are reassembled into rx_buffer, control frames (which may arrive
+ *  between the fragments of a message) are kept separately.
+ */
+static bool wsStartFrame( WebSocketClient_t *state, WebsocketPacketHeader_t *header )
+{
+    WebSocketDecoder_t *decoder = &state->decoder;
+    uint8_t opcode = header->meta.bits.OPCODE;
+    uint8_t rsv = header->meta.bits.RSV;
+    bool compressed = false;
+
+    #if WS_DEFLATE
+    // RSV1 is only valid on the first frame of a data message
+    if ( rsv == WS_RSV1 && state->deflate_active && ( opcode == WEBSOCKET_OPCODE_TEXT || opcode == WEBSOCKET_OPCODE_BIN ) ) {
+        rsv = 0;
+        compressed = true;
+    }
+    #endif
+
+    if ( rsv != 0 ) {
+        wsFail( decoder, WS_CLOSE_PROTOCOL_ERROR, "unexpected RSV bits" );
+        return false;
+    }
+
+    switch( opcode ) {
+        case WEBSOCKET_OPCODE_CLOSE:
+        case WEBSOCKET_OPCODE_PING:
+        case WEBSOCKET_OPCODE_PONG:
+            if ( !header->meta.bits.FIN || header->length > WS_MAX_CONTROL_SIZE ) {
+                wsFail( decoder, WS_CLOSE_PROTOCOL_ERROR, "invalid control frame" );
+                return false;
+            }
+            decoder->sink = WS_SINK_CONTROL;
+            return true;
+        case WEBSOCKET_OPCODE_TEXT:
+        case WEBSOCKET_OPCODE_BIN:
+            if ( decoder->message_opcode != WEBSOCKET_OPCODE_CONTINUE ) {
+                wsFail( decoder, WS_CLOSE_PROTOCOL_ERROR, "new message before previous message completed" );
+                return false;
+            }
+            decoder->message_opcode = opcode;
+            decoder->message_len = 0;
+            decoder->message_compressed = compressed;
+            // compressed text is checked once it has been inflated
+            decoder->check_utf8 = ( opcode == WEBSOCKET_OPCODE_TEXT && !compressed );
+            decoder->utf8_state = 0;
+            break;
+        case WEBSOCKET_OPCODE_CONTINUE:
+            if ( decoder->message_opcode == WEBSOCKET_OPCODE_CONTINUE ) {
+                wsFail( decoder, WS_CLOSE_PROTOCOL_ERROR, "continuation without a message" );
+                return false;
+            }
+            break;
+        default:
+            wsFail( decoder, WS_CLOSE_PROTOCOL_ERROR, "unknown opcode" );
+            return false;
+    }
+
+    // streamed messages are passed on as they arrive, nothing is buffered
+    if ( state->streamHandler && decoder->message_opcode == WEBSOCKET_OPCODE_TEXT && !decoder->message_compressed ) {
+        decoder->sink = WS_SINK_STREAM;
+        return true;
+    }
+
+    // fail fast rather than let one message grow without bound
+    if ( header->length > state->max_message_size - decoder->message_len ) {
+        wsFail( decoder, WS_CLOSE_TOO_BIG, "message exceeds maximum size" );
+        return false;
+    }
+
+    decoder->sink = WS_SINK_BUFFER;
+    return true;
+}
+
+#if WS_DEFLATE
+/*  Decompresses a reassembled message from rx_buffer and delivers it, a streamed
+ *  text message arrives at the stream handler as a single final chunk.
+ */
+static void wsInflateMessage( WebSocketClient_t *state, uint8_t opcode, uint32_t len )
+{
+    WebSocketDecoder_t *decoder = &state->decoder;
+
+    int message_len = inflate_message( state->inflater, state->rx_buffer, len, state->inflate_buffer, state->max_message_size );
+    if ( message_len == INFLATE_TOO_BIG ) {
+        wsFail( decoder, WS_CLOSE_TOO_BIG, "decompressed message exceeds maximum size" );
+        return;
+    } else if ( message_len < 0 ) {
+        wsFail( decoder, WS_CLOSE_INVALID_DATA, "invalid compressed message" );
+        return;
+    }
+    if ( state->deflate_reset_rx ) {
+        inflate_reset( state->inflater );
+    }
+    decoder->check_utf8 = ( opcode == WEBSOCKET_OPCODE_TEXT );
+    decoder->utf8_state = 0;
+    if ( !wsCheckText( decoder, state->inflate_buffer, message_len, true ) ) {
+        return;
+    }
+
+    if ( state->streamHandler && opcode == WEBSOCKET_OPCODE_TEXT ) {
+        (state->streamHandler)( (WebSocketClient_p)state, (char *)state->inflate_buffer, message_len, 0, true );
+    } else {
+        wsHandleFrame( state, opcode, state->inflate_buffer, message_len );
+    }
+}
+#endif
+
+/*  Allocates rx_buffer when a message first has to be copied, most are delivered in
+ *  place and never need it. Fails the connection if out of memory.
+ */
+static bool wsRxBuffer( WebSocketClient_t *state )
+{
+    if ( state->rx_buffer == NULL ) {
+        state->rx_buffer = (uint8_t *)malloc( state->rx_capacity + 1 );
+        if ( state->rx_buffer == NULL ) {
+            wsFail( &state->decoder, WS_CLOSE_INTERNAL_ERROR, "out of memory for message" );
+            return false;
+        }
+    }
+    return true;
+}
+
+static void wsEndFrame( WebSocketClient_t *state, WebsocketPacketHeader_t *header )
+{
+    WebSocketDecoder_t *decoder = &state->decoder;
+    uint8_t opcode = header->meta.bits.OPCODE;
+
+    if ( opcode >= WEBSOCKET_OPCODE_CLOSE ) {
+        wsHandleFrame( state, opcode, decoder->control, (uint32_t)header->length );
+        return;
+    }
+
+    // the message may not end part way through a character
+    if ( header->meta.bits.FIN && !wsCheckText( decoder, NULL, 0, true ) ) {
+        return;
+    }
+    if ( decoder->sink == WS_SINK_STREAM ) {
+        // chunks already delivered, an empty final frame still has to end the message
+        if ( header->length == 0 && header->meta.bits.FIN ) {
+            (state->streamHandler)( (WebSocketClient_p)state, "", 0, decoder->message_len, true );
+        }
+        decoder->message_len += (uint32_t)header->length;
+        if ( header->meta.bits.FIN ) {
+            decoder->message_opcode = WEBSOCKET_OPCODE_CONTINUE;
+            decoder->message_len = 0;
+        }
+    } else {
+        decoder->message_len += (uint32_t)header->length;
+        if ( header->meta.bits.FIN ) {
+            if ( !wsRxBuffer( state ) ) {
+                return;
+            }
+            uint8_t message_opcode = decoder->message_opcode;
+            uint32_t message_len = decoder->message_len;
+            decoder->message_opcode = WEBSOCKET_OPCODE_CONTINUE;
+            decoder->message_len = 0;
+            #if WS_DEFLATE
+            if ( decoder->message_compressed ) {
+                decoder->message_compressed = false;
+                wsInflateMessage( state, message_opcode, message_len );
+                return;
+            }
+            #endif
+            wsHandleFrame( state, message_opcode, state->rx_buffer, message_len );
+        }
+    }
+}
+
+#if WS_ZERO_COPY_RX
+/*  Delivers an unfragmented data frame straight from the receive buffer when its
+ *  whole payload is present, the byte following the payload is borrowed for the
+ *  terminator and restored afterwards. Returns the bytes consumed, 0 if the
+ *  frame has to be copied.
+ */
+static uint32_t wsDeliverInPlace( WebSocketClient_t *state, uint8_t *data, uint32_t len, uint32_t tail_room )
+{
+    WebSocketDecoder_t *decoder = &state->decoder;
+    WebsocketPacketHeader_t *header = &decoder->header;
+
+    if ( decoder->sink != WS_SINK_BUFFER || !header->meta.bits.FIN || decoder->message_len != 0 || decoder->message_compressed ) {
+        return 0;
+    }
+    if ( header->length == 0 || header->length > len || ( header->length == len && tail_room == 0 ) ) {
+        return 0;
+    }
+
+    uint32_t length = (uint32_t)header->length;
+    uint8_t opcode = decoder->message_opcode;
+
+    if ( header->meta.bits.MASK ) {
+        wsMask( data, data, length, header->mask.maskBytes, 0 );
+    }
+    if ( !wsCheckText( decoder, data, length, true ) ) {
+        return 0;
+    }
+
+    decoder->state = WS_DECODE_HEADER;
+    decoder->header_len = 0;
+    decoder->header_need = 2;
+    decoder->message_opcode = WEBSOCKET_OPCODE_CONTINUE;
+
+    uint8_t saved = data[length];
+    wsHandleFrame( state, opcode, data, length );
+    data[length] = saved;
+
+    return length;
+}
+#endif
+
+/*  Feeds received bytes into the frame decoder, each complete frame is passed to
+ *  wsHandleFrame, any partial frame is kept until the next call. The data is
+ *  modified in place, tail_room is the number of writable bytes after it.
+ */
+static void wsDecode( WebSocketClient_t *state, uint8_t *data, uint32_t len, uint32_t tail_room )
+{
+    WebSocketDecoder_t *decoder = &state->decoder;
+
+    while ( len > 0 && decoder->close_code == 0 ) {
+        if ( decoder->state == WS_DECODE_HEADER ) {
+            uint32_t count = decoder->header_need - decoder->header_len;
+            if ( count > len ) {
+                count = len;
+            }
+            memcpy( decoder->header_bytes + decoder->header_len, data, count );
+            decoder->header_len += count;
+            data += count;
+            len -= count;
+
+            if ( decoder->header_len == 2 ) {
+                decoder->header_need = wsHeaderSize( decoder->header_bytes );
+            }
+            if ( decoder->header_len == decoder->header_need ) {
+                wsParseHeader( &decoder->header, decoder->header_bytes, decoder->header_len );
+                if ( !wsStartFrame( state, &decoder->header ) ) {
+                    break;
+                }
+                state->stats.rx_frames[wsStatsIndex( decoder->header.meta.bits.OPCODE )]++;
+                decoder->state = WS_DECODE_PAYLOAD;
+                decoder->payload_received = 0;
+
+                #if WS_ZERO_COPY_RX
+                uint32_t used = wsDeliverInPlace( state, data, len, tail_room );
+                if ( used > 0 ) {
+                    data += used;
+                    len -= used;
+                    continue;
+                }
+                #endif
+            }
+        } else {
+            uint64_t remaining = decoder->header.length - decoder->payload_received;
+            uint32_t count = remaining < len ? (uint32_t)remaining : len;
+            // streamed payload is unmasked in place and handed over without copying
+            uint8_t *dst = data;
+            if ( decoder->sink == WS_SINK_CONTROL ) {
+                dst = decoder->control + decoder->payload_received;
+            } else if ( decoder->sink == WS_SINK_BUFFER ) {
+                if ( !wsRxBuffer( state ) ) {
+                    break;
+                }
+                dst = state->rx_buffer + decoder->message_len + decoder->payload_received;
+            }
+
+            if ( decoder->header.meta.bits.MASK ) {
+                wsMask( dst, data, count, decoder->header.mask.maskBytes, (uint32_t)decoder->payload_received );
+            } else if ( dst != data ) {
+                memcpy( dst, data, count );
+            }
+            if ( decoder->sink != WS_SINK_CONTROL && !wsCheckText( decoder, dst, count, decoder->header.meta.bits.FIN && count == remaining ) ) {
+                break;
+            }
+            if ( decoder->sink == WS_SINK_STREAM ) {
+                bool final = decoder->header.meta.bits.FIN && count == remaining;
+                (state->streamHandler)( (WebSocketClient_p)state, (char *)data, count, decoder->message_len + (uint32_t)decoder->payload_received, final );
+            }
+            decoder->payload_received += count;
+            data += count;
+            len -= count;
+        }
+
+        if ( decoder->state == WS_DECODE_PAYLOAD && decoder->payload_received == decoder->header.length ) {
+            WebsocketPacketHeader_t header = decoder->header;
+            decoder->state = WS_DECODE_HEADER;
+            decoder->header_len = 0;
+            decoder->header_need = 2;
+            wsEndFrame( state, &header );
+        }
+    }
+}
+
+#if WS_DEFLATE
+/*  Applies the server's answer to the permessage-deflate offer, the extension is
+ *  only used if the server listed it in its Sec-WebSocket-Extensions header.
+ */
+static void wsDeflateAccept( WebSocketClient_t *state, const char *extensions )
+{
+    state->deflate_active = false;
+    if ( state->deflate_window_bits == 0 || extensions == NULL || strstr(extensions, "permessage-deflate") == NULL ) {
+        return;
+    }
+
+    state->deflate_reset_tx = ( strstr(extensions, "client_no_context_takeover") != NULL );
+    state->deflate_reset_rx = ( strstr(extensions, "server_no_context_takeover") != NULL );
+
+    // the server may ask for a smaller window than offered, never a larger one
+    state->deflate_tx_bits = state->deflate_window_bits;
+    const char *bits = strstr(extensions, "client_max_window_bits=");
+    if ( bits != NULL ) {
+        int value = atoi( bits + 23 );
+        if ( value >= DEFLATE_MIN_WINDOW_BITS && value < state->deflate_tx_bits ) {
+            state->deflate_tx_bits = (uint8_t)value;
+        }
+    }
+
+    // allocated now the server has agreed, the compressor only as large as it allows
+    wsDeflateRelease( state );
+    state->deflater = deflate_create( state->deflate_tx_bits );
+    state->inflater = inflate_create( state->deflate_window_bits );
+    state->inflate_buffer = (uint8_t *)malloc( state->rx_capacity + 1 );
+    if ( state->deflater == NULL || state->inflater == NULL || state->inflate_buffer == NULL ) {
+        // the server will compress what it sends, so carrying on without it isn't possible
+        wsDeflateRelease( state );
+        wsFail( &state->decoder, WS_CLOSE_INTERNAL_ERROR, "failed to allocate permessage-deflate" );
+        return;
+    }
+    state->deflate_active = true;
+    printf("WebSocket permessage-deflate window %d bits%s\n", state->deflate_tx_bits, state->deflate_reset_tx ? ", no context takeover" : "");
+}
+#endif
+
+static void wsUpgradeAccepted( WebSocketClient_t *state, const char *extensions )
+{
+    printf("WebSocket upgrade acknowladged\n");
+    state->upgraded = true;
+    state->upgraded_at = to_ms_since_boot(get_absolute_time());
+    state->stats.upgrade_ms = state->upgraded_at - state->connected_at;
+    state->reconnect_stats.connects++;
+    if ( state->down ) {
+        state->reconnect_stats.disconnected_ms += state->upgraded_at - state->down_since;
+        state->down = false;
+    }
+    wsDecoderReset( &state->decoder );
+    state->ping_sent_ms = to_ms_since_boot(get_absolute_time());
+    state->ping_outstanding = false;
+    state->pings_missed = 0;
+    #if WS_DEFLATE
+    wsDeflateAccept( state, extensions );
+    #endif
+}
+
+/*  True if the comma separated header value lists token, compared without case
+ *  as Upgrade and Connection values are.
+ */
+static bool wsHeaderHasToken( const char *value, const char *token )
+{
+    size_t token_len = strlen(token);
+
+    while ( *value != 0 ) {
+        while ( *value == ' ' || *value == '\t' || *value == ',' ) {
+            value++;
+        }
+        const char *end = value;
+        while ( *end != 0 && *end != ',' ) {
+            end++;
+        }
+        const char *last = end;
+        while ( last > value && (last[-1] == ' ' || last[-1] == '\t') ) {
+            last--;
+        }
+        if ( (size_t)(last - value) == token_len && strncasecmp(value, token, token_len) == 0 ) {
+            return true;
+        }
+        value = end;
+    }
+    return false;
+}
+
+/*  Handles one complete line of the upgrade response, line has its CRLF removed.
+ */
+static void wsUpgradeLine( WebSocketClient_t *state, char *line )
+{
+    WebSocketUpgrade_t *upgrade = &state->upgrade;
+
+    if ( upgrade->state == WS_UPGRADE_STATUS ) {
+        // HTTP/1.1 101 Switching Protocols
+        if ( strlen(line) < 12 || strncmp(line, "HTTP/1.", 7) != 0 || line[8] != ' ' ) {
+            printf("WebSocket upgrade bad status line [%s]\n", line);
+            upgrade->state = WS_UPGRADE_FAILED;
+            return;
+        }
+        upgrade->status = (uint16_t)atoi( line + 9 );
+        upgrade->state = WS_UPGRADE_HEADERS;
+        return;
+    }
+
+    if ( *line == 0 ) {
+        // end of the headers
+        if ( upgrade->status == 101 && upgrade->upgrade_ok && upgrade->connection_ok && upgrade->accept_ok ) {
+            upgrade->state = WS_UPGRADE_DONE;
+            #if WS_DEFLATE
+            wsUpgradeAccepted( state, upgrade->has_extensions ? upgrade->extensions : NULL );
+            #else
+            wsUpgradeAccepted( state, NULL );
+            #endif
+        } else {
+            printf("WebSocket upgrade refused, status %d%s%s%s\n", upgrade->status,
+                upgrade->upgrade_ok ? "" : ", no Upgrade: websocket",
+                upgrade->connection_ok ? "" : ", no Connection: upgrade",
+                upgrade->accept_ok ? "" : ", Sec-WebSocket-Accept mismatch");
+            upgrade->state = WS_UPGRADE_FAILED;
+        }
+        return;
+    }
+
+    char *value = strchr(line, ':');
+    if ( value == NULL ) {
+        return;
+    }
+    *value++ = 0;
+    while ( *value == ' ' || *value == '\t' ) {
+        value++;
+    }
+    char *end = value + strlen(value);
+    while ( end > value && (end[-1] == ' ' || end[-1] == '\t') ) {
+        *--end = 0;
+    }
+
+    if ( strcasecmp(line, "Upgrade") == 0 ) {
+        upgrade->upgrade_ok = wsHeaderHasToken( value, "websocket" );
+    } else if ( strcasecmp(line, "Connection") == 0 ) {
+        upgrade->connection_ok = wsHeaderHasToken( value, "upgrade" );
+    } else if ( strcasecmp(line, "Sec-WebSocket-Accept") == 0 ) {
+        upgrade->accept_ok = ( strcmp(value, upgrade->accept) == 0 );
+    }
+    #if WS_DEFLATE
+    else if ( strcasecmp(line, "Sec-WebSocket-Extensions") == 0 ) {
+        strncpy( upgrade->extensions, value, sizeof(upgrade->extensions) - 1 );
+        upgrade->has_extensions = true;
+    }
+    #endif
+}
+
+/*  Feeds received bytes to the upgrade response parser, returns how many were
+ *  used. Stops straight after the empty line that ends the headers so the
+ *  caller can pass the rest to the frame decoder.
+ */
+static uint32_t wsUpgradeParse( WebSocketClient_t *state, const uint8_t *data, uint32_t len )
+{
+    WebSocketUpgrade_t *upgrade = &state->upgrade;
+    uint32_t used = 0;
+
+    while ( used < len && upgrade->state != WS_UPGRADE_DONE && upgrade->state != WS_UPGRADE_FAILED ) {
+        char c = (char)data[used++];
+
+        if ( ++upgrade->total > WS_UPGRADE_MAX_SIZE ) {
+            printf("WebSocket upgrade response too long\n");
+            upgrade->state = WS_UPGRADE_FAILED;
+            break;
+        }
+        if ( c == '\n' ) {
+            if ( upgrade->line_len > 0 && upgrade->line[upgrade->line_len-1] == '\r' ) {
+                upgrade->line_len--;
+            }
+            upgrade->line[upgrade->line_len] = 0;
+            upgrade->line_len = 0;
+            wsUpgradeLine( state, upgrade->line );
+        } else if ( upgrade->line_len < WS_UPGRADE_LINE_SIZE - 1 ) {
+            upgrade->line[upgrade->line_len++] = c;
+        }
+    }
+
+    return used;
+}
+
+/*  Received bytes go to the upgrade response parser until the upgrade is accepted,
+ *  then to the frame decoder, including any that followed the response headers.
+ */
+void wsTransportReceive( WebSocketClient_p client, uint8_t *data, uint32_t len, uint32_t tail_room )
+{
+    WebSocketClient_t *state = (WebSocketClient_t*)client;
+    uint32_t offset = 0;
+
+    state->stats.rx_bytes += len;
+    state->receiving = true;
+    if ( !state->upgraded ) {
+        offset = wsUpgradeParse( state, data, len );
+    }
+    if ( state->upgraded && offset < len ) {
+        wsDecode( state, data + offset, len - offset, tail_room );
+    }
+}
+
+void wsTransportReceiveDone( WebSocketClient_p client )
+{
+    WebSocketClient_t *state = (WebSocketClient_t*)client;
+
+    state->receiving = false;
+    if ( state->connected == TCP_DISCONNECTED ) {
+        // closed while decoding, rx_buffer was kept until now
+        wsRxBufferRelease( state );
+    }
+    if ( state->upgrade.state == WS_UPGRADE_FAILED ) {
+        state->stats.parse_failures++;
+        wsClose( state );
+    } else if ( state->decoder.close_code != 0 ) {
+        if ( state->decoder.close_code == WS_CLOSE_TOO_BIG ) {
+            state->stats.truncations++;
+        } else if ( state->decoder.close_code != WS_CLOSE_INTERNAL_ERROR ) {
+            state->stats.parse_failures++;
+        }
+        wsSendClose( state, state->decoder.close_code );
+        wsClose( state );
+    } else {
+        // send any replies (and anything held back until the upgrade)
+        wsDrain( state );
+    }
+}
+
+void wsTransportWritable( WebSocketClient_p client )
+{
+    wsDrain( (WebSocketClient_t *)client );
+}
+
+//===============================================================================================================
+
+/*! \brief Initialises a WebSocket for connection
+ *  \ingroup Websocket.c
+ *
+ * The client, its receive buffer and copies of the strings are allocated in
+ * one block. Devices that only exchange small messages can lower the
+ * capacities in config, see wsRamWorstCase for what a client can use.
+ *
+ * \param server ip address of target server
+ * \param hostname hostname of target server (for Host header), can be NULL
+ * \param port port on which to connect
+ * \param messageHandler callback to handle received messages
+ * \param additioonalHeaders additional headers to include in the connect
+ * \param autoReconnect automatically reconnect if the connection is closed
+ * \param config buffer capacities, NULL for the defaults
+ * \return handle to a WebSocket client
+ */
+WebSocketClient_p wsCreate( const char *server, const char *hostname, uint16_t port, wsMessagehandler messageHandler, char *additionalHeaders, bool autoReconnect, const wsConfig_t *config )
+{
+    uint32_t rx_capacity = config && config->rx_capacity ? config->rx_capacity : WS_MAX_MESSAGE_SIZE;
+    uint32_t tx_capacity = config && config->tx_capacity ? config->tx_capacity : WS_MAX_SEND_SIZE;
+    size_t server_len = strlen(server) + 1;
+    size_t hostname_len = hostname ? strlen(hostname) + 1 : 0;
+    size_t headers_len = additionalHeaders ? strlen(additionalHeaders) + 1 : 0;
+
+    WebSocketClient_t *state = (WebSocketClient_t *)calloc(1, sizeof(WebSocketClient_t) + server_len + hostname_len + headers_len);
+    if (!state) {
+        printf("Failed to allocate WebSocket client\n");
+        return NULL;
+    }
+    char *next = (char *)(state + 1);
+    state->rx_capacity = rx_capacity;
+    state->tx_capacity = tx_capacity;
+    state->server = memcpy( next, server, server_len );
+    next += server_len;
+    if ( hostname ) {
+        state->hostname = memcpy( next, hostname, hostname_len );
+        next += hostname_len;
+    }
+    if ( additionalHeaders ) {
+        state->additional_headers = memcpy( next, additionalHeaders, headers_len );
+    }
+
+    state->transport = &WS_TRANSPORT;
+    state->transport_state = state->transport->create( state, state->server, port );
+    if ( !state->transport_state ) {
+        printf("Failed to allocate WebSocket %s transport\n", state->transport->name);
+        free( state );
+        return NULL;
+    }
+    state->remote_port = port;
+    state->messageHandler = messageHandler;
+    state->auto_reconnect = autoReconnect;
+    wsSetMaxMessageSize( state, state->rx_capacity );
+    wsSetReconnect( state, WS_RECONNECT_MIN_DELAY, WS_RECONNECT_MAX_DELAY, WS_CONNECT_TIMEOUT );
+    wsSetKeepalive( state, WS_KEEPALIVE_INTERVAL, WS_KEEPALIVE_MISSES );
+    state->rtt_us = -1;
+    state->state_since = to_ms_since_boot(get_absolute_time());
+    for ( int priority = 0 ; priority < WS_PRIORITY_COUNT ; priority++ ) {
+        wsQueueInit( &state->queue[priority] );
+    }
+    atomic_init( &state->cork, 0 );
+
+    return( (WebSocketClient_p)state );
+}
+
+/*! \brief Connects a client to the server
+ *  \ingroup Websocket.c
+ *
+ * \param client handle of client to connect
+ * \return true if succesful
+ */
+bool wsConnect( WebSocketClient_p client )
+{
+    bool result = false;
+    WebSocketClient_t *state = (WebSocketClient_t *)client;
+
+    if ( state->connected != TCP_DISCONNECTED ) {
+        return true;
+    }
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    state->reconnect_pending = false;
+    state->disconnect_requested = false;
+    state->upgrade.status = 0;
+    state->connect_started = now;
+    state->reconnect_stats.attempts++;
+    if ( !state->down ) {
+        state->down = true;
+        state->down_since = now;
+    }
+
+    printf("WebSocket connecting to %s:%u\n", state->server, state->remote_port);
+    if ( state->transport->connect( state->transport_state ) ) {
+        wsSetState( state, TCP_CONNECTING );
+        state->upgraded = false;
+        result = true;
+    }
+    return result;
+}
+
+/*! \brief Destroys a client freeing resourcxes
+ *  \ingroup Websocket.c
+ *
+ * \param client handle of client to connect
+ * \return true if succesful
+ */
+bool wsDestroy( WebSocketClient_p client )
+{
+    WebSocketClient_t *state = (WebSocketClient_t *)client;
+    state->auto_reconnect = false;
+    wsClose( state );
+    state->transport->destroy( state->transport_state );
+    for ( int priority = 0 ; priority < WS_PRIORITY_COUNT ; priority++ ) {
+        wsQueueFlush( &state->queue[priority] );
+    }
+    free( state->rx_buffer );
+    #if WS_DEFLATE
+    wsDeflateRelease( state );
+    #endif
+    if ( client ) {
+        free( client );
+    }
+
+    return true;
+}
+
+/*! \brief Returns the current connection state
+ *  \ingroup Websocket.c
+ *
+ * \param client handle of client to connect
+ * \return connection state TCP_DISCONNECTED, TCP_CONNECTING, or TCP_CONNECTED
+ */
+int wsConnectState( WebSocketClient_p client )
+{
+    WebSocketClient_t *state = (WebSocketClient_t *)client;
+    return(state->connected);
+}
+
+/*! \brief Reserves room for a message so it can be built where it will be sent from
+ *  \ingroup Websocket.c
+ *
+ * Returns a buffer for up to maxLen payload bytes inside the frame that will
+ * be queued, with room for the header in front of it, so a message can be
+ * written straight into it rather than built elsewhere and copied. Pass the
+ * reservation to wsCommit with the length written, or to wsRelease to drop it.
+ * May be called from any context.
+ *
+ * \param client handle of client
+ * \param maxLen most payload bytes that will be written
+ * \param reservation filled in for wsCommit or wsRelease
+ * \return where to write the payload, NULL if maxLen is too large or out of memory
+ */
+char *wsReserve( WebSocketClient_p client, size_t maxLen, wsReservation_t *reservation )
+{
+    WebSocketClient_t *state = (WebSocketClient_t *)client;
+    uint32_t largest = wsFrameSize( maxLen, 1 );
+
+    reservation->frame = NULL;
+    #if WS_DEFLATE
+    if ( state->deflate_active ) {
+        largest = WS_MAX_HEADER_SIZE + DEFLATE_BOUND(maxLen);
+    }
+    #endif
+    if ( maxLen > state->tx_capacity || largest > state->transport->max_frame ) {
+        return NULL;
+    }
+
+    // the header for maxLen, a shorter message may need a shorter one
+    reservation->headroom = (uint8_t)( wsFrameSize( maxLen, 1 ) - maxLen );
+    reservation->capacity = (uint32_t)maxLen;
+    reservation->frame = (uint8_t *)malloc( reservation->headroom + maxLen + 1 );
+    if ( reservation->frame == NULL ) {
+        return NULL;
+    }
+    return (char *)reservation->frame + reservation->headroom;
+}
+
+/*! \brief Queues a message written into the room from wsReserve
+ *  \ingroup Websocket.c
+ *
+ * The header is written in front of the payload and the payload masked where
+ * it is. Only a message that needs a shorter header than the one reserved for
+ * is moved up to meet it. May be called from any context.
+ *
+ * \param client handle of client the room was reserved from
+ * \param reservation from wsReserve, released whether or not the message is queued
+ * \param len payload bytes written
+ * \param binary true for a binary message, false for text
+ * \param priority queue to send the message on
+ * \return true if queued
+ */
+bool wsCommit( WebSocketClient_p client, wsReservation_t *reservation, size_t len, bool binary, wsPriority_t priority )
+{
+    WebSocketClient_t *state = (WebSocketClient_t *)client;
+    enum WebSocketOpCode opCode = binary ? WEBSOCKET_OPCODE_BIN : WEBSOCKET_OPCODE_TEXT;
+    uint8_t *frame = reservation->frame;
+    uint8_t *payload = frame + reservation->headroom;
+
+    reservation->frame = NULL;
+    if ( frame == NULL ) {
+        return false;
+    }
+    if ( priority >= WS_PRIORITY_COUNT || len > reservation->capacity ) {
+        free( frame );
+        return false;
+    }
+
+    #if WS_DEFLATE
+    // compressed when it is sent, until then only the payload is kept
+    if ( state->deflate_active ) {
+        memmove( frame, payload, len );
+        return wsQueueBuilt( state, priority, frame, (uint32_t)len, opCode );
+    }
+    #endif
+
+    uint32_t header_len = wsFrameSize( len, 1 ) - (uint32_t)len;
+    if ( header_len < reservation->headroom ) {
+        memmove( frame + header_len, payload, len );
+        payload = frame + header_len;
+    }
+    uint8_t maskBytes[4];
+    wsBuildHeader( frame, opCode, len, 1, maskBytes );
+    wsMask( payload, payload, (uint32_t)len, maskBytes, 0 );
+
+    return wsQueueBuilt( state, priority, frame, header_len + (uint32_t)len, 0 );
+}
+
+/*! \brief Drops room reserved with wsReserve without sending anything
+ *  \ingroup Websocket.c
+ *
+ * \param reservation from wsReserve
+ * \return Nothing
+ */
+void wsRelease( wsReservation_t *reservation )
+{
+    free( reservation->frame );
+    reservation->frame = NULL;
+}
+
+/*! \brief Closes the connection and leaves it closed
+ *  \ingroup Websocket.c
+ *
+ * The server is sent a normal CLOSE on the next wsHandler, and the client
+ * doesn't reconnect until wsConnect is called. Queued messages are kept for
+ * the next connection.
+ *
+ * \param client handle of client to disconnect
+ * \return Nothing
+ */
+void wsDisconnect( WebSocketClient_p client )
+{
+    WebSocketClient_t *state = (WebSocketClient_t *)client;
+    state->disconnect_requested = true;
+}
+
+/*! \brief Tells if the connection is ready for messages
+ *  \ingroup Websocket.c
+ *
+ * \param client handle of client
+ * \return true once the server has accepted the upgrade, until the connection closes
+ */
+bool wsIsUpgraded( WebSocketClient_p client )
 {
     WebSocketClient_t *state = (WebSocketClient_t *)client;
-    return(state->connected);
+    return state->upgraded && state->connected == TCP_CONNECTED;
 }
 
 /*! \brief Send a message from the client to the connected server
  *  \ingroup Websocket.c
  *
+ * The message is queued with notification priority, see wsSendMessagePriority.
+ *
  * \param client handle of client to connect
  * \param text message to send
  * \param len length of the message
@@ -657,62 +1998,537 @@ int wsConnectState( WebSocketClient_p client )
  */
 bool wsSendMessage( WebSocketClient_p client, char *text, size_t len )
 {
-    WebSocketClient_t *state = (WebSocketClient_t *)client;
-    bool result = false;
+    return wsSendMessagePriority( client, text, len, WS_PRIORITY_NOTIFY );
+}
 
-    #ifdef WIZNET_BOARD
+/*! \brief Queue a message from the client to the connected server
+ *  \ingroup Websocket.c
+ *
+ * May be called from any context (either core or an lwIP callback) without
+ * locking. The message is copied into a frame and sent from the lwIP context
+ * once the connection is upgraded and the send window allows, queues are
+ * sent highest priority first. Fails if the priority's queue is full.
+ *
+ * \param client handle of client
+ * \param text message to send
+ * \param len length of the message
+ * \param priority WS_PRIORITY_CONTROL, WS_PRIORITY_RESPONSE or WS_PRIORITY_NOTIFY
+ * \return true if queued
+ */
+bool wsSendMessagePriority( WebSocketClient_p client, char *text, size_t len, wsPriority_t priority )
+{
     //printf("send message [%.*s](%d)\n",len,text,len);
-    int buffer_len = wsBuildPacket((char *)state->send_buf, BUF_SIZE, WEBSOCKET_OPCODE_TEXT, text, len, 1);
-    result = ( httpc_send_body(state->send_buf, buffer_len) == buffer_len );
-    #else
-    state->buffer_len = wsBuildPacket((char *)state->en, BUF_SIZE, WEBSOCKET_OPCODE_TEXT, text, len, 1);
-    result = ( tcp_write(state->tcp_pcb, state->en, state->buffer_len, TCP_WRITE_FLAG_COPY) == ERR_OK );
-    #endif
+    if ( priority >= WS_PRIORITY_COUNT ) {
+        return false;
+    }
+    return wsQueueFrame( (WebSocketClient_t *)client, priority, WEBSOCKET_OPCODE_TEXT, text, len );
+}
 
-    return result;
+/*! \brief Send a message built from several pieces without joining them first
+ *  \ingroup Websocket.c
+ *
+ * The pieces are masked straight into a single frame, for example a constant
+ * prefix, a dynamic middle and a signature. Queued with notification priority.
+ *
+ * \param client handle of client
+ * \param iov pieces of the message, in order
+ * \param iovcnt number of pieces
+ * \return true if queued
+ */
+bool wsSendMessagev( WebSocketClient_p client, const wsIovec_t *iov, int iovcnt )
+{
+    return wsSendFramev( client, iov, iovcnt, false, WS_PRIORITY_NOTIFY );
 }
 
-/*! \brief Handles any WebSocket functionality, must be called periodically
+/*! \brief Send a binary message to the connected server
  *  \ingroup Websocket.c
  *
- * \param Nothing
+ * \param client handle of client
+ * \param data message to send
+ * \param len length of the message
+ * \return true if queued
+ */
+bool wsSendBinary( WebSocketClient_p client, const uint8_t *data, size_t len )
+{
+    wsIovec_t iov = { data, len };
+    return wsSendFramev( client, &iov, 1, true, WS_PRIORITY_NOTIFY );
+}
+
+/*! \brief Queue a text or binary message built from several pieces
+ *  \ingroup Websocket.c
+ *
+ * As wsSendMessagePriority, but gathers the message from iovcnt pieces.
+ *
+ * \param client handle of client
+ * \param iov pieces of the message, in order
+ * \param iovcnt number of pieces
+ * \param binary send a binary rather than a text frame
+ * \param priority WS_PRIORITY_CONTROL, WS_PRIORITY_RESPONSE or WS_PRIORITY_NOTIFY
+ * \return true if queued
+ */
+bool wsSendFramev( WebSocketClient_p client, const wsIovec_t *iov, int iovcnt, bool binary, wsPriority_t priority )
+{
+    if ( priority >= WS_PRIORITY_COUNT || iovcnt < 0 ) {
+        return false;
+    }
+    return wsQueueFramev( (WebSocketClient_t *)client, priority, binary ? WEBSOCKET_OPCODE_BIN : WEBSOCKET_OPCODE_TEXT, iov, iovcnt );
+}
+
+/*! \brief Returns the outbound queue depths and drop counts
+ *  \ingroup Websocket.c
+ *
+ * \param client handle of client
+ * \param stats filled in per priority, drops count messages refused because
+ *        their queue was full or no memory was available
  * \return Nothing
  */
-void wsHandler( WebSocketClient_p client )
+void wsGetQueueStats( WebSocketClient_p client, wsQueueStats_t *stats )
 {
     WebSocketClient_t *state = (WebSocketClient_t *)client;
 
-    #ifdef WIZNET_BOARD
-    httpc_connection_handler();
+    for ( int priority = 0 ; priority < WS_PRIORITY_COUNT ; priority++ ) {
+        WebSocketQueue_t *queue = &state->queue[priority];
+        unsigned dequeue_pos = atomic_load_explicit( &queue->dequeue_pos, memory_order_relaxed );
+        stats->depth[priority] = (uint16_t)(atomic_load_explicit( &queue->enqueue_pos, memory_order_relaxed ) - dequeue_pos);
+        stats->high_water[priority] = (uint16_t)atomic_load_explicit( &queue->high_water, memory_order_relaxed );
+        stats->drops[priority] = atomic_load_explicit( &queue->drops, memory_order_relaxed );
+    }
+}
+
+/*! \brief Sets the largest message that will be reassembled from fragments
+ *  \ingroup Websocket.c
+ *
+ * A message exceeding this size fails the connection with close code 1009.
+ *
+ * \param client handle of client
+ * \param size maximum message size in bytes, limited to the receive capacity
+ * \return Nothing
+ */
+void wsSetMaxMessageSize( WebSocketClient_p client, uint32_t size )
+{
+    WebSocketClient_t *state = (WebSocketClient_t *)client;
+    state->max_message_size = size < state->rx_capacity ? size : state->rx_capacity;
+}
 
-    if( state->connected == TCP_CONNECTED && httpc_isConnected ) {
-        // Recv: HTTP response
-        if(httpc_isReceived > 0) {
-            wsReceive(client, ERR_OK);
-        } else {
-            uint32_t now = to_ms_since_boot(get_absolute_time());
-            if ( (now-state->lastPing) > PING_TIMEOUT ) {
-                printf("WebSocket PING timeout (%d s), closing socket\n", (int)(now-state->lastPing)/1000);
-                wsClose( client );
-            }
+/*! \brief Sets a handler that receives messages in chunks as they arrive
+ *  \ingroup Websocket.c
+ *
+ * When set, text messages are not reassembled into the receive buffer (and are
+ * not limited by the maximum message size), instead each chunk is passed on
+ * as soon as it is received. The chunk is only valid for the duration of the
+ * call and is not null terminated. Pass NULL to return to whole messages.
+ *
+ * \param client handle of client
+ * \param streamHandler callback receiving (chunk, length, offset, final)
+ * \return Nothing
+ */
+void wsSetStreamHandler( WebSocketClient_p client, wsStreamHandler streamHandler )
+{
+    WebSocketClient_t *state = (WebSocketClient_t *)client;
+    state->streamHandler = streamHandler;
+}
+
+#if WS_DEFLATE
+/*! \brief Asks for permessage-deflate compression on the next connection
+ *  \ingroup Websocket.c
+ *
+ * The extension is offered in the upgrade request and used if the server
+ * accepts it. Each direction keeps a history window of 1 << windowBits bytes,
+ * the compressor needs three times that. Without context takeover each
+ * message is compressed on its own, saving less but tolerating loss of state.
+ * While connected the current connection keeps its settings, the new ones are
+ * applied when the next connection is made. The compressor and decompressor
+ * are only allocated once a server accepts, and are freed when it closes.
+ *
+ * \param client handle of client
+ * \param windowBits log2 of the window, 9 to 15, 0 to stop offering compression
+ * \param contextTakeover keep history between messages
+ * \return true
+ */
+bool wsSetDeflate( WebSocketClient_p client, uint8_t windowBits, bool contextTakeover )
+{
+    WebSocketClient_t *state = (WebSocketClient_t *)client;
+
+    // zlib based servers can't use 8 bit windows, 9 is the smallest all will accept
+    if ( windowBits != 0 && windowBits < 9 ) {
+        windowBits = 9;
+    } else if ( windowBits > DEFLATE_MAX_WINDOW_BITS ) {
+        windowBits = DEFLATE_MAX_WINDOW_BITS;
+    }
+
+    state->deflate_request_bits = windowBits;
+    state->deflate_request_takeover = contextTakeover;
+    if ( state->connected == TCP_DISCONNECTED ) {
+        wsDeflateApply( state );
+    }
+
+    return true;
+}
+#endif
+
+/*! \brief Sets a handler for binary messages
+ *  \ingroup Websocket.c
+ *
+ * Binary messages are reassembled like text ones, but are not null terminated
+ * and are not passed to the stream handler. Without a handler they are dropped.
+ *
+ * \param client handle of client
+ * \param binaryHandler callback receiving (data, length)
+ * \return Nothing
+ */
+void wsSetBinaryHandler( WebSocketClient_p client, wsBinaryHandler binaryHandler )
+{
+    WebSocketClient_t *state = (WebSocketClient_t *)client;
+    state->binaryHandler = binaryHandler;
+}
+
+/*! \brief Sets how often the client checks the server is still there
+ *  \ingroup Websocket.c
+ *
+ * A PING is sent every interval, when maxMissed in a row go unanswered the
+ * connection is closed (and reconnected if auto reconnect is set).
+ *
+ * \param client handle of client
+ * \param intervalMs time between PINGs in milliseconds, 0 to disable
+ * \param maxMissed unanswered PINGs before the connection is closed, at least 1
+ * \return Nothing
+ */
+void wsSetKeepalive( WebSocketClient_p client, uint32_t intervalMs, uint8_t maxMissed )
+{
+    WebSocketClient_t *state = (WebSocketClient_t *)client;
+    state->keepalive_interval = intervalMs;
+    state->keepalive_misses = maxMissed > 0 ? maxMissed : 1;
+}
+
+/*! \brief Returns the smoothed round trip time measured by the keepalive PINGs
+ *  \ingroup Websocket.c
+ *
+ * \param client handle of client
+ * \param jitter if not NULL, set to the smoothed deviation of the round trip time in milliseconds
+ * \return round trip time in milliseconds, -1 if not yet measured
+ */
+int wsGetRtt( WebSocketClient_p client, int *jitter )
+{
+    WebSocketClient_t *state = (WebSocketClient_t *)client;
+
+    if ( state->rtt_us < 0 ) {
+        if ( jitter ) {
+            *jitter = -1;
         }
-    } else if ( state->connected == TCP_DISCONNECTED && httpc_isSockOpen ) {
-        //printf("HTTP Client connect...\n");
-        if ( httpc_connect()==HTTPC_TRUE ) {
-            //printf("HTTP Client connecting...\n");
-            state->connected = TCP_CONNECTING;
-            state->upgraded = false;
-        } else {
-            printf("WebSocket HTTP Client failed to connect\n");
+        return -1;
+    }
+    if ( jitter ) {
+        *jitter = (state->rtt_var_us + 500) / 1000;
+    }
+    return (state->rtt_us + 500) / 1000;
+}
+
+/*! \brief Returns how many keepalive PINGs in a row have gone unanswered
+ *  \ingroup Websocket.c
+ *
+ * The connection is closed when this reaches the maxMissed given to
+ * wsSetKeepalive, anything less is an early sign of a failing connection.
+ *
+ * \param client handle of client
+ * \return unanswered PINGs, 0 once a PONG arrives
+ */
+int wsGetPingsMissed( WebSocketClient_p client )
+{
+    WebSocketClient_t *state = (WebSocketClient_t *)client;
+    return state->pings_missed;
+}
+
+/*! \brief Sets how the client reconnects when auto reconnect is on
+ *  \ingroup Websocket.c
+ *
+ * After a failed attempt the delay doubles from minDelayMs up to maxDelayMs,
+ * once a connection has stayed up for maxDelayMs it starts again from minDelayMs.
+ *
+ * \param client handle of client
+ * \param minDelayMs delay before the first attempt after a connection is lost
+ * \param maxDelayMs longest delay between attempts
+ * \param connectTimeoutMs time allowed from starting a connect to the upgrade being accepted, 0 for no limit
+ * \return Nothing
+ */
+void wsSetReconnect( WebSocketClient_p client, uint32_t minDelayMs, uint32_t maxDelayMs, uint32_t connectTimeoutMs )
+{
+    WebSocketClient_t *state = (WebSocketClient_t *)client;
+    state->reconnect_min = minDelayMs > 0 ? minDelayMs : 1;
+    state->reconnect_max = maxDelayMs > state->reconnect_min ? maxDelayMs : state->reconnect_min;
+    state->connect_timeout = connectTimeoutMs;
+}
+
+/*! \brief Returns reconnect counters
+ *  \ingroup Websocket.c
+ *
+ * \param client handle of client
+ * \param stats filled in with the counters since the client was created
+ * \return Nothing
+ */
+void wsGetReconnectStats( WebSocketClient_p client, wsReconnectStats_t *stats )
+{
+    WebSocketClient_t *state = (WebSocketClient_t *)client;
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+
+    *stats = state->reconnect_stats;
+    if ( state->down ) {
+        // include the outage still in progress
+        stats->disconnected_ms += now - state->down_since;
+    }
+    stats->next_attempt_ms = 0;
+    if ( state->reconnect_pending && (int32_t)(state->reconnect_at - now) > 0 ) {
+        stats->next_attempt_ms = state->reconnect_at - now;
+    }
+}
+
+/*! \brief Returns connection statistics
+ *  \ingroup Websocket.c
+ *
+ * Counters run from when the client was created, or with reset from the
+ * previous call that reset them, so a periodic reporter gets the change since
+ * its last report. Counting is a plain increment in the transport's context,
+ * nothing is lost if this is called from elsewhere while it runs.
+ *
+ * \param client handle of client
+ * \param stats filled in with the counters and the times of the last connection
+ * \param reset start counting again from zero after this call
+ * \return Nothing
+ */
+void wsGetStats( WebSocketClient_p client, wsStats_t *stats, bool reset )
+{
+    WebSocketClient_t *state = (WebSocketClient_t *)client;
+    wsStats_t current = state->stats;
+    uint32_t *counters = (uint32_t *)stats;
+    const uint32_t *base = (const uint32_t *)&state->stats_base;
+
+    // include time in the current state and the drops counted by the queues
+    current.state_ms[state->connected] += to_ms_since_boot(get_absolute_time()) - state->state_since;
+    current.queue_drops = 0;
+    for ( int priority = 0 ; priority < WS_PRIORITY_COUNT ; priority++ ) {
+        current.queue_drops += atomic_load_explicit( &state->queue[priority].drops, memory_order_relaxed );
+    }
+
+    *stats = current;
+    for ( size_t i = 0 ; i < offsetof(wsStats_t, connect_ms) / sizeof(uint32_t) ; i++ ) {
+        counters[i] -= base[i];
+    }
+    if ( reset ) {
+        state->stats_base = current;
+    }
+}
+
+#if WS_TLS
+/*! \brief Runs connections over TLS (wss://)
+ *  \ingroup Websocket.c
+ *
+ * Takes effect from the next connect. The hostname given to wsCreate is sent
+ * for SNI and checked against the server's certificate. The TLS session is
+ * kept between connections so a reconnect can resume it, skipping the
+ * public key operations that make a full handshake take seconds.
+ *
+ * \param client handle of client
+ * \param caCert CA certificate (PEM including the terminating NUL, or DER), NULL to not verify the server
+ * \param caCertLen length of caCert
+ * \return false if the transport has no TLS or out of memory
+ */
+bool wsSetTls( WebSocketClient_p client, const uint8_t *caCert, size_t caCertLen )
+{
+    WebSocketClient_t *state = (WebSocketClient_t *)client;
+
+    if ( state->transport->set_tls == NULL ) {
+        printf("WebSocket %s transport has no TLS\n", state->transport->name);
+        return false;
+    }
+    if ( caCert == NULL ) {
+        printf("WebSocket TLS without a CA certificate, the server will not be verified\n");
+    }
+    return state->transport->set_tls( state->transport_state, state->hostname ? state->hostname : state->server, caCert, caCertLen );
+}
+
+/*! \brief Returns TLS handshake statistics
+ *  \ingroup Websocket.c
+ *
+ * \param client handle of client
+ * \param stats filled in with handshake counts and times
+ * \return false if the transport has no TLS
+ */
+bool wsGetTlsStats( WebSocketClient_p client, wsTlsStats_t *stats )
+{
+    WebSocketClient_t *state = (WebSocketClient_t *)client;
+
+    if ( state->transport->tls_stats == NULL ) {
+        memset( stats, 0, sizeof(*stats) );
+        return false;
+    }
+    return state->transport->tls_stats( state->transport_state, stats );
+}
+#endif
+
+/*! \brief Returns the number of free transmit slots
+ *  \ingroup Websocket.c
+ *
+ * With WS_ZERO_COPY_TX each frame sent holds a slot until the server has
+ * acknowledged it, queued messages wait while none are free.
+ *
+ * \param client handle of client
+ * \return number of frames that can be sent before an acknowledgement is needed
+ */
+int wsTxSlotsFree( WebSocketClient_p client )
+{
+    WebSocketClient_t *state = (WebSocketClient_t *)client;
+    if ( state->transport->slots_free == NULL ) {
+        // every frame is copied
+        return WS_TX_SLOTS;
+    }
+    return state->transport->slots_free( state->transport_state );
+}
+
+/*! \brief Sends frames as soon as they are queued
+ *  \ingroup Websocket.c
+ *
+ * In latency mode Nagle's algorithm is off and a queued frame is written and
+ * pushed out by the call that queues it, rather than at the next wsHandler or
+ * lwIP poll. This costs a segment per frame, use wsCork to send several frames
+ * together. Without it frames go out on the next poll and small frames can be
+ * held back until earlier ones are acknowledged.
+ *
+ * \param client handle of client
+ * \param lowLatency true for latency mode
+ * \return Nothing
+ */
+void wsSetLatencyMode( WebSocketClient_p client, bool lowLatency )
+{
+    WebSocketClient_t *state = (WebSocketClient_t *)client;
+    state->low_latency = lowLatency;
+    if ( state->transport->set_nodelay != NULL ) {
+        state->transport->set_nodelay( state->transport_state, lowLatency );
+    }
+}
+
+/*! \brief Holds frames back so they can be sent together
+ *  \ingroup Websocket.c
+ *
+ * Frames queued until the matching wsUncork stay in the queues, then go out in
+ * one flush, in as few segments as fit them. Calls nest. Nothing is sent while
+ * corked, keepalive PINGs and PONGs included, so keep it short and bear in
+ * mind the queues hold WS_QUEUE_DEPTH frames per priority.
+ *
+ * \param client handle of client
+ * \return Nothing
+ */
+void wsCork( WebSocketClient_p client )
+{
+    WebSocketClient_t *state = (WebSocketClient_t *)client;
+    atomic_fetch_add_explicit( &state->cork, 1, memory_order_acq_rel );
+}
+
+/*! \brief Sends the frames held since wsCork
+ *  \ingroup Websocket.c
+ *
+ * The last wsUncork sends straight away if the transport can, otherwise on
+ * the next wsHandler. A wsUncork without a wsCork is ignored.
+ *
+ * \param client handle of client
+ * \return Nothing
+ */
+void wsUncork( WebSocketClient_p client )
+{
+    WebSocketClient_t *state = (WebSocketClient_t *)client;
+    int cork = atomic_load_explicit( &state->cork, memory_order_relaxed );
+
+    do {
+        if ( cork == 0 ) {
+            return;
         }
-    } else if ( state->connected == TCP_CONNECTING && httpc_isConnected ) {
-        //printf("HTTP Client connected\n");
-        wsConnected( client, ERR_OK );
-    } else  if( state->connected == TCP_CONNECTED && !httpc_isConnected ) {
-        printf("WebSocket not connected, closing socket\n");
-        wsClose( client );
+    } while ( !atomic_compare_exchange_weak_explicit( &state->cork, &cork, cork - 1, memory_order_acq_rel, memory_order_relaxed ) );
+
+    if ( cork == 1 && state->transport->kick != NULL ) {
+        state->transport->kick( state->transport_state );
     }
+}
+
+/*! \brief Returns the most heap the client can use
+ *  \ingroup Websocket.c
+ *
+ * Counts the client with its buffers, the transport, permessage-deflate if
+ * enabled, and every outbound queue full of the largest frames allowed by the
+ * transmit capacity. Define WS_RAM_BUDGET for the build to check the same
+ * figure for the default capacities.
+ *
+ * \param client handle of client
+ * \return bytes, not counting allocator overhead
+ */
+uint32_t wsRamWorstCase( WebSocketClient_p client )
+{
+    WebSocketClient_t *state = (WebSocketClient_t *)client;
+    uint8_t bits = 0;
 
+    #if WS_DEFLATE
+    // the window the next connection will use may differ from this one's
+    bits = state->deflate_window_bits > state->deflate_request_bits ? state->deflate_window_bits : state->deflate_request_bits;
     #endif
+    uint32_t ram = WS_CLIENT_RAM( state->rx_capacity, state->tx_capacity, bits, state->transport->state_size );
+
+    ram += strlen(state->server) + 1;
+    ram += state->hostname ? strlen(state->hostname) + 1 : 0;
+    ram += state->additional_headers ? strlen(state->additional_headers) + 1 : 0;
+
+    return ram;
+}
+
+/*  Abandons a connect that hasn't been upgraded by the deadline, and starts the
+ *  next attempt once its backoff delay is over.
+ */
+static void wsReconnect( WebSocketClient_t *state )
+{
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+
+    if ( state->connected != TCP_DISCONNECTED && !state->upgraded ) {
+        if ( state->connect_timeout != 0 && now - state->connect_started > state->connect_timeout ) {
+            printf("WebSocket connect timed out after %d ms\n", (int)(now - state->connect_started));
+            state->reconnect_stats.timeouts++;
+            wsClose( state );
+        }
+        return;
+    }
+
+    if ( state->reconnect_pending && state->connected == TCP_DISCONNECTED && (int32_t)(now - state->reconnect_at) >= 0 ) {
+        state->stats.reconnects++;
+        if ( !wsConnect( state ) ) {
+            wsReconnectSchedule( state, false );
+        }
+    }
+}
+
+void wsTransportService( WebSocketClient_p client )
+{
+    WebSocketClient_t *state = (WebSocketClient_t *)client;
+
+    if ( state->disconnect_requested ) {
+        state->reconnect_pending = false;
+        if ( state->connected != TCP_DISCONNECTED ) {
+            if ( state->upgraded ) {
+                wsSendClose( state, WS_CLOSE_NORMAL );
+            }
+            wsClose( state );
+        }
+        return;
+    }
+    wsKeepalive( state );
+    wsDrain( state );
+    wsReconnect( state );
 }
 
+/*! \brief Handles any WebSocket functionality, must be called periodically
+ *  \ingroup Websocket.c
+ *
+ * \param Nothing
+ * \return Nothing
+ */
+void wsHandler( WebSocketClient_p client )
+{
+    WebSocketClient_t *state = (WebSocketClient_t *)client;
+
+    // the transport services the connection then calls back into wsTransportService
+    state->transport->poll( state->transport_state );
+}
@@ -6,21 +6,213 @@ extern "C" {
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 #define BUF_SIZE 2048
 
+// default receive capacity, the largest message reassembled from fragments, see wsConfig_t
+#ifndef WS_MAX_MESSAGE_SIZE
+#define WS_MAX_MESSAGE_SIZE (BUF_SIZE-1)
+#endif
+// default transmit capacity, the largest message that can be sent
+#ifndef WS_MAX_SEND_SIZE
+#define WS_MAX_SEND_SIZE (BUF_SIZE-1)
+#endif
+// define WS_RAM_BUDGET as a number of bytes for the build to fail if a client with the
+// default capacities could use more heap, see wsRamWorstCase
+
+// deliver complete frames straight from the receive buffer rather than copying them
+#ifndef WS_ZERO_COPY_RX
+#define WS_ZERO_COPY_RX 1
+#endif
+
+// check text messages are UTF-8 as they arrive, failing the connection (1007) if not
+#ifndef WS_VALIDATE_UTF8
+#define WS_VALIDATE_UTF8 1
+#endif
+
+// hand frames to lwIP without copying, each frame holds a transmit slot until acknowledged
+#ifndef WS_ZERO_COPY_TX
+#define WS_ZERO_COPY_TX 1
+#endif
+#ifndef WS_TX_SLOTS
+#define WS_TX_SLOTS 4
+#endif
+
+// permessage-deflate (RFC 7692), offered when enabled with wsSetDeflate
+#ifndef WS_DEFLATE
+#define WS_DEFLATE 1
+#endif
+#ifndef WS_DEFLATE_WINDOW_BITS
+#define WS_DEFLATE_WINDOW_BITS 10
+#endif
+
+// client keepalive, a PING every interval (ms), the connection is closed after this many go unanswered
+#ifndef WS_KEEPALIVE_INTERVAL
+#define WS_KEEPALIVE_INTERVAL (10*1000)
+#endif
+#ifndef WS_KEEPALIVE_MISSES
+#define WS_KEEPALIVE_MISSES 3
+#endif
+
+// outbound queue priorities, a queue is only sent once those above it are empty
+typedef enum {
+    WS_PRIORITY_CONTROL,            // PING, PONG and CLOSE frames
+    WS_PRIORITY_RESPONSE,           // replies to requests from the server
+    WS_PRIORITY_NOTIFY,             // everything else
+    WS_PRIORITY_COUNT
+} wsPriority_t;
+
+// frames each priority can hold waiting to be sent, must be a power of 2
+#ifndef WS_QUEUE_DEPTH
+#define WS_QUEUE_DEPTH 8
+#endif
+
+typedef struct {
+    uint16_t depth[WS_PRIORITY_COUNT];          // frames waiting now
+    uint16_t high_water[WS_PRIORITY_COUNT];     // most frames ever waiting
+    uint32_t drops[WS_PRIORITY_COUNT];          // messages refused
+} wsQueueStats_t;
+
+// reconnect backoff, the delay doubles from min to max after each failed attempt
+#ifndef WS_RECONNECT_MIN_DELAY
+#define WS_RECONNECT_MIN_DELAY  (1*1000)
+#endif
+#ifndef WS_RECONNECT_MAX_DELAY
+#define WS_RECONNECT_MAX_DELAY  (60*1000)
+#endif
+// delays are spread by up to this percentage either way so devices don't reconnect in step
+#ifndef WS_RECONNECT_JITTER
+#define WS_RECONNECT_JITTER     25
+#endif
+// retry delay after the server rejects our credentials (close 1008, HTTP 401/403)
+#ifndef WS_RECONNECT_AUTH_DELAY
+#define WS_RECONNECT_AUTH_DELAY (5*60*1000)
+#endif
+// time allowed from starting a connect to the upgrade being accepted
+#ifndef WS_CONNECT_TIMEOUT
+#define WS_CONNECT_TIMEOUT      (15*1000)
+#endif
+
+typedef struct {
+    uint32_t attempts;          // connects started, including the first
+    uint32_t connects;          // upgrades accepted
+    uint32_t timeouts;          // attempts abandoned at the connect deadline
+    uint32_t auth_failures;     // closes with 1008 or upgrades refused with 401/403
+    uint32_t disconnected_ms;   // total time spent without an upgraded connection
+    uint32_t next_attempt_ms;   // time until the next scheduled attempt, 0 if none
+    uint16_t last_close_code;   // status of the server's last CLOSE, 0 if the connection was lost
+} wsReconnectStats_t;
+
+// frame types counted by wsGetStats
+typedef enum {
+    WS_STATS_CONTINUATION,
+    WS_STATS_TEXT,
+    WS_STATS_BINARY,
+    WS_STATS_CLOSE,
+    WS_STATS_PING,
+    WS_STATS_PONG,
+    WS_STATS_OPCODES
+} wsStatsOpcode_t;
+
+typedef struct {
+    // counters, all uint32_t and kept first so wsGetStats can return differences
+    uint32_t rx_bytes;                  // bytes received, including the upgrade response
+    uint32_t tx_bytes;                  // bytes written, including the upgrade request
+    uint32_t rx_frames[WS_STATS_OPCODES];
+    uint32_t tx_frames[WS_STATS_OPCODES];
+    uint32_t truncations;               // messages refused for exceeding the maximum size
+    uint32_t parse_failures;            // invalid frames and upgrade responses
+    uint32_t write_failures;            // frames or requests the transport failed to write
+    uint32_t queue_drops;               // messages refused by the outbound queues
+    uint32_t reconnects;                // connects started by auto reconnect
+    uint32_t tx_flushes;                // batches of frames pushed out to the network
+    uint32_t tx_segments;               // TCP segments the frames went out in, 0 if the transport can't tell
+    uint32_t tx_latency_us;             // total time frames spent queued, divide by the tx_frames total for the mean
+    uint32_t state_ms[3];               // time spent in TCP_DISCONNECTED, TCP_CONNECTING and TCP_CONNECTED
+    // last connection, not reset
+    uint32_t connect_ms;                // from starting the connect to the connection being up
+    uint32_t upgrade_ms;                // from sending the upgrade request to it being accepted
+} wsStats_t;
+
+// wss:// over lwIP altcp and mbedTLS, enabled with wsSetTls, build with the WS_TLS CMake option
+#ifndef WS_TLS
+#define WS_TLS 0
+#endif
+
+typedef struct {
+    uint32_t handshakes;        // TLS connections established
+    uint32_t resumed;           // of those, how many resumed the cached session
+    uint32_t last_handshake_ms; // TCP connect and TLS handshake of the last connection
+    uint32_t last_full_ms;      // time taken by the last full handshake
+    uint32_t last_resumed_ms;   // time taken by the last resumed handshake
+    bool last_resumed;          // the last connection resumed the cached session
+} wsTlsStats_t;
+
 #define TCP_DISCONNECTED 0
 #define TCP_CONNECTING   1
 #define TCP_CONNECTED    2
 
+// per client buffer capacities, allocated with the client in one block by wsCreate
+typedef struct {
+    uint32_t rx_capacity;           // largest message received, 0 for WS_MAX_MESSAGE_SIZE
+    uint32_t tx_capacity;           // largest message sent, 0 for WS_MAX_SEND_SIZE
+} wsConfig_t;
+
 typedef void *WebSocketClient_p;
 typedef void (*wsMessagehandler)( WebSocketClient_p client, char *message, int len );
+typedef void (*wsStreamHandler)( WebSocketClient_p client, char *chunk, int len, uint32_t offset, bool final );
+typedef void (*wsBinaryHandler)( WebSocketClient_p client, uint8_t *data, int len );
 
-WebSocketClient_p wsCreate( const char *server, const char *hostname, uint16_t port, wsMessagehandler messageHandler, char *additional_headers, bool autoReconnect );
+// one piece of a message sent with wsSendMessagev
+typedef struct {
+    const void *base;
+    size_t len;
+} wsIovec_t;
+
+// room for a message handed out by wsReserve, for exactly one wsCommit or wsRelease
+typedef struct {
+    uint8_t *frame;                 // allocation the frame is built in
+    uint32_t capacity;              // payload bytes that may be written
+    uint8_t headroom;               // bytes in front of the payload kept for the header
+} wsReservation_t;
+
+WebSocketClient_p wsCreate( const char *server, const char *hostname, uint16_t port, wsMessagehandler messageHandler, char *additional_headers, bool autoReconnect, const wsConfig_t *config );
 bool wsConnect( WebSocketClient_p client );
 bool wsDestroy( WebSocketClient_p client );
+void wsDisconnect( WebSocketClient_p client );
 int wsConnectState( WebSocketClient_p client );
+bool wsIsUpgraded( WebSocketClient_p client );
 bool wsSendMessage( WebSocketClient_p client, char *text, size_t len );
+bool wsSendMessagePriority( WebSocketClient_p client, char *text, size_t len, wsPriority_t priority );
+bool wsSendMessagev( WebSocketClient_p client, const wsIovec_t *iov, int iovcnt );
+bool wsSendBinary( WebSocketClient_p client, const uint8_t *data, size_t len );
+bool wsSendFramev( WebSocketClient_p client, const wsIovec_t *iov, int iovcnt, bool binary, wsPriority_t priority );
+char *wsReserve( WebSocketClient_p client, size_t maxLen, wsReservation_t *reservation );
+bool wsCommit( WebSocketClient_p client, wsReservation_t *reservation, size_t len, bool binary, wsPriority_t priority );
+void wsRelease( wsReservation_t *reservation );
+void wsGetQueueStats( WebSocketClient_p client, wsQueueStats_t *stats );
+void wsSetMaxMessageSize( WebSocketClient_p client, uint32_t size );
+void wsSetStreamHandler( WebSocketClient_p client, wsStreamHandler streamHandler );
+void wsSetBinaryHandler( WebSocketClient_p client, wsBinaryHandler binaryHandler );
+void wsSetKeepalive( WebSocketClient_p client, uint32_t intervalMs, uint8_t maxMissed );
+int wsGetRtt( WebSocketClient_p client, int *jitter );
+int wsGetPingsMissed( WebSocketClient_p client );
+void wsSetReconnect( WebSocketClient_p client, uint32_t minDelayMs, uint32_t maxDelayMs, uint32_t connectTimeoutMs );
+void wsGetReconnectStats( WebSocketClient_p client, wsReconnectStats_t *stats );
+void wsGetStats( WebSocketClient_p client, wsStats_t *stats, bool reset );
+int wsTxSlotsFree( WebSocketClient_p client );
+uint32_t wsRamWorstCase( WebSocketClient_p client );
+void wsSetLatencyMode( WebSocketClient_p client, bool lowLatency );
+void wsCork( WebSocketClient_p client );
+void wsUncork( WebSocketClient_p client );
+#if WS_DEFLATE
+bool wsSetDeflate( WebSocketClient_p client, uint8_t windowBits, bool contextTakeover );
+#endif
+#if WS_TLS
+bool wsSetTls( WebSocketClient_p client, const uint8_t *caCert, size_t caCertLen );
+bool wsGetTlsStats( WebSocketClient_p client, wsTlsStats_t *stats );
+#endif
 void wsHandler( WebSocketClient_p client );
 
 #ifdef __cplusplus
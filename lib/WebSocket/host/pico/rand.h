@@ -0,0 +1,19 @@
+#pragma once
+
+// Host stand-in for the Pico SDK random number generator, see stdlib.h
+
+#include <stdint.h>
+#include <sys/random.h>
+
+static inline uint32_t get_rand_32( void )
+{
+    uint32_t value = 0;
+    while ( getrandom( &value, sizeof(value), 0 ) != sizeof(value) ) {
+    }
+    return value;
+}
+
+static inline uint64_t get_rand_64( void )
+{
+    return ((uint64_t)get_rand_32() << 32) | get_rand_32();
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+/*  Stand-ins for the few Pico SDK calls the libraries use, so they can be built
+ *  on Linux with WS_TRANSPORT_POSIX=1. Put the host directory on the include
+ *  path in place of the SDK.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef uint64_t absolute_time_t;
+
+static inline absolute_time_t get_absolute_time( void )
+{
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (uint64_t)now.tv_sec * 1000000u + (uint64_t)now.tv_nsec / 1000u;
+}
+
+static inline uint32_t to_ms_since_boot( absolute_time_t t )
+{
+    return (uint32_t)(t / 1000u);
+}
+
+static inline uint64_t to_us_since_boot( absolute_time_t t )
+{
+    return t;
+}
+
+static inline void sleep_ms( uint32_t ms )
+{
+    usleep( ms * 1000u );
+}
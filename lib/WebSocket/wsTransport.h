@@ -0,0 +1,91 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "WebSocket.h"
+
+/*  Interface between the WebSocket client (WebSocket.c) and the connection it runs
+ *  over. A transport opens a TCP connection to the server and moves bytes, it knows
+ *  nothing of WebSocket framing, and tells the client what happens through the
+ *  wsTransport... callbacks below. Callbacks must be made from the context the
+ *  client runs in, the lwIP transport makes them from lwIP callbacks or under
+ *  cyw43_arch_lwip_begin.
+ */
+typedef struct {
+    const char *name;
+    uint32_t max_frame;         // largest frame write will ever accept
+    uint32_t state_size;        // bytes create allocates, for wsRamWorstCase
+    // allocates the transport's state for a client, NULL on failure
+    void *(*create)( WebSocketClient_p client, const char *server, uint16_t port );
+    void (*destroy)( void *transport );
+    // starts connecting, wsTransportConnected is called once the connection is up
+    bool (*connect)( void *transport );
+    // true if a frame of len bytes can be written now
+    bool (*writable)( void *transport, uint32_t len );
+    // writes a frame allocated with malloc, on success the transport owns it and frees it
+    // once sent, copy asks for it to be copied straight away rather than held
+    bool (*write)( void *transport, uint8_t *frame, uint32_t len, bool copy );
+    // copies the pieces and writes them, used for the upgrade request
+    bool (*writev)( void *transport, const wsIovec_t *iov, int iovcnt );
+    // sends anything written since the last flush, returns how many TCP segments the
+    // writes since the last flush were queued as, 0 if the transport can't tell
+    uint32_t (*flush)( void *transport );
+    // closes the connection, anything not yet sent is dropped
+    void (*close)( void *transport );
+    // services the connection, called from wsHandler, must call wsTransportService
+    void (*poll)( void *transport );
+    // frames that can be written before one is acknowledged, NULL if there is no limit
+    int (*slots_free)( void *transport );
+    // turns Nagle's algorithm off (or back on) now and for later connections, NULL if
+    // the transport sends every write straight away
+    void (*set_nodelay)( void *transport, bool nodelay );
+    // calls wsTransportWritable from the transport's context, may be called from any
+    // context, NULL if sending has to wait for the next poll
+    void (*kick)( void *transport );
+#if WS_TLS
+    // runs the next connection over TLS, hostname is sent for SNI and checked against the
+    // certificate, ca is a PEM or DER CA certificate, without one the server isn't verified.
+    // NULL if the transport has no TLS
+    bool (*set_tls)( void *transport, const char *hostname, const uint8_t *ca, size_t ca_len );
+    bool (*tls_stats)( void *transport, wsTlsStats_t *stats );
+#endif
+} wsTransport_t;
+
+extern const wsTransport_t wsTransportLwip;
+extern const wsTransport_t wsTransportWiznet;
+extern const wsTransport_t wsTransportPosix;
+
+// transport used by wsCreate, build with WS_TRANSPORT_POSIX=1 to run on Linux
+// WS_TRANSPORT_STATE_MAX bounds the state it allocates, for WS_RAM_BUDGET, each
+// transport checks its own state fits
+#ifndef WS_TRANSPORT
+    #if WS_TRANSPORT_POSIX
+        #define WS_TRANSPORT wsTransportPosix
+        #define WS_TRANSPORT_STATE_MAX ( BUF_SIZE + ( WS_TLS ? 256 : 128 ) )
+    #elif defined(WIZNET_BOARD)
+        #define WS_TRANSPORT wsTransportWiznet
+        #define WS_TRANSPORT_STATE_MAX ( 2 * BUF_SIZE + 64 )
+    #else
+        #define WS_TRANSPORT wsTransportLwip
+        #define WS_TRANSPORT_STATE_MAX ( WS_TLS ? 1024 : 128 )
+    #endif
+#endif
+
+// the connection is up, the client sends its upgrade request
+void wsTransportConnected( WebSocketClient_p client );
+// bytes received, tail_room is how many bytes after data the client may borrow
+void wsTransportReceive( WebSocketClient_p client, uint8_t *data, uint32_t len, uint32_t tail_room );
+// end of a batch of wsTransportReceive calls, the client replies or closes as needed
+void wsTransportReceiveDone( WebSocketClient_p client );
+// more can be written, the client sends anything waiting
+void wsTransportWritable( WebSocketClient_p client );
+// the connection failed or the server closed it, the client closes its side
+void wsTransportClosed( WebSocketClient_p client );
+// periodic client work, keepalive, sending and reconnecting
+void wsTransportService( WebSocketClient_p client );
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,723 @@
+/*===========================================================================*/
+/*                                                                           */
+/*  WebSocket transport for the Raspberry Pi Pico W, lwIP raw TCP over the   */
+/*  cyw43 driver, through altcp so the connection can run over TLS.          */
+/*                                                                           */
+/*  This is free and unencumbered software released into the public domain.  */
+/*                                                                           */
+/*===========================================================================*/
+
+#include "WebSocket.h"
+#include "wsTransport.h"
+
+#if !defined(WIZNET_BOARD) && !WS_TRANSPORT_POSIX
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"
+#include "lwip/pbuf.h"
+#include "lwip/altcp.h"
+#include "lwip/priv/tcp_priv.h"     // struct tcp_seg, to count the segments written
+#if WS_TLS
+#if !LWIP_ALTCP_TLS
+#error "WS_TLS needs LWIP_ALTCP and LWIP_ALTCP_TLS in lwipopts.h"
+#endif
+#include "lwip/altcp_tls.h"
+#include "mbedtls/ssl.h"
+
+// mbedTLS 3 hides the session id, it is only read to tell if a session was resumed
+#ifndef MBEDTLS_PRIVATE
+#define MBEDTLS_PRIVATE(member) member
+#endif
+
+// mbedtls_ssl_write takes one record at a time, a larger frame could never be written
+#define WS_LWIP_MAX_FRAME ( MBEDTLS_SSL_OUT_CONTENT_LEN < TCP_SND_BUF ? MBEDTLS_SSL_OUT_CONTENT_LEN : TCP_SND_BUF )
+#else
+#define WS_LWIP_MAX_FRAME TCP_SND_BUF
+#endif
+#if WS_ZERO_COPY_TX && !LWIP_TCP_PCB_NUM_EXT_ARGS
+#error "WS_ZERO_COPY_TX needs LWIP_TCP_PCB_NUM_EXT_ARGS in lwipopts.h, or build with WS_ZERO_COPY_TX=0"
+#endif
+
+// Transmit slot, a frame handed to lwIP without copying, freed once acknowledged
+typedef struct {
+    uint8_t *frame;                 // frame owned by the slot, NULL if lwIP copied it
+    uint16_t unacked;               // bytes not yet acknowledged by the peer
+} wsLwipTxSlot_t;
+
+/*  The transmit slots, allocated apart from wsLwip_t as frames lwIP still holds at
+ *  the close go with the pcb, freed once acknowledged or when lwIP frees the pcb.
+ */
+typedef struct {
+    wsLwipTxSlot_t slots[WS_TX_SLOTS];
+    uint8_t head;                   // oldest unacknowledged slot
+    uint8_t count;                  // slots in use
+    bool closing;                   // inside altcp_close, which may free the pcb
+    bool pcb_freed;                 // it did
+} wsLwipTx_t;
+
+typedef struct {
+    WebSocketClient_p client;
+    struct altcp_pcb *tcp_pcb;
+    ip_addr_t remote_addr;
+    u16_t remote_port;
+    bool aborted;                   // the pcb was aborted during an lwIP callback
+    wsLwipTx_t *tx;                 // NULL until connecting
+    bool nodelay;                   // Nagle's algorithm off
+    uint32_t segments;              // segments queued since the last flush
+#if WS_TLS
+    struct altcp_tls_config *tls_config;    // NULL for plain TCP
+    const char *tls_hostname;       // SNI and certificate name, owned by the client
+    bool tls_verify;                // a CA certificate was given, the server must match it
+    struct altcp_tls_session tls_session;   // kept from the last connection to resume it
+    bool tls_session_valid;
+    bool tls_established;           // handshake done on the current connection
+    uint32_t tls_started;           // time the current connect started
+    wsTlsStats_t tls_stats;
+#endif
+} wsLwip_t;
+
+#define WS_LWIP_STATE_SIZE ( sizeof(wsLwip_t) + sizeof(wsLwipTx_t) )
+
+#ifdef WS_TRANSPORT_STATE_MAX
+_Static_assert( WS_LWIP_STATE_SIZE <= WS_TRANSPORT_STATE_MAX, "WS_TRANSPORT_STATE_MAX doesn't cover wsLwip_t" );
+#endif
+
+#if WS_ZERO_COPY_TX
+
+/*  Records len bytes written, frame is NULL if lwIP copied them. Copied bytes are
+ *  acknowledged straight after the newest slot's so they are added to it, that
+ *  way copying never needs a free slot.
+ */
+static void wsLwipCommit( wsLwipTx_t *tx, uint8_t *frame, uint32_t len )
+{
+    if ( frame == NULL && tx->count > 0 ) {
+        tx->slots[(tx->head + tx->count - 1) % WS_TX_SLOTS].unacked += (uint16_t)len;
+        return;
+    }
+
+    wsLwipTxSlot_t *slot = &tx->slots[(tx->head + tx->count) % WS_TX_SLOTS];
+    slot->frame = frame;
+    slot->unacked = (uint16_t)len;
+    tx->count++;
+}
+
+#endif
+
+static bool wsLwipTxInUse( wsLwipTx_t *tx )
+{
+    for ( int i = 0 ; tx != NULL && i < tx->count ; i++ ) {
+        if ( tx->slots[(tx->head + i) % WS_TX_SLOTS].frame != NULL ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Acknowledgements arrive in order, releases the slots they complete
+static void wsLwipTxAcked( wsLwipTx_t *tx, u16_t len )
+{
+    while ( len > 0 && tx->count > 0 ) {
+        wsLwipTxSlot_t *slot = &tx->slots[tx->head];
+        uint16_t acked = len < slot->unacked ? len : slot->unacked;
+        slot->unacked -= acked;
+        len -= acked;
+        if ( slot->unacked == 0 ) {
+            free( slot->frame );
+            slot->frame = NULL;
+            tx->head = (tx->head + 1) % WS_TX_SLOTS;
+            tx->count--;
+        }
+    }
+}
+
+// Frees frames still held by the slots, only once lwIP has dropped its references
+static void wsLwipTxReset( wsLwipTx_t *tx )
+{
+    for ( int i = 0 ; tx != NULL && i < tx->count ; i++ ) {
+        free( tx->slots[(tx->head + i) % WS_TX_SLOTS].frame );
+    }
+    if ( tx != NULL ) {
+        memset( tx, 0, sizeof(wsLwipTx_t) );
+    }
+}
+
+#if WS_ZERO_COPY_TX
+
+static u8_t ws_lwip_ext_id;         // the pcb's ext arg a closed connection's slots hang on
+static bool ws_lwip_ext_allocated;
+
+// lwIP is freeing a closed pcb, so nothing references the slots' frames any more
+static void wsLwipTxDestroyed( u8_t id, void *data )
+{
+    wsLwipTx_t *tx = (wsLwipTx_t *)data;
+    (void)id;
+
+    if ( tx == NULL ) {
+        return;
+    }
+    if ( tx->closing ) {
+        // freed by altcp_close or altcp_abort, wsLwipClose takes the slots back
+        tx->pcb_freed = true;
+        return;
+    }
+    wsLwipTxReset( tx );
+    free( tx );
+}
+
+static const struct tcp_ext_arg_callbacks ws_lwip_ext_callbacks = {
+    .destroy = wsLwipTxDestroyed,
+};
+
+// Acknowledgements after the close, the slots are freed with the last frame
+static err_t wsLwipClosedSent( void *arg, struct tcp_pcb *tpcb, u16_t len )
+{
+    wsLwipTx_t *tx = (wsLwipTx_t *)arg;
+
+    wsLwipTxAcked( tx, len );
+    if ( !wsLwipTxInUse( tx ) ) {
+        tcp_arg( tpcb, NULL );
+        tcp_sent( tpcb, NULL );
+        tcp_ext_arg_set_callbacks( tpcb, ws_lwip_ext_id, NULL );
+        tcp_ext_arg_set( tpcb, ws_lwip_ext_id, NULL );
+        wsLwipTxReset( tx );
+        free( tx );
+    }
+    return ERR_OK;
+}
+
+#endif
+
+// The TCP connection at the bottom of the altcp stack
+static struct tcp_pcb *wsLwipTcp( struct altcp_pcb *conn )
+{
+    #if LWIP_ALTCP
+    while ( conn->inner_conn != NULL ) {
+        conn = conn->inner_conn;
+    }
+    return (struct tcp_pcb *)conn->state;
+    #else
+    return conn;
+    #endif
+}
+
+// Segments lwIP holds for the connection, sent or not
+static uint32_t wsLwipSegmentsHeld( struct tcp_pcb *pcb )
+{
+    uint32_t count = 0;
+
+    for ( struct tcp_seg *seg = pcb->unsent ; seg != NULL ; seg = seg->next ) {
+        count++;
+    }
+    for ( struct tcp_seg *seg = pcb->unacked ; seg != NULL ; seg = seg->next ) {
+        count++;
+    }
+    return count;
+}
+
+/*  Writes through altcp, counting the segments lwIP adds for the data. Nothing
+ *  is acknowledged while writing, so a write that fits in the last segment adds
+ *  nothing, and new segments count whether TLS sends them straight away or they
+ *  wait for the flush.
+ */
+static err_t wsLwipWriteCounted( wsLwip_t *lwip, const void *data, u16_t len, u8_t flags )
+{
+    struct tcp_pcb *pcb = wsLwipTcp( lwip->tcp_pcb );
+    uint32_t before = wsLwipSegmentsHeld( pcb );
+
+    err_t err = altcp_write( lwip->tcp_pcb, data, len, flags );
+    lwip->segments += wsLwipSegmentsHeld( pcb ) - before;
+    return err;
+}
+
+static err_t wsLwipSent(void *arg, struct altcp_pcb *tpcb, u16_t len) {
+    wsLwip_t *lwip = (wsLwip_t*)arg;
+
+    wsLwipTxAcked( lwip->tx, len );
+
+    // window has opened up, move on anything waiting
+    lwip->aborted = false;
+    wsTransportWritable( lwip->client );
+
+    return lwip->aborted ? ERR_ABRT : ERR_OK;
+}
+
+static err_t wsLwipPoll(void *arg, struct altcp_pcb *tpcb) {
+    wsLwip_t *lwip = (wsLwip_t*)arg;
+
+    // catch anything queued while nothing else was happening
+    lwip->aborted = false;
+    wsTransportWritable( lwip->client );
+    return lwip->aborted ? ERR_ABRT : ERR_OK;
+}
+
+/*  Bytes after a received pbuf's data that the client may borrow. Pool pbufs, as
+ *  the cyw43 driver and altcp TLS receive into, are PBUF_POOL_BUFSIZE bytes after
+ *  the pbuf itself, anything past the data is unused. Other kinds aren't known.
+ */
+static uint32_t wsLwipTailRoom( struct pbuf *q )
+{
+    if ( !pbuf_match_type( q, PBUF_POOL ) || ( q->flags & PBUF_FLAG_IS_CUSTOM ) || q->ref != 1 ) {
+        return 0;
+    }
+
+    uint8_t *end = (uint8_t *)q + LWIP_MEM_ALIGN_SIZE(sizeof(struct pbuf)) + LWIP_MEM_ALIGN_SIZE(PBUF_POOL_BUFSIZE);
+    uint8_t *tail = (uint8_t *)q->payload + q->len;
+
+    return tail < end ? (uint32_t)( end - tail ) : 0;
+}
+
+static err_t wsLwipReceive(void *arg, struct altcp_pcb *tpcb, struct pbuf *p, err_t err)
+{
+    wsLwip_t *lwip = (wsLwip_t*)arg;
+
+    // this method is callback from lwIP, so cyw43_arch_lwip_begin is not required, however you
+    // can use this method to cause an assertion in debug mode, if this method is called when
+    // cyw43_arch_lwip_begin IS needed
+    cyw43_arch_lwip_check();
+    lwip->aborted = false;
+
+    if(p == NULL) {
+        // Close
+        wsTransportClosed( lwip->client );
+        return lwip->aborted ? ERR_ABRT : ERR_OK;
+    }
+
+    if (p->tot_len > 0) {
+        // decode straight from each segment of the chain, the chain is only
+        // released once every frame it holds has been handled
+        for (struct pbuf *q = p; q != NULL; q = q->next) {
+            wsTransportReceive( lwip->client, (uint8_t *)q->payload, q->len, wsLwipTailRoom( q ) );
+        }
+        altcp_recved(tpcb, p->tot_len);
+    }
+    pbuf_free(p);
+
+    // send any replies, or close if the data was bad
+    wsTransportReceiveDone( lwip->client );
+
+    return lwip->aborted ? ERR_ABRT : ERR_OK;
+}
+
+#if WS_TLS
+
+// Drops the cached session, also after a failed handshake as offering it again would fail again
+static void wsLwipTlsForget( wsLwip_t *lwip )
+{
+    if ( lwip->tls_session_valid ) {
+        altcp_tls_free_session( &lwip->tls_session );
+        altcp_tls_init_session( &lwip->tls_session );
+        lwip->tls_session_valid = false;
+    }
+}
+
+/*  Called once the TLS handshake is done. Keeps the session for the next connect,
+ *  the server kept the cached one if it agreed to resume with the same session id.
+ */
+static void wsLwipTlsEstablished( wsLwip_t *lwip, struct altcp_pcb *tpcb )
+{
+    uint32_t elapsed = to_ms_since_boot(get_absolute_time()) - lwip->tls_started;
+    mbedtls_ssl_session *cached = &lwip->tls_session.data;
+    unsigned char id[32];
+    size_t id_len = 0;
+    bool resumed = false;
+
+    if ( lwip->tls_session_valid ) {
+        id_len = cached->MBEDTLS_PRIVATE(id_len);
+        memcpy( id, cached->MBEDTLS_PRIVATE(id), id_len );
+    }
+    wsLwipTlsForget( lwip );
+    lwip->tls_session_valid = altcp_tls_get_session(tpcb, &lwip->tls_session) == ERR_OK;
+    if ( lwip->tls_session_valid && id_len > 0 && cached->MBEDTLS_PRIVATE(id_len) == id_len ) {
+        resumed = memcmp( id, cached->MBEDTLS_PRIVATE(id), id_len ) == 0;
+    }
+
+    lwip->tls_established = true;
+    lwip->tls_stats.handshakes++;
+    lwip->tls_stats.last_handshake_ms = elapsed;
+    lwip->tls_stats.last_resumed = resumed;
+    if ( resumed ) {
+        lwip->tls_stats.resumed++;
+        lwip->tls_stats.last_resumed_ms = elapsed;
+    } else {
+        lwip->tls_stats.last_full_ms = elapsed;
+    }
+    printf("WebSocket TLS %s handshake %lu ms\n", resumed ? "resumed" : "full", (unsigned long)elapsed);
+}
+
+#endif
+
+static err_t wsLwipConnected(void *arg, struct altcp_pcb *tpcb, err_t err)
+{
+    wsLwip_t *lwip = (wsLwip_t*)arg;
+    if (err != ERR_OK) {
+        printf("WebSocket connect failed %d\n", err);
+        return ERR_ABRT;
+    }
+
+    #if WS_TLS
+    // over TLS this is called once the handshake is done
+    if ( lwip->tls_config != NULL ) {
+        // lwIP only records the verification result unless built with ALTCP_MBEDTLS_AUTHMODE required
+        if ( lwip->tls_verify && mbedtls_ssl_get_verify_result(altcp_tls_context(tpcb)) != 0 ) {
+            printf("WebSocket TLS server certificate not trusted\n");
+            altcp_abort( tpcb );    // reported through wsLwipError
+            return ERR_ABRT;
+        }
+        wsLwipTlsEstablished( lwip, tpcb );
+    }
+    #endif
+
+    lwip->aborted = false;
+    wsTransportConnected( lwip->client );
+    return lwip->aborted ? ERR_ABRT : ERR_OK;
+}
+
+static void wsLwipError(void *arg, err_t err) {
+    wsLwip_t *lwip = (wsLwip_t*)arg;
+    // the pcb has already been freed by lwIP
+    lwip->tcp_pcb = NULL;
+    if (err != ERR_ABRT) {
+        printf("WebSocket Client Error %d\n", err);
+    } else {
+        printf("WebSocket Client Error abort %d\n", err);
+    }
+    #if WS_TLS
+    if ( lwip->tls_config != NULL && !lwip->tls_established ) {
+        wsLwipTlsForget( lwip );
+    }
+    #endif
+
+    wsTransportClosed( lwip->client );
+}
+
+static void *wsLwipCreate( WebSocketClient_p client, const char *server, uint16_t port )
+{
+    wsLwip_t *lwip = (wsLwip_t *)calloc(1, sizeof(wsLwip_t));
+    if ( lwip ) {
+        lwip->client = client;
+        ip4addr_aton(server, &lwip->remote_addr);
+        lwip->remote_port = port;
+        #if WS_TLS
+        altcp_tls_init_session( &lwip->tls_session );
+        #endif
+        #if WS_ZERO_COPY_TX
+        if ( !ws_lwip_ext_allocated ) {
+            cyw43_arch_lwip_begin();
+            ws_lwip_ext_id = tcp_ext_arg_alloc_id();
+            cyw43_arch_lwip_end();
+            ws_lwip_ext_allocated = true;
+        }
+        #endif
+    }
+    return lwip;
+}
+
+static void wsLwipDestroy( void *transport )
+{
+    wsLwip_t *lwip = (wsLwip_t *)transport;
+
+    // closed by now, the slots hold nothing lwIP still references
+    wsLwipTxReset( lwip->tx );
+    free( lwip->tx );
+    #if WS_TLS
+    wsLwipTlsForget( lwip );
+    if ( lwip->tls_config != NULL ) {
+        altcp_tls_free_config( lwip->tls_config );
+    }
+    #endif
+    free( transport );
+}
+
+static bool wsLwipConnect( void *transport )
+{
+    wsLwip_t *lwip = (wsLwip_t *)transport;
+    err_t err = ERR_ABRT;
+
+    if ( lwip->tx == NULL ) {
+        // the last connection's went with its pcb
+        lwip->tx = (wsLwipTx_t *)calloc(1, sizeof(wsLwipTx_t));
+        if ( lwip->tx == NULL ) {
+            return false;
+        }
+    }
+
+    // cyw43_arch_lwip_begin/end should be used around calls into lwIP to ensure correct locking.
+    // You can omit them if you are in a callback from lwIP. Note that when using pico_cyw_arch_poll
+    // these calls are a no-op and can be omitted, but it is a good practice to use them in
+    // case you switch the cyw43_arch type later.
+    cyw43_arch_lwip_begin();
+    #if WS_TLS
+    if ( lwip->tls_config != NULL ) {
+        lwip->tcp_pcb = altcp_tls_new(lwip->tls_config, IP_GET_TYPE(&lwip->remote_addr));
+        if ( lwip->tcp_pcb ) {
+            mbedtls_ssl_set_hostname(altcp_tls_context(lwip->tcp_pcb), lwip->tls_hostname);
+            if ( lwip->tls_session_valid ) {
+                // offer the last session, the server falls back to a full handshake if it has forgotten it
+                altcp_tls_set_session(lwip->tcp_pcb, &lwip->tls_session);
+            }
+        }
+        lwip->tls_established = false;
+        lwip->tls_started = to_ms_since_boot(get_absolute_time());
+    } else
+    #endif
+    lwip->tcp_pcb = altcp_new_ip_type(NULL, IP_GET_TYPE(&lwip->remote_addr));
+    if (!lwip->tcp_pcb) {
+        cyw43_arch_lwip_end();
+        return false;
+    }
+    if ( lwip->nodelay ) {
+        altcp_nagle_disable(lwip->tcp_pcb);
+    }
+    lwip->segments = 0;
+
+    altcp_arg(lwip->tcp_pcb, lwip);
+    altcp_poll(lwip->tcp_pcb, wsLwipPoll, 1);
+    altcp_sent(lwip->tcp_pcb, wsLwipSent);
+    altcp_recv(lwip->tcp_pcb, wsLwipReceive);
+    altcp_err(lwip->tcp_pcb, wsLwipError);
+
+    wsLwipTxReset( lwip->tx );
+    err = altcp_connect(lwip->tcp_pcb, &lwip->remote_addr, lwip->remote_port, wsLwipConnected);
+    cyw43_arch_lwip_end();
+
+    return err == ERR_OK;
+}
+
+static bool wsLwipWritable( void *transport, uint32_t len )
+{
+    wsLwip_t *lwip = (wsLwip_t *)transport;
+    return lwip->tcp_pcb != NULL && altcp_sndbuf(lwip->tcp_pcb) >= len;
+}
+
+static bool wsLwipWrite( void *transport, uint8_t *frame, uint32_t len, bool copy )
+{
+    wsLwip_t *lwip = (wsLwip_t *)transport;
+
+    #if WS_TLS
+    if ( lwip->tls_config != NULL ) {
+        // encrypted into lwIP's own buffers straight away, nothing to hold on to
+        if ( wsLwipWriteCounted(lwip, frame, len, TCP_WRITE_FLAG_COPY) != ERR_OK ) {
+            return false;
+        }
+        free( frame );
+        return true;
+    }
+    #endif
+
+    #if WS_ZERO_COPY_TX
+    if ( !copy ) {
+        if ( lwip->tx->count >= WS_TX_SLOTS || wsLwipWriteCounted(lwip, frame, len, 0) != ERR_OK ) {
+            return false;
+        }
+        // the slot owns the frame until it is acknowledged
+        wsLwipCommit( lwip->tx, frame, len );
+        return true;
+    }
+    #endif
+
+    if ( wsLwipWriteCounted(lwip, frame, len, TCP_WRITE_FLAG_COPY) != ERR_OK ) {
+        return false;
+    }
+    #if WS_ZERO_COPY_TX
+    // copied by lwIP, but still accounted for so later acknowledgements line up
+    wsLwipCommit( lwip->tx, NULL, len );
+    #endif
+    free( frame );
+    return true;
+}
+
+static bool wsLwipWritev( void *transport, const wsIovec_t *iov, int iovcnt )
+{
+    wsLwip_t *lwip = (wsLwip_t *)transport;
+    uint32_t total = 0;
+
+    if ( lwip->tcp_pcb == NULL ) {
+        return false;
+    }
+    for ( int i = 0 ; i < iovcnt ; i++ ) {
+        if ( iov[i].len == 0 ) {
+            continue;
+        }
+        u8_t flags = TCP_WRITE_FLAG_COPY | ( i < iovcnt - 1 ? TCP_WRITE_FLAG_MORE : 0 );
+        if ( wsLwipWriteCounted(lwip, iov[i].base, (u16_t)iov[i].len, flags) != ERR_OK ) {
+            return false;
+        }
+        total += iov[i].len;
+    }
+    #if WS_ZERO_COPY_TX
+    #if WS_TLS
+    if ( lwip->tls_config == NULL )
+    #endif
+    wsLwipCommit( lwip->tx, NULL, total );
+    #endif
+    return true;
+}
+
+static uint32_t wsLwipFlush( void *transport )
+{
+    wsLwip_t *lwip = (wsLwip_t *)transport;
+    uint32_t segments = lwip->segments;
+
+    if ( lwip->tcp_pcb != NULL ) {
+        altcp_output( lwip->tcp_pcb );
+    }
+    lwip->segments = 0;
+    return segments;
+}
+
+static void wsLwipClose( void *transport )
+{
+    wsLwip_t *lwip = (wsLwip_t *)transport;
+    err_t err;
+
+    if (lwip->tcp_pcb != NULL) {
+        #if WS_ZERO_COPY_TX
+        struct tcp_pcb *pcb = wsLwipTcp( lwip->tcp_pcb );
+        wsLwipTx_t *tx = NULL;
+        #endif
+        altcp_arg(lwip->tcp_pcb, NULL);
+        altcp_poll(lwip->tcp_pcb, NULL, 0);
+        altcp_sent(lwip->tcp_pcb, NULL);
+        altcp_recv(lwip->tcp_pcb, NULL);
+        altcp_err(lwip->tcp_pcb, NULL);
+        #if WS_ZERO_COPY_TX
+        if ( wsLwipTxInUse( lwip->tx ) ) {
+            // lwIP still sends unacknowledged frames after the close, the slots go with the pcb
+            tx = lwip->tx;
+            lwip->tx = NULL;
+            tx->closing = true;
+            tcp_ext_arg_set_callbacks( pcb, ws_lwip_ext_id, &ws_lwip_ext_callbacks );
+            tcp_ext_arg_set( pcb, ws_lwip_ext_id, tx );
+        }
+        #endif
+        // queued data, the CLOSE frame included, is still sent before the FIN
+        err = altcp_close(lwip->tcp_pcb);
+        if (err != ERR_OK) {
+            printf("WebSocket close failed %d, calling abort\n", err);
+            altcp_abort(lwip->tcp_pcb);
+            lwip->aborted = true;
+        }
+        lwip->tcp_pcb = NULL;
+        #if WS_ZERO_COPY_TX
+        if ( tx != NULL ) {
+            tx->closing = false;
+            if ( tx->pcb_freed ) {
+                // nothing left to acknowledge them, the slots are ours again
+                lwip->tx = tx;
+            } else {
+                // altcp_close dropped the callbacks, the TCP pcb itself reports what is acknowledged
+                tcp_arg( pcb, tx );
+                tcp_sent( pcb, wsLwipClosedSent );
+            }
+        }
+        #endif
+    }
+    wsLwipTxReset( lwip->tx );
+}
+
+static void wsLwipPollClient( void *transport )
+{
+    wsLwip_t *lwip = (wsLwip_t *)transport;
+
+    cyw43_arch_lwip_begin();
+    wsTransportService( lwip->client );
+    cyw43_arch_lwip_end();
+}
+
+static void wsLwipSetNodelay( void *transport, bool nodelay )
+{
+    wsLwip_t *lwip = (wsLwip_t *)transport;
+
+    cyw43_arch_lwip_begin();
+    lwip->nodelay = nodelay;
+    if ( lwip->tcp_pcb != NULL ) {
+        if ( nodelay ) {
+            altcp_nagle_disable(lwip->tcp_pcb);
+        } else {
+            altcp_nagle_enable(lwip->tcp_pcb);
+        }
+    }
+    cyw43_arch_lwip_end();
+}
+
+static void wsLwipKick( void *transport )
+{
+    wsLwip_t *lwip = (wsLwip_t *)transport;
+
+    // the lock is recursive, so this is safe from lwIP callbacks too
+    cyw43_arch_lwip_begin();
+    wsTransportWritable( lwip->client );
+    cyw43_arch_lwip_end();
+}
+
+static int wsLwipSlotsFree( void *transport )
+{
+    #if WS_ZERO_COPY_TX
+    wsLwip_t *lwip = (wsLwip_t *)transport;
+    return lwip->tx != NULL ? WS_TX_SLOTS - lwip->tx->count : WS_TX_SLOTS;
+    #else
+    // every frame is copied
+    return WS_TX_SLOTS;
+    #endif
+}
+
+#if WS_TLS
+
+static bool wsLwipSetTls( void *transport, const char *hostname, const uint8_t *ca, size_t ca_len )
+{
+    wsLwip_t *lwip = (wsLwip_t *)transport;
+
+    if ( lwip->tls_config != NULL ) {
+        altcp_tls_free_config( lwip->tls_config );
+    }
+    wsLwipTlsForget( lwip );
+    // parses the CA certificate once, every connection shares it
+    cyw43_arch_lwip_begin();
+    lwip->tls_config = altcp_tls_create_config_client(ca, ca_len);
+    cyw43_arch_lwip_end();
+    if ( lwip->tls_config == NULL ) {
+        printf("WebSocket failed to create TLS config\n");
+        return false;
+    }
+    lwip->tls_hostname = hostname;
+    lwip->tls_verify = ( ca != NULL );
+    return true;
+}
+
+static bool wsLwipTlsStats( void *transport, wsTlsStats_t *stats )
+{
+    wsLwip_t *lwip = (wsLwip_t *)transport;
+    *stats = lwip->tls_stats;
+    return true;
+}
+
+#endif
+
+const wsTransport_t wsTransportLwip = {
+    .name = "lwIP",
+    // a frame larger than the send buffer would block its queue for good
+    .max_frame = WS_LWIP_MAX_FRAME,
+    .state_size = WS_LWIP_STATE_SIZE,
+    .create = wsLwipCreate,
+    .destroy = wsLwipDestroy,
+    .connect = wsLwipConnect,
+    .writable = wsLwipWritable,
+    .write = wsLwipWrite,
+    .writev = wsLwipWritev,
+    .flush = wsLwipFlush,
+    .close = wsLwipClose,
+    .poll = wsLwipPollClient,
+    .slots_free = wsLwipSlotsFree,
+    .set_nodelay = wsLwipSetNodelay,
+    .kick = wsLwipKick,
+#if WS_TLS
+    .set_tls = wsLwipSetTls,
+    .tls_stats = wsLwipTlsStats,
+#endif
+};
+
+#endif
@@ -0,0 +1,496 @@
+/*===========================================================================*/
+/*                                                                           */
+/*  WebSocket transport over POSIX sockets, so the client and everything     */
+/*  built on it can be run and measured on Linux against a local server.     */
+/*  Build with WS_TRANSPORT_POSIX=1 and the host/ include directory, with    */
+/*  WS_TLS=1 wss:// runs over OpenSSL (link -lssl -lcrypto).                 */
+/*                                                                           */
+/*  This is free and unencumbered software released into the public domain.  */
+/*                                                                           */
+/*===========================================================================*/
+
+#include "WebSocket.h"
+#include "wsTransport.h"
+
+#if WS_TRANSPORT_POSIX
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/tcp.h>              // struct tcp_info with the segment counts
+#include <arpa/inet.h>
+#if WS_TLS
+#include <openssl/ssl.h>
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+#include "pico/stdlib.h"
+#endif
+
+typedef struct {
+    WebSocketClient_p client;
+    struct sockaddr_in addr;
+    int fd;                         // -1 when closed
+    bool connecting;                // non-blocking connect still in progress
+    bool nodelay;                   // Nagle's algorithm off
+    uint32_t segments;              // data segments the kernel had sent at the last flush
+    pthread_mutex_t lock;           // held by poll and kick, recursive as the lwIP lock is
+#if WS_TLS
+    SSL_CTX *tls_ctx;               // NULL for plain TCP
+    SSL *ssl;                       // the current connection's, NULL when closed
+    SSL_SESSION *tls_session;       // kept from the last connection to resume it
+    const char *tls_hostname;       // SNI and certificate name, owned by the client
+    bool tls_verify;                // a CA certificate was given, the server must match it
+    bool tls_handshaking;           // TCP is up, the TLS handshake isn't done
+    uint32_t tls_started;           // time the current connect started
+    wsTlsStats_t tls_stats;
+#endif
+    uint8_t recv_buf[BUF_SIZE];
+} wsPosix_t;
+
+#ifdef WS_TRANSPORT_STATE_MAX
+_Static_assert( sizeof(wsPosix_t) <= WS_TRANSPORT_STATE_MAX, "WS_TRANSPORT_STATE_MAX doesn't cover wsPosix_t" );
+#endif
+
+static void *wsPosixCreate( WebSocketClient_p client, const char *server, uint16_t port )
+{
+    wsPosix_t *posix = (wsPosix_t *)calloc(1, sizeof(wsPosix_t));
+    if ( posix ) {
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init( &attr );
+        pthread_mutexattr_settype( &attr, PTHREAD_MUTEX_RECURSIVE );
+        pthread_mutex_init( &posix->lock, &attr );
+        pthread_mutexattr_destroy( &attr );
+        posix->client = client;
+        posix->fd = -1;
+        posix->addr.sin_family = AF_INET;
+        posix->addr.sin_port = htons(port);
+        if ( inet_pton(AF_INET, server, &posix->addr.sin_addr) != 1 ) {
+            printf("WebSocket invalid server ip address [%s]\n", server);
+        }
+    }
+    return posix;
+}
+
+static void wsPosixClose( void *transport )
+{
+    wsPosix_t *posix = (wsPosix_t *)transport;
+    #if WS_TLS
+    if ( posix->ssl != NULL && !posix->tls_handshaking ) {
+        // closed without close_notify OpenSSL takes the session as not resumable
+        SSL_shutdown( posix->ssl );
+    }
+    SSL_free( posix->ssl );
+    posix->ssl = NULL;
+    posix->tls_handshaking = false;
+    #endif
+    if ( posix->fd >= 0 ) {
+        close( posix->fd );
+        posix->fd = -1;
+    }
+    posix->connecting = false;
+}
+
+static void wsPosixDestroy( void *transport )
+{
+    wsPosix_t *posix = (wsPosix_t *)transport;
+
+    wsPosixClose( transport );
+    #if WS_TLS
+    SSL_SESSION_free( posix->tls_session );
+    SSL_CTX_free( posix->tls_ctx );
+    #endif
+    pthread_mutex_destroy( &posix->lock );
+    free( transport );
+}
+
+static bool wsPosixConnect( void *transport )
+{
+    wsPosix_t *posix = (wsPosix_t *)transport;
+    int nodelay = posix->nodelay;
+
+    posix->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if ( posix->fd < 0 ) {
+        return false;
+    }
+    posix->segments = 0;
+    #if WS_TLS
+    posix->tls_started = to_ms_since_boot(get_absolute_time());
+    #endif
+    setsockopt( posix->fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay) );
+    fcntl( posix->fd, F_SETFL, fcntl(posix->fd, F_GETFL) | O_NONBLOCK );
+
+    if ( connect(posix->fd, (struct sockaddr *)&posix->addr, sizeof(posix->addr)) != 0 && errno != EINPROGRESS ) {
+        printf("WebSocket connect failed %d\n", errno);
+        wsPosixClose( posix );
+        return false;
+    }
+    posix->connecting = true;
+    return true;
+}
+
+static bool wsPosixWritable( void *transport, uint32_t len )
+{
+    wsPosix_t *posix = (wsPosix_t *)transport;
+    (void)len;      // the socket buffers whatever it is given
+    #if WS_TLS
+    if ( posix->tls_handshaking ) {
+        return false;
+    }
+    #endif
+    return posix->fd >= 0 && !posix->connecting;
+}
+
+/*  Writes everything, the socket is blocking for writes once connected. Held as
+ *  more to come so a batch of frames shares segments, the flush sends them.
+ */
+static bool wsPosixSend( wsPosix_t *posix, const void *data, size_t len )
+{
+    const uint8_t *p = (const uint8_t *)data;
+
+    #if WS_TLS
+    if ( posix->ssl != NULL ) {
+        // the socket stays non-blocking under TLS, wait for room instead. Corked so a
+        // batch of records shares segments, the flush uncorks
+        int cork = 1;
+        setsockopt( posix->fd, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork) );
+        while ( len > 0 ) {
+            int n = SSL_write( posix->ssl, p, (int)len );
+            if ( n <= 0 ) {
+                int error = SSL_get_error( posix->ssl, n );
+                if ( error != SSL_ERROR_WANT_WRITE && error != SSL_ERROR_WANT_READ ) {
+                    return false;
+                }
+                struct pollfd pfd = { .fd = posix->fd, .events = error == SSL_ERROR_WANT_WRITE ? POLLOUT : POLLIN };
+                poll( &pfd, 1, -1 );
+                continue;
+            }
+            p += n;
+            len -= (size_t)n;
+        }
+        return true;
+    }
+    #endif
+
+    while ( len > 0 ) {
+        ssize_t n = send( posix->fd, p, len, MSG_NOSIGNAL | MSG_MORE );
+        if ( n < 0 ) {
+            if ( errno == EINTR ) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+static bool wsPosixWrite( void *transport, uint8_t *frame, uint32_t len, bool copy )
+{
+    wsPosix_t *posix = (wsPosix_t *)transport;
+    (void)copy;     // always sent, or copied by the kernel, before returning
+
+    if ( !wsPosixSend( posix, frame, len ) ) {
+        return false;
+    }
+    free( frame );
+    return true;
+}
+
+static bool wsPosixWritev( void *transport, const wsIovec_t *iov, int iovcnt )
+{
+    wsPosix_t *posix = (wsPosix_t *)transport;
+
+    for ( int i = 0 ; i < iovcnt ; i++ ) {
+        if ( !wsPosixSend( posix, iov[i].base, iov[i].len ) ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static uint32_t wsPosixFlush( void *transport )
+{
+    wsPosix_t *posix = (wsPosix_t *)transport;
+    struct tcp_info info;
+    socklen_t info_len = sizeof(info);
+    int cork = 0;
+
+    if ( posix->fd < 0 ) {
+        return 0;
+    }
+    // uncorking pushes out what MSG_MORE held back
+    setsockopt( posix->fd, IPPROTO_TCP, TCP_CORK, &cork, sizeof(cork) );
+    if ( getsockopt(posix->fd, IPPROTO_TCP, TCP_INFO, &info, &info_len) != 0 ) {
+        return 0;
+    }
+    uint32_t segments = info.tcpi_data_segs_out - posix->segments;
+    posix->segments = info.tcpi_data_segs_out;
+    return segments;
+}
+
+static void wsPosixSetNodelay( void *transport, bool nodelay )
+{
+    wsPosix_t *posix = (wsPosix_t *)transport;
+    int value = nodelay;
+
+    posix->nodelay = nodelay;
+    if ( posix->fd >= 0 ) {
+        setsockopt( posix->fd, IPPROTO_TCP, TCP_NODELAY, &value, sizeof(value) );
+    }
+}
+
+/*  The transport's context is wsPosixPoll, on the thread calling wsHandler. A kick from
+ *  another thread waits for the poll to finish rather than draining the queue alongside
+ *  it, the queue has a single consumer.
+ */
+static void wsPosixKick( void *transport )
+{
+    wsPosix_t *posix = (wsPosix_t *)transport;
+
+    pthread_mutex_lock( &posix->lock );
+    wsTransportWritable( posix->client );
+    pthread_mutex_unlock( &posix->lock );
+}
+
+#if WS_TLS
+
+// Keeps each session the server issues, a TLS 1.3 ticket may only come after the handshake
+static int wsPosixTlsNewSession( SSL *ssl, SSL_SESSION *session )
+{
+    wsPosix_t *posix = (wsPosix_t *)SSL_get_app_data( ssl );
+    SSL_SESSION_free( posix->tls_session );
+    posix->tls_session = session;
+    return 1;
+}
+
+// Starts the handshake once TCP is up, offering the cached session
+static bool wsPosixTlsStart( wsPosix_t *posix )
+{
+    posix->ssl = SSL_new( posix->tls_ctx );
+    if ( posix->ssl == NULL ) {
+        return false;
+    }
+    SSL_set_app_data( posix->ssl, posix );
+    SSL_set_fd( posix->ssl, posix->fd );
+    SSL_set_tlsext_host_name( posix->ssl, posix->tls_hostname );
+    if ( posix->tls_verify ) {
+        SSL_set1_host( posix->ssl, posix->tls_hostname );
+    }
+    if ( posix->tls_session != NULL ) {
+        SSL_set_session( posix->ssl, posix->tls_session );
+    }
+    posix->tls_handshaking = true;
+    return true;
+}
+
+// Carries the handshake on, false if it failed
+static bool wsPosixTlsHandshake( wsPosix_t *posix )
+{
+    int result = SSL_connect( posix->ssl );
+    if ( result != 1 ) {
+        int error = SSL_get_error( posix->ssl, result );
+        if ( error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE ) {
+            return true;
+        }
+        if ( SSL_get_verify_result( posix->ssl ) != X509_V_OK ) {
+            printf("WebSocket TLS server certificate not trusted\n");
+        } else {
+            printf("WebSocket TLS handshake failed %d\n", error);
+        }
+        // offering the session again would fail again
+        SSL_SESSION_free( posix->tls_session );
+        posix->tls_session = NULL;
+        return false;
+    }
+
+    uint32_t elapsed = to_ms_since_boot(get_absolute_time()) - posix->tls_started;
+    bool resumed = SSL_session_reused( posix->ssl );
+    posix->tls_handshaking = false;
+    posix->tls_stats.handshakes++;
+    posix->tls_stats.last_handshake_ms = elapsed;
+    posix->tls_stats.last_resumed = resumed;
+    if ( resumed ) {
+        posix->tls_stats.resumed++;
+        posix->tls_stats.last_resumed_ms = elapsed;
+    } else {
+        posix->tls_stats.last_full_ms = elapsed;
+    }
+    printf("WebSocket TLS %s handshake %lu ms\n", resumed ? "resumed" : "full", (unsigned long)elapsed);
+    wsTransportConnected( posix->client );
+    return true;
+}
+
+// Reads what has arrived, returns what recv would
+static ssize_t wsPosixRecv( wsPosix_t *posix )
+{
+    if ( posix->ssl == NULL ) {
+        return recv( posix->fd, posix->recv_buf, BUF_SIZE, MSG_DONTWAIT );
+    }
+    int n = SSL_read( posix->ssl, posix->recv_buf, BUF_SIZE );
+    if ( n <= 0 ) {
+        int error = SSL_get_error( posix->ssl, n );
+        if ( error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE ) {
+            errno = EAGAIN;
+            return -1;
+        }
+        if ( error == SSL_ERROR_ZERO_RETURN ) {
+            return 0;
+        }
+        errno = EIO;
+        return -1;
+    }
+    return n;
+}
+
+static bool wsPosixSetTls( void *transport, const char *hostname, const uint8_t *ca, size_t ca_len )
+{
+    wsPosix_t *posix = (wsPosix_t *)transport;
+
+    SSL_CTX_free( posix->tls_ctx );
+    SSL_SESSION_free( posix->tls_session );
+    posix->tls_session = NULL;
+    posix->tls_ctx = SSL_CTX_new( TLS_client_method() );
+    if ( posix->tls_ctx == NULL ) {
+        printf("WebSocket failed to create TLS config\n");
+        return false;
+    }
+    // sessions are kept by wsPosixTlsNewSession, one per client
+    SSL_CTX_set_session_cache_mode( posix->tls_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE );
+    SSL_CTX_sess_set_new_cb( posix->tls_ctx, wsPosixTlsNewSession );
+    // a record that isn't data, e.g. a ticket, ends SSL_read rather than waiting for more
+    SSL_CTX_clear_mode( posix->tls_ctx, SSL_MODE_AUTO_RETRY );
+
+    if ( ca != NULL ) {
+        // PEM including the terminating NUL, or DER, as wsSetTls takes it
+        X509_STORE *store = SSL_CTX_get_cert_store( posix->tls_ctx );
+        BIO *bio = BIO_new_mem_buf( ca, (int)ca_len );
+        X509 *cert;
+        int added = 0;
+        while ( ( cert = PEM_read_bio_X509( bio, NULL, NULL, NULL ) ) != NULL ) {
+            added += X509_STORE_add_cert( store, cert );
+            X509_free( cert );
+        }
+        BIO_free( bio );
+        if ( added == 0 ) {
+            const uint8_t *der = ca;
+            cert = d2i_X509( NULL, &der, (long)ca_len );
+            added = cert != NULL && X509_STORE_add_cert( store, cert );
+            X509_free( cert );
+        }
+        if ( added == 0 ) {
+            printf("WebSocket TLS CA certificate not understood\n");
+            SSL_CTX_free( posix->tls_ctx );
+            posix->tls_ctx = NULL;
+            return false;
+        }
+        SSL_CTX_set_verify( posix->tls_ctx, SSL_VERIFY_PEER, NULL );
+    }
+    posix->tls_hostname = hostname;
+    posix->tls_verify = ( ca != NULL );
+    return true;
+}
+
+static bool wsPosixTlsStats( void *transport, wsTlsStats_t *stats )
+{
+    wsPosix_t *posix = (wsPosix_t *)transport;
+    *stats = posix->tls_stats;
+    return true;
+}
+
+#define wsPosixHandshaking( posix )  ( (posix)->tls_handshaking )
+#else
+#define wsPosixHandshaking( posix )  false
+#define wsPosixRecv( posix )    recv( (posix)->fd, (posix)->recv_buf, BUF_SIZE, MSG_DONTWAIT )
+#endif
+
+static void wsPosixPoll( void *transport )
+{
+    wsPosix_t *posix = (wsPosix_t *)transport;
+
+    pthread_mutex_lock( &posix->lock );
+
+    if ( posix->fd >= 0 && posix->connecting ) {
+        struct pollfd pfd = { .fd = posix->fd, .events = POLLOUT };
+        if ( poll(&pfd, 1, 0) > 0 ) {
+            int error = 0;
+            socklen_t error_len = sizeof(error);
+            getsockopt( posix->fd, SOL_SOCKET, SO_ERROR, &error, &error_len );
+            if ( error != 0 ) {
+                printf("WebSocket connect failed %d\n", error);
+                wsPosixClose( posix );
+                wsTransportClosed( posix->client );
+            } else {
+                posix->connecting = false;
+                #if WS_TLS
+                if ( posix->tls_ctx != NULL ) {
+                    if ( !wsPosixTlsStart( posix ) ) {
+                        wsPosixClose( posix );
+                        wsTransportClosed( posix->client );
+                    }
+                } else
+                #endif
+                {
+                    // reads stay non-blocking, writes block rather than queue partial frames
+                    fcntl( posix->fd, F_SETFL, fcntl(posix->fd, F_GETFL) & ~O_NONBLOCK );
+                    wsTransportConnected( posix->client );
+                }
+            }
+        }
+    }
+
+    #if WS_TLS
+    if ( posix->tls_handshaking && !wsPosixTlsHandshake( posix ) ) {
+        wsPosixClose( posix );
+        wsTransportClosed( posix->client );
+    }
+    #endif
+
+    while ( posix->fd >= 0 && !posix->connecting && !wsPosixHandshaking( posix ) ) {
+        ssize_t n = wsPosixRecv( posix );
+        if ( n > 0 ) {
+            wsTransportReceive( posix->client, posix->recv_buf, (uint32_t)n, BUF_SIZE - (uint32_t)n );
+            wsTransportReceiveDone( posix->client );
+            continue;
+        }
+        if ( n == 0 || ( errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR ) ) {
+            wsPosixClose( posix );
+            wsTransportClosed( posix->client );
+        }
+        break;
+    }
+
+    wsTransportService( posix->client );
+    pthread_mutex_unlock( &posix->lock );
+}
+
+const wsTransport_t wsTransportPosix = {
+    .name = "POSIX",
+    .max_frame = UINT16_MAX,
+    .state_size = sizeof(wsPosix_t),
+    .create = wsPosixCreate,
+    .destroy = wsPosixDestroy,
+    .connect = wsPosixConnect,
+    .writable = wsPosixWritable,
+    .write = wsPosixWrite,
+    .writev = wsPosixWritev,
+    .flush = wsPosixFlush,
+    .close = wsPosixClose,
+    .poll = wsPosixPoll,
+    .slots_free = NULL,
+    .set_nodelay = wsPosixSetNodelay,
+    .kick = wsPosixKick,
+#if WS_TLS
+    .set_tls = wsPosixSetTls,
+    .tls_stats = wsPosixTlsStats,
+#endif
+};
+
+#endif
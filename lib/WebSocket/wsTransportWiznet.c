@@ -0,0 +1,198 @@
+/*===========================================================================*/
+/*                                                                           */
+/*  WebSocket transport for WIZnet Pico boards, TCP on the W5x00 through     */
+/*  the WIZnet HTTP client.                                                  */
+/*                                                                           */
+/*  This is free and unencumbered software released into the public domain.  */
+/*                                                                           */
+/*===========================================================================*/
+
+#include "WebSocket.h"
+#include "wsTransport.h"
+
+#if defined(WIZNET_BOARD) && !WS_TRANSPORT_POSIX
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "pico/stdlib.h"
+#include "wizchip_conf.h"
+#include "wizchip_spi.h"
+#include "httpClient.h"
+
+// the W5x00's default maximum segment size for TCP over Ethernet
+#define WS_WIZNET_MSS 1460
+
+enum wsWiznetPhase {
+    WS_WIZNET_IDLE,
+    WS_WIZNET_REQUESTED,            // connect once the socket is open
+    WS_WIZNET_CONNECTING,
+    WS_WIZNET_CONNECTED
+};
+
+typedef struct {
+    WebSocketClient_p client;
+    uint8_t send_buf[BUF_SIZE];
+    uint8_t recv_buf[BUF_SIZE];
+    uint8_t server_ip[4];
+    bool server_ip_valid;
+    const char *server;
+    uint16_t remote_port;
+    enum wsWiznetPhase phase;
+    uint32_t segments;              // segments sent since the last flush
+} wsWiznet_t;
+
+#ifdef WS_TRANSPORT_STATE_MAX
+_Static_assert( sizeof(wsWiznet_t) <= WS_TRANSPORT_STATE_MAX, "WS_TRANSPORT_STATE_MAX doesn't cover wsWiznet_t" );
+#endif
+
+static void *wsWiznetCreate( WebSocketClient_p client, const char *server, uint16_t port )
+{
+    wsWiznet_t *wiznet = (wsWiznet_t *)calloc(1, sizeof(wsWiznet_t));
+    if ( wiznet ) {
+        wiznet->client = client;
+        wiznet->server = server;
+        wiznet->remote_port = port;
+        //printf("WebSocket parsing server ip address [%s]\n",server);
+        wiznet->server_ip_valid = ( sscanf(server, "%hhu.%hhu.%hhu.%hhu", &wiznet->server_ip[0], &wiznet->server_ip[1], &wiznet->server_ip[2], &wiznet->server_ip[3]) == 4 );
+    }
+    return wiznet;
+}
+
+static void wsWiznetDestroy( void *transport )
+{
+    free( transport );
+}
+
+static bool wsWiznetConnect( void *transport )
+{
+    wsWiznet_t *wiznet = (wsWiznet_t *)transport;
+
+    if ( !wiznet->server_ip_valid ) {
+        printf("WebSocket invalid server ip address [%s]",wiznet->server);
+        return false;
+    }
+    if ( httpc_init(0, wiznet->server_ip, wiznet->remote_port, wiznet->send_buf, wiznet->recv_buf) != HTTPC_TRUE) {
+        printf("WebSocket HTTP Client initialise failed\n");
+        return false;
+    }
+    wiznet->phase = WS_WIZNET_REQUESTED;
+    return true;
+}
+
+static bool wsWiznetWritable( void *transport, uint32_t len )
+{
+    (void)transport;
+    (void)len;      // httpc_send_body waits for room in the W5x00's buffer
+    return true;
+}
+
+// The W5x00 sends each write as soon as it has it, in MSS sized segments
+static uint32_t wsWiznetSegments( uint32_t len )
+{
+    return ( len + WS_WIZNET_MSS - 1 ) / WS_WIZNET_MSS;
+}
+
+static bool wsWiznetWrite( void *transport, uint8_t *frame, uint32_t len, bool copy )
+{
+    wsWiznet_t *wiznet = (wsWiznet_t *)transport;
+    (void)copy;     // the W5x00 copies everything into its own buffer
+
+    if ( httpc_send_body(frame, (uint16_t)len) != len ) {
+        return false;
+    }
+    wiznet->segments += wsWiznetSegments( len );
+    free( frame );
+    return true;
+}
+
+static bool wsWiznetWritev( void *transport, const wsIovec_t *iov, int iovcnt )
+{
+    wsWiznet_t *wiznet = (wsWiznet_t *)transport;
+    uint32_t len = 0;
+
+    // gathered so the request goes out in one piece
+    for ( int i = 0 ; i < iovcnt ; i++ ) {
+        if ( len + iov[i].len > BUF_SIZE ) {
+            return false;
+        }
+        memcpy( wiznet->send_buf + len, iov[i].base, iov[i].len );
+        len += iov[i].len;
+    }
+    //printf("[%.*s](%d)\n",len,wiznet->send_buf,len);
+    // Send HTTP requset as message body
+    if ( httpc_send_body(wiznet->send_buf, (uint16_t)len) != len ) {
+        return false;
+    }
+    wiznet->segments += wsWiznetSegments( len );
+    return true;
+}
+
+static uint32_t wsWiznetFlush( void *transport )
+{
+    wsWiznet_t *wiznet = (wsWiznet_t *)transport;
+    uint32_t segments = wiznet->segments;
+    wiznet->segments = 0;
+    return segments;
+}
+
+static void wsWiznetClose( void *transport )
+{
+    wsWiznet_t *wiznet = (wsWiznet_t *)transport;
+    httpc_disconnect();
+    wiznet->phase = WS_WIZNET_IDLE;
+}
+
+static void wsWiznetPoll( void *transport )
+{
+    wsWiznet_t *wiznet = (wsWiznet_t *)transport;
+
+    httpc_connection_handler();
+
+    if( wiznet->phase == WS_WIZNET_CONNECTED && httpc_isConnected ) {
+        // Recv: HTTP response
+        if(httpc_isReceived > 0) {
+            uint16_t len = httpc_recv(wiznet->recv_buf, httpc_isReceived);
+            wsTransportReceive( wiznet->client, wiznet->recv_buf, len, len < BUF_SIZE ? BUF_SIZE - len : 0 );
+            wsTransportReceiveDone( wiznet->client );
+        }
+    } else if ( wiznet->phase == WS_WIZNET_REQUESTED && httpc_isSockOpen ) {
+        //printf("HTTP Client connect...\n");
+        if ( httpc_connect()==HTTPC_TRUE ) {
+            //printf("HTTP Client connecting...\n");
+            wiznet->phase = WS_WIZNET_CONNECTING;
+        } else {
+            printf("WebSocket HTTP Client failed to connect\n");
+        }
+    } else if ( wiznet->phase == WS_WIZNET_CONNECTING && httpc_isConnected ) {
+        //printf("HTTP Client connected\n");
+        wiznet->phase = WS_WIZNET_CONNECTED;
+        wsTransportConnected( wiznet->client );
+    } else  if( wiznet->phase == WS_WIZNET_CONNECTED && !httpc_isConnected ) {
+        printf("WebSocket not connected, closing socket\n");
+        wsTransportClosed( wiznet->client );
+    }
+
+    wsTransportService( wiznet->client );
+}
+
+const wsTransport_t wsTransportWiznet = {
+    .name = "WIZnet",
+    .max_frame = BUF_SIZE,
+    .state_size = sizeof(wsWiznet_t),
+    .create = wsWiznetCreate,
+    .destroy = wsWiznetDestroy,
+    .connect = wsWiznetConnect,
+    .writable = wsWiznetWritable,
+    .write = wsWiznetWrite,
+    .writev = wsWiznetWritev,
+    .flush = wsWiznetFlush,
+    .close = wsWiznetClose,
+    .poll = wsWiznetPoll,
+    .slots_free = NULL,
+    .set_nodelay = NULL,
+    .kick = NULL,
+};
+
+#endif
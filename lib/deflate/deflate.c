@@ -0,0 +1,651 @@
+/*===========================================================================*/
+/*                                                                           */
+/*  Raw deflate / inflate for the WebSocket permessage-deflate extension     */
+/*                                                                           */
+/*  Compression uses LZ77 with short hash chains and the fixed Huffman       */
+/*  codes, which keeps both the code and the RAM small. Decompression        */
+/*  handles stored, fixed and dynamic blocks since the server may use any.   */
+/*                                                                           */
+/*  This is free and unencumbered software released into the public domain.  */
+/*                                                                           */
+/*===========================================================================*/
+
+#include <string.h>
+#include <stdlib.h>
+
+#include "deflate.h"
+
+#define DEFLATE_HASH_BITS   9
+#define DEFLATE_HASH_SIZE   (1 << DEFLATE_HASH_BITS)
+#define DEFLATE_MAX_CHAIN   16          // candidates tried per position
+#define DEFLATE_MIN_MATCH   3
+#define DEFLATE_MAX_MATCH   258
+
+#define HUFFMAN_MAX_BITS    15
+#define HUFFMAN_MAX_LCODES  286
+#define HUFFMAN_MAX_DCODES  30
+#define HUFFMAN_FIX_LCODES  288
+
+static const uint16_t length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t dist_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const uint8_t dist_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+static uint8_t clamp_window_bits( uint8_t window_bits )
+{
+    if ( window_bits < DEFLATE_MIN_WINDOW_BITS ) {
+        return DEFLATE_MIN_WINDOW_BITS;
+    }
+    if ( window_bits > DEFLATE_MAX_WINDOW_BITS ) {
+        return DEFLATE_MAX_WINDOW_BITS;
+    }
+    return window_bits;
+}
+
+//===============================================================================================================
+// Compression
+
+/*  Positions are counted from the last reset and stored in the hash tables as
+ *  16 bits, so a candidate may be stale, every candidate is checked byte by byte
+ *  before it is used which makes that harmless.
+ */
+struct deflate_s {
+    uint8_t  window_bits;               // allocated window
+    uint32_t window_mask;
+    uint32_t max_distance;              // negotiated window, no larger than allocated
+    uint32_t pos;                       // stream position of the next message
+    uint8_t  *window;                   // the last bytes of earlier messages
+    uint16_t *prev;                     // previous position with the same hash
+    uint16_t head[DEFLATE_HASH_SIZE];   // latest position for each hash
+};
+
+// DEFLATE_RAM is the window and chain, 3 bytes per position, plus this
+_Static_assert( sizeof(deflate_t) <= DEFLATE_RAM(0) - 3, "DEFLATE_RAM doesn't cover deflate_t" );
+
+typedef struct {
+    uint8_t  *out;
+    uint32_t out_size;
+    uint32_t out_len;
+    uint32_t bit_buf;
+    int      bit_count;
+    bool     overflow;
+} deflate_bits_t;
+
+static void put_bits( deflate_bits_t *bits, uint32_t value, int count )
+{
+    bits->bit_buf |= value << bits->bit_count;
+    bits->bit_count += count;
+    while ( bits->bit_count >= 8 ) {
+        if ( bits->out_len < bits->out_size ) {
+            bits->out[bits->out_len++] = (uint8_t)bits->bit_buf;
+        } else {
+            bits->overflow = true;
+        }
+        bits->bit_buf >>= 8;
+        bits->bit_count -= 8;
+    }
+}
+
+// Huffman codes are defined most significant bit first
+static void put_code( deflate_bits_t *bits, uint32_t code, int count )
+{
+    uint32_t reversed = 0;
+    for ( int i = 0 ; i < count ; i++ ) {
+        reversed = (reversed << 1) | (code & 1);
+        code >>= 1;
+    }
+    put_bits( bits, reversed, count );
+}
+
+static void put_symbol( deflate_bits_t *bits, int symbol )
+{
+    if ( symbol < 144 ) {
+        put_code( bits, 0x30 + symbol, 8 );
+    } else if ( symbol < 256 ) {
+        put_code( bits, 0x190 + symbol - 144, 9 );
+    } else if ( symbol < 280 ) {
+        put_code( bits, symbol - 256, 7 );
+    } else {
+        put_code( bits, 0xC0 + symbol - 280, 8 );
+    }
+}
+
+static void put_match( deflate_bits_t *bits, uint32_t length, uint32_t distance )
+{
+    int code = 28;
+    while ( length < length_base[code] ) {
+        code--;
+    }
+    put_symbol( bits, 257 + code );
+    put_bits( bits, length - length_base[code], length_extra[code] );
+
+    code = 29;
+    while ( distance < dist_base[code] ) {
+        code--;
+    }
+    put_code( bits, code, 5 );
+    put_bits( bits, distance - dist_base[code], dist_extra[code] );
+}
+
+static inline uint32_t hash3( uint8_t a, uint8_t b, uint8_t c )
+{
+    return ( ((uint32_t)a << 16 | (uint32_t)b << 8 | c) * 2654435761u ) >> (32 - DEFLATE_HASH_BITS);
+}
+
+/*! \brief Creates a compressor
+ *  \ingroup deflate.c
+ *
+ * Uses 1 << window_bits bytes of history plus twice that for the hash chains.
+ *
+ * \param window_bits log2 of the history window, 8 to 15
+ * \return compressor, NULL if out of memory
+ */
+deflate_t *deflate_create( uint8_t window_bits )
+{
+    deflate_t *deflate = (deflate_t *)calloc(1, sizeof(deflate_t));
+    if ( deflate == NULL ) {
+        return NULL;
+    }
+
+    deflate->window_bits = clamp_window_bits( window_bits );
+    deflate->window_mask = (1u << deflate->window_bits) - 1;
+    deflate->window = (uint8_t *)malloc( 1u << deflate->window_bits );
+    deflate->prev = (uint16_t *)malloc( sizeof(uint16_t) << deflate->window_bits );
+    if ( deflate->window == NULL || deflate->prev == NULL ) {
+        deflate_destroy( deflate );
+        return NULL;
+    }
+    deflate_reset( deflate, deflate->window_bits );
+
+    return deflate;
+}
+
+/*! \brief Frees a compressor
+ *  \ingroup deflate.c
+ *
+ * \param deflate compressor, may be NULL
+ * \return Nothing
+ */
+void deflate_destroy( deflate_t *deflate )
+{
+    if ( deflate ) {
+        free( deflate->window );
+        free( deflate->prev );
+        free( deflate );
+    }
+}
+
+/*! \brief Forgets earlier messages and sets the window the peer accepts
+ *  \ingroup deflate.c
+ *
+ * \param deflate compressor
+ * \param window_bits log2 of the largest distance to use, limited to the window allocated
+ * \return Nothing
+ */
+void deflate_reset( deflate_t *deflate, uint8_t window_bits )
+{
+    window_bits = clamp_window_bits( window_bits );
+    if ( window_bits > deflate->window_bits ) {
+        window_bits = deflate->window_bits;
+    }
+    deflate->max_distance = 1u << window_bits;
+    deflate->pos = 0;
+    memset( deflate->head, 0, sizeof(deflate->head) );
+    memset( deflate->prev, 0, sizeof(uint16_t) << deflate->window_bits );
+}
+
+/*! \brief Compresses one message
+ *  \ingroup deflate.c
+ *
+ * The output is a fixed Huffman block followed by a sync flush with the final
+ * 00 00 FF FF removed, as sent in a permessage-deflate frame.
+ *
+ * \param deflate compressor
+ * \param in message to compress
+ * \param in_len length of the message
+ * \param out buffer for the compressed data, DEFLATE_BOUND(in_len) is always enough
+ * \param out_size size of out
+ * \return compressed length, -1 if out is too small
+ */
+int deflate_message( deflate_t *deflate, const uint8_t *in, uint32_t in_len, uint8_t *out, uint32_t out_size )
+{
+    deflate_bits_t bits = { .out = out, .out_size = out_size };
+    uint32_t start = deflate->pos;
+    uint32_t end = start + in_len;
+
+    // byte at a stream position, earlier messages come from the window
+    #define DEFLATE_BYTE(p) ( (p) >= start ? in[(p) - start] : deflate->window[(p) & deflate->window_mask] )
+
+    // BFINAL 0, fixed Huffman
+    put_bits( &bits, 0x2, 3 );
+
+    uint32_t p = start;
+    while ( p < end ) {
+        uint32_t best_len = 0;
+        uint32_t best_dist = 0;
+
+        if ( end - p >= DEFLATE_MIN_MATCH ) {
+            uint32_t h = hash3( in[p - start], in[p - start + 1], in[p - start + 2] );
+            uint32_t max_len = end - p < DEFLATE_MAX_MATCH ? end - p : DEFLATE_MAX_MATCH;
+            uint32_t candidate = deflate->head[h];
+            uint32_t last_dist = 0;
+
+            for ( int chain = 0 ; chain < DEFLATE_MAX_CHAIN ; chain++ ) {
+                uint32_t dist = (p - candidate) & 0xFFFF;
+                if ( dist <= last_dist || dist > deflate->max_distance || dist > p ) {
+                    break;
+                }
+                uint32_t from = p - dist;
+                uint32_t len = 0;
+                while ( len < max_len && DEFLATE_BYTE(from + len) == in[p - start + len] ) {
+                    len++;
+                }
+                if ( len > best_len ) {
+                    best_len = len;
+                    best_dist = dist;
+                    if ( len == max_len ) {
+                        break;
+                    }
+                }
+                last_dist = dist;
+                candidate = deflate->prev[from & deflate->window_mask];
+            }
+        }
+
+        uint32_t advance = 1;
+        if ( best_len >= DEFLATE_MIN_MATCH ) {
+            put_match( &bits, best_len, best_dist );
+            advance = best_len;
+        } else {
+            put_symbol( &bits, in[p - start] );
+        }
+
+        // every position covered is added to the chains for later matches
+        for ( uint32_t i = 0 ; i < advance ; i++, p++ ) {
+            if ( end - p >= DEFLATE_MIN_MATCH ) {
+                uint32_t h = hash3( in[p - start], in[p - start + 1], in[p - start + 2] );
+                deflate->prev[p & deflate->window_mask] = deflate->head[h];
+                deflate->head[h] = (uint16_t)p;
+            }
+        }
+    }
+
+    #undef DEFLATE_BYTE
+
+    // end of block, then an empty stored block (the sync flush) padded to a byte
+    put_symbol( &bits, 256 );
+    put_bits( &bits, 0, 3 );
+    if ( bits.bit_count > 0 ) {
+        put_bits( &bits, 0, 8 - bits.bit_count );
+    }
+    if ( bits.overflow ) {
+        return -1;
+    }
+
+    // keep the tail of this message as history for the next
+    uint32_t keep = in_len < deflate->window_mask + 1 ? in_len : deflate->window_mask + 1;
+    for ( uint32_t i = in_len - keep ; i < in_len ; i++ ) {
+        deflate->window[(start + i) & deflate->window_mask] = in[i];
+    }
+    deflate->pos = end;
+
+    return (int)bits.out_len;
+}
+
+//===============================================================================================================
+// Decompression
+
+struct inflate_s {
+    uint8_t  window_bits;
+    uint32_t window_mask;
+    uint32_t pos;                       // bytes output since the last reset
+    uint8_t  *window;
+};
+
+// INFLATE_RAM is the window plus this
+_Static_assert( sizeof(inflate_t) <= INFLATE_RAM(0) - 1, "INFLATE_RAM doesn't cover inflate_t" );
+
+typedef struct {
+    int16_t count[HUFFMAN_MAX_BITS+1];  // codes of each length
+    int16_t *symbol;                    // symbols ordered by code
+} huffman_t;
+
+typedef struct {
+    inflate_t *inflate;
+    const uint8_t *in;
+    uint32_t in_len;
+    uint32_t in_pos;                    // runs on into the implied 00 00 FF FF tail
+    uint32_t bit_buf;
+    int      bit_count;
+    uint8_t  *out;
+    uint32_t out_size;
+    uint32_t out_len;
+    int      error;
+} inflate_state_t;
+
+static const uint8_t sync_tail[4] = { 0x00, 0x00, 0xFF, 0xFF };
+
+static uint32_t get_bits( inflate_state_t *s, int count )
+{
+    while ( s->bit_count < count ) {
+        uint8_t byte = 0;
+        if ( s->in_pos < s->in_len ) {
+            byte = s->in[s->in_pos];
+        } else if ( s->in_pos < s->in_len + sizeof(sync_tail) ) {
+            byte = sync_tail[s->in_pos - s->in_len];
+        } else {
+            s->error = INFLATE_ERROR;
+        }
+        s->in_pos++;
+        s->bit_buf |= (uint32_t)byte << s->bit_count;
+        s->bit_count += 8;
+    }
+
+    uint32_t value = s->bit_buf & ((1u << count) - 1);
+    s->bit_buf >>= count;
+    s->bit_count -= count;
+    return value;
+}
+
+static void put_byte( inflate_state_t *s, uint8_t byte )
+{
+    if ( s->out_len >= s->out_size ) {
+        s->error = INFLATE_TOO_BIG;
+        return;
+    }
+    s->out[s->out_len++] = byte;
+    s->inflate->window[s->inflate->pos++ & s->inflate->window_mask] = byte;
+}
+
+// Builds canonical code tables from code lengths, returns < 0 if over subscribed
+static int huffman_build( huffman_t *h, const uint8_t *length, int n )
+{
+    int16_t offs[HUFFMAN_MAX_BITS+1];
+
+    memset( h->count, 0, sizeof(h->count) );
+    for ( int symbol = 0 ; symbol < n ; symbol++ ) {
+        h->count[length[symbol]]++;
+    }
+    if ( h->count[0] == n ) {
+        return 0;
+    }
+
+    int left = 1;
+    for ( int len = 1 ; len <= HUFFMAN_MAX_BITS ; len++ ) {
+        left <<= 1;
+        left -= h->count[len];
+        if ( left < 0 ) {
+            return left;
+        }
+    }
+
+    offs[1] = 0;
+    for ( int len = 1 ; len < HUFFMAN_MAX_BITS ; len++ ) {
+        offs[len + 1] = offs[len] + h->count[len];
+    }
+    for ( int symbol = 0 ; symbol < n ; symbol++ ) {
+        if ( length[symbol] != 0 ) {
+            h->symbol[offs[length[symbol]]++] = (int16_t)symbol;
+        }
+    }
+
+    return left;
+}
+
+static int huffman_decode( inflate_state_t *s, const huffman_t *h )
+{
+    int code = 0, first = 0, index = 0;
+
+    for ( int len = 1 ; len <= HUFFMAN_MAX_BITS ; len++ ) {
+        code |= (int)get_bits( s, 1 );
+        int count = h->count[len];
+        if ( code - count < first ) {
+            return h->symbol[index + (code - first)];
+        }
+        index += count;
+        first += count;
+        first <<= 1;
+        code <<= 1;
+    }
+
+    s->error = INFLATE_ERROR;
+    return -1;
+}
+
+static void inflate_stored( inflate_state_t *s )
+{
+    // discard to the byte boundary
+    s->bit_buf = 0;
+    s->bit_count = 0;
+
+    uint32_t len = get_bits( s, 16 );
+    if ( (get_bits( s, 16 ) ^ 0xFFFF) != len ) {
+        s->error = INFLATE_ERROR;
+        return;
+    }
+    while ( len-- > 0 && s->error == 0 ) {
+        put_byte( s, (uint8_t)get_bits( s, 8 ) );
+    }
+}
+
+static void inflate_codes( inflate_state_t *s, const huffman_t *lencode, const huffman_t *distcode )
+{
+    inflate_t *inflate = s->inflate;
+
+    while ( s->error == 0 ) {
+        int symbol = huffman_decode( s, lencode );
+        if ( symbol < 0 ) {
+            return;
+        }
+        if ( symbol < 256 ) {
+            put_byte( s, (uint8_t)symbol );
+        } else if ( symbol == 256 ) {
+            return;
+        } else {
+            symbol -= 257;
+            if ( symbol >= 29 ) {
+                s->error = INFLATE_ERROR;
+                return;
+            }
+            uint32_t len = length_base[symbol] + get_bits( s, length_extra[symbol] );
+
+            symbol = huffman_decode( s, distcode );
+            if ( symbol < 0 || symbol >= 30 ) {
+                s->error = INFLATE_ERROR;
+                return;
+            }
+            uint32_t dist = dist_base[symbol] + get_bits( s, dist_extra[symbol] );
+            if ( dist > inflate->pos || dist > inflate->window_mask + 1 ) {
+                s->error = INFLATE_ERROR;
+                return;
+            }
+
+            while ( len-- > 0 && s->error == 0 ) {
+                put_byte( s, inflate->window[(inflate->pos - dist) & inflate->window_mask] );
+            }
+        }
+    }
+}
+
+static void inflate_fixed( inflate_state_t *s )
+{
+    int16_t lensym[HUFFMAN_FIX_LCODES], distsym[HUFFMAN_MAX_DCODES];
+    huffman_t lencode = { .symbol = lensym }, distcode = { .symbol = distsym };
+    uint8_t lengths[HUFFMAN_FIX_LCODES];
+
+    memset( lengths, 8, 144 );
+    memset( lengths + 144, 9, 256 - 144 );
+    memset( lengths + 256, 7, 280 - 256 );
+    memset( lengths + 280, 8, HUFFMAN_FIX_LCODES - 280 );
+    huffman_build( &lencode, lengths, HUFFMAN_FIX_LCODES );
+    memset( lengths, 5, HUFFMAN_MAX_DCODES );
+    huffman_build( &distcode, lengths, HUFFMAN_MAX_DCODES );
+
+    inflate_codes( s, &lencode, &distcode );
+}
+
+static void inflate_dynamic( inflate_state_t *s )
+{
+    static const uint8_t order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+    int16_t lensym[HUFFMAN_MAX_LCODES], distsym[HUFFMAN_MAX_DCODES];
+    huffman_t lencode = { .symbol = lensym }, distcode = { .symbol = distsym };
+    uint8_t lengths[HUFFMAN_MAX_LCODES + HUFFMAN_MAX_DCODES];
+
+    int nlen = (int)get_bits( s, 5 ) + 257;
+    int ndist = (int)get_bits( s, 5 ) + 1;
+    int ncode = (int)get_bits( s, 4 ) + 4;
+    if ( nlen > HUFFMAN_MAX_LCODES || ndist > HUFFMAN_MAX_DCODES ) {
+        s->error = INFLATE_ERROR;
+        return;
+    }
+
+    // code length code, used to send the other two
+    memset( lengths, 0, 19 );
+    for ( int i = 0 ; i < ncode ; i++ ) {
+        lengths[order[i]] = (uint8_t)get_bits( s, 3 );
+    }
+    if ( huffman_build( &lencode, lengths, 19 ) != 0 ) {
+        s->error = INFLATE_ERROR;
+        return;
+    }
+
+    int index = 0;
+    while ( index < nlen + ndist && s->error == 0 ) {
+        int symbol = huffman_decode( s, &lencode );
+        if ( symbol < 0 ) {
+            return;
+        }
+        if ( symbol < 16 ) {
+            lengths[index++] = (uint8_t)symbol;
+            continue;
+        }
+
+        uint8_t value = 0;
+        int repeat;
+        if ( symbol == 16 ) {
+            if ( index == 0 ) {
+                s->error = INFLATE_ERROR;
+                return;
+            }
+            value = lengths[index - 1];
+            repeat = 3 + (int)get_bits( s, 2 );
+        } else if ( symbol == 17 ) {
+            repeat = 3 + (int)get_bits( s, 3 );
+        } else {
+            repeat = 11 + (int)get_bits( s, 7 );
+        }
+        if ( index + repeat > nlen + ndist ) {
+            s->error = INFLATE_ERROR;
+            return;
+        }
+        while ( repeat-- > 0 ) {
+            lengths[index++] = value;
+        }
+    }
+
+    if ( s->error != 0 || lengths[256] == 0 ) {
+        s->error = INFLATE_ERROR;
+        return;
+    }
+    // incomplete codes are allowed (a single distance code is common), over subscribed ones are not
+    if ( huffman_build( &lencode, lengths, nlen ) < 0 || huffman_build( &distcode, lengths + nlen, ndist ) < 0 ) {
+        s->error = INFLATE_ERROR;
+        return;
+    }
+
+    inflate_codes( s, &lencode, &distcode );
+}
+
+/*! \brief Creates a decompressor
+ *  \ingroup deflate.c
+ *
+ * \param window_bits log2 of the largest window the peer may use, 8 to 15
+ * \return decompressor, NULL if out of memory
+ */
+inflate_t *inflate_create( uint8_t window_bits )
+{
+    inflate_t *inflate = (inflate_t *)calloc(1, sizeof(inflate_t));
+    if ( inflate == NULL ) {
+        return NULL;
+    }
+
+    inflate->window_bits = clamp_window_bits( window_bits );
+    inflate->window_mask = (1u << inflate->window_bits) - 1;
+    inflate->window = (uint8_t *)malloc( 1u << inflate->window_bits );
+    if ( inflate->window == NULL ) {
+        inflate_destroy( inflate );
+        return NULL;
+    }
+
+    return inflate;
+}
+
+/*! \brief Frees a decompressor
+ *  \ingroup deflate.c
+ *
+ * \param inflate decompressor, may be NULL
+ * \return Nothing
+ */
+void inflate_destroy( inflate_t *inflate )
+{
+    if ( inflate ) {
+        free( inflate->window );
+        free( inflate );
+    }
+}
+
+/*! \brief Forgets earlier messages
+ *  \ingroup deflate.c
+ *
+ * \param inflate decompressor
+ * \return Nothing
+ */
+void inflate_reset( inflate_t *inflate )
+{
+    inflate->pos = 0;
+}
+
+/*! \brief Decompresses one message
+ *  \ingroup deflate.c
+ *
+ * \param inflate decompressor
+ * \param in compressed payload, without the trailing 00 00 FF FF
+ * \param in_len length of the payload
+ * \param out buffer for the message
+ * \param out_size size of out
+ * \return message length, INFLATE_ERROR if the data is corrupt or INFLATE_TOO_BIG
+ */
+int inflate_message( inflate_t *inflate, const uint8_t *in, uint32_t in_len, uint8_t *out, uint32_t out_size )
+{
+    inflate_state_t s = { .inflate = inflate, .in = in, .in_len = in_len, .out = out, .out_size = out_size };
+    bool last = false;
+
+    // the message ends with the sync flush's empty stored block, or a final block
+    while ( !last && s.error == 0 && s.in_pos < in_len + sizeof(sync_tail) ) {
+        last = get_bits( &s, 1 );
+        switch( get_bits( &s, 2 ) ) {
+            case 0:
+                inflate_stored( &s );
+                break;
+            case 1:
+                inflate_fixed( &s );
+                break;
+            case 2:
+                inflate_dynamic( &s );
+                break;
+            default:
+                s.error = INFLATE_ERROR;
+                break;
+        }
+    }
+
+    return s.error != 0 ? s.error : (int)s.out_len;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*  Raw deflate (RFC 1951) sized for the WebSocket permessage-deflate extension
+ *  (RFC 7692). Each message is compressed to fixed Huffman codes and ended with
+ *  a sync flush whose trailing 00 00 FF FF is removed, inflate puts it back.
+ *  The history window is kept between messages (context takeover) until reset.
+ */
+
+#define DEFLATE_MIN_WINDOW_BITS 8
+#define DEFLATE_MAX_WINDOW_BITS 15
+
+// compressed size can exceed the input, this is enough for any message of len bytes
+#define DEFLATE_BOUND(len)  ((len) + ((len) >> 3) + 8)
+
+// heap used by deflate_create and inflate_create, for sizing
+#define DEFLATE_RAM(window_bits)    ((3u << (window_bits)) + 1088)
+#define INFLATE_RAM(window_bits)    ((1u << (window_bits)) + 32)
+
+#define INFLATE_ERROR       -1      // corrupt input
+#define INFLATE_TOO_BIG     -2      // output buffer too small
+
+typedef struct deflate_s deflate_t;
+typedef struct inflate_s inflate_t;
+
+deflate_t *deflate_create( uint8_t window_bits );
+void deflate_destroy( deflate_t *deflate );
+void deflate_reset( deflate_t *deflate, uint8_t window_bits );
+int deflate_message( deflate_t *deflate, const uint8_t *in, uint32_t in_len, uint8_t *out, uint32_t out_size );
+
+inflate_t *inflate_create( uint8_t window_bits );
+void inflate_destroy( inflate_t *inflate );
+void inflate_reset( inflate_t *inflate );
+int inflate_message( inflate_t *inflate, const uint8_t *in, uint32_t in_len, uint8_t *out, uint32_t out_size );
+
+#ifdef __cplusplus
+}
+#endif
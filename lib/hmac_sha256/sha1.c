@@ -0,0 +1,234 @@
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//  WjCryptLib_Sha1
+//
+//  Implementation of SHA1 hash function, in the same form as WjCryptLib_Sha256.
+//
+//  This is free and unencumbered software released into the public domain.
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//  IMPORTS
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#include "sha1.h"
+#include <memory.h>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//  MACROS
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define rol(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
+
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+
+#define STORE32H(x, y)                     \
+  {                                        \
+    (y)[0] = (uint8_t)(((x) >> 24) & 255); \
+    (y)[1] = (uint8_t)(((x) >> 16) & 255); \
+    (y)[2] = (uint8_t)(((x) >> 8) & 255);  \
+    (y)[3] = (uint8_t)((x)&255);           \
+  }
+
+#define LOAD32H(x, y)                                                         \
+  {                                                                           \
+    x = ((uint32_t)((y)[0] & 255) << 24) | ((uint32_t)((y)[1] & 255) << 16) | \
+        ((uint32_t)((y)[2] & 255) << 8) | ((uint32_t)((y)[3] & 255));         \
+  }
+
+#define STORE64H(x, y)                     \
+  {                                        \
+    (y)[0] = (uint8_t)(((x) >> 56) & 255); \
+    (y)[1] = (uint8_t)(((x) >> 48) & 255); \
+    (y)[2] = (uint8_t)(((x) >> 40) & 255); \
+    (y)[3] = (uint8_t)(((x) >> 32) & 255); \
+    (y)[4] = (uint8_t)(((x) >> 24) & 255); \
+    (y)[5] = (uint8_t)(((x) >> 16) & 255); \
+    (y)[6] = (uint8_t)(((x) >> 8) & 255);  \
+    (y)[7] = (uint8_t)((x)&255);           \
+  }
+
+#define BLOCK_SIZE 64
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//  INTERNAL FUNCTIONS
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//  TransformFunction
+//
+//  Compress 512-bits
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+static void TransformFunction(Sha1Context* Context, uint8_t const* Buffer) {
+  uint32_t W[80];
+  uint32_t a, b, c, d, e, f, k, t;
+  int i;
+
+  // Copy the 512-bits into W[0..15]
+  for (i = 0; i < 16; i++) {
+    LOAD32H(W[i], Buffer + (4 * i));
+  }
+
+  // Fill W[16..79]
+  for (i = 16; i < 80; i++) {
+    W[i] = rol(W[i - 3] ^ W[i - 8] ^ W[i - 14] ^ W[i - 16], 1);
+  }
+
+  a = Context->state[0];
+  b = Context->state[1];
+  c = Context->state[2];
+  d = Context->state[3];
+  e = Context->state[4];
+
+  // Compress
+  for (i = 0; i < 80; i++) {
+    if (i < 20) {
+      f = (b & c) | (~b & d);
+      k = 0x5A827999UL;
+    } else if (i < 40) {
+      f = b ^ c ^ d;
+      k = 0x6ED9EBA1UL;
+    } else if (i < 60) {
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8F1BBCDCUL;
+    } else {
+      f = b ^ c ^ d;
+      k = 0xCA62C1D6UL;
+    }
+    t = rol(a, 5) + f + e + k + W[i];
+    e = d;
+    d = c;
+    c = rol(b, 30);
+    b = a;
+    a = t;
+  }
+
+  // Feedback
+  Context->state[0] += a;
+  Context->state[1] += b;
+  Context->state[2] += c;
+  Context->state[3] += d;
+  Context->state[4] += e;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//  PUBLIC FUNCTIONS
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//  Sha1Initialise
+//
+//  Initialises a SHA1 Context. Use this to initialise/reset a context.
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void Sha1Initialise(Sha1Context* Context  // [out]
+) {
+  Context->curlen = 0;
+  Context->length = 0;
+  Context->state[0] = 0x67452301UL;
+  Context->state[1] = 0xEFCDAB89UL;
+  Context->state[2] = 0x98BADCFEUL;
+  Context->state[3] = 0x10325476UL;
+  Context->state[4] = 0xC3D2E1F0UL;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//  Sha1Update
+//
+//  Adds data to the SHA1 context. This will process the data and update the
+//  internal state of the context. Keep on calling this function until all the
+//  data has been added. Then call Sha1Finalise to calculate the hash.
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void Sha1Update(Sha1Context* Context,  // [in out]
+                void const* Buffer,    // [in]
+                uint32_t BufferSize    // [in]
+) {
+  uint32_t n;
+
+  if (Context->curlen > sizeof(Context->buf)) {
+    return;
+  }
+
+  while (BufferSize > 0) {
+    if (Context->curlen == 0 && BufferSize >= BLOCK_SIZE) {
+      TransformFunction(Context, (uint8_t*)Buffer);
+      Context->length += BLOCK_SIZE * 8;
+      Buffer = (uint8_t*)Buffer + BLOCK_SIZE;
+      BufferSize -= BLOCK_SIZE;
+    } else {
+      n = MIN(BufferSize, (BLOCK_SIZE - Context->curlen));
+      memcpy(Context->buf + Context->curlen, Buffer, (size_t)n);
+      Context->curlen += n;
+      Buffer = (uint8_t*)Buffer + n;
+      BufferSize -= n;
+      if (Context->curlen == BLOCK_SIZE) {
+        TransformFunction(Context, Context->buf);
+        Context->length += 8 * BLOCK_SIZE;
+        Context->curlen = 0;
+      }
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//  Sha1Finalise
+//
+//  Performs the final calculation of the hash and returns the digest (20 byte
+//  buffer containing 160bit hash). After calling this, Sha1Initialised must
+//  be used to reuse the context.
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void Sha1Finalise(Sha1Context* Context,  // [in out]
+                  SHA1_HASH* Digest      // [out]
+) {
+  int i;
+
+  if (Context->curlen >= sizeof(Context->buf)) {
+    return;
+  }
+
+  // Increase the length of the message
+  Context->length += Context->curlen * 8;
+
+  // Append the '1' bit
+  Context->buf[Context->curlen++] = (uint8_t)0x80;
+
+  // if the length is currently above 56 bytes we append zeros
+  // then compress.  Then we can fall back to padding zeros and length
+  // encoding like normal.
+  if (Context->curlen > 56) {
+    while (Context->curlen < 64) {
+      Context->buf[Context->curlen++] = (uint8_t)0;
+    }
+    TransformFunction(Context, Context->buf);
+    Context->curlen = 0;
+  }
+
+  // Pad up to 56 bytes of zeroes
+  while (Context->curlen < 56) {
+    Context->buf[Context->curlen++] = (uint8_t)0;
+  }
+
+  // Store length
+  STORE64H(Context->length, Context->buf + 56);
+  TransformFunction(Context, Context->buf);
+
+  // Copy output
+  for (i = 0; i < 5; i++) {
+    STORE32H(Context->state[i], Digest->bytes + (4 * i));
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+//  Sha1Calculate
+//
+//  Combines Sha1Initialise, Sha1Update, and Sha1Finalise into one
+//  function. Calculates the SHA1 hash of the buffer.
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void Sha1Calculate(void const* Buffer,   // [in]
+                   uint32_t BufferSize,  // [in]
+                   SHA1_HASH* Digest     // [in]
+) {
+  Sha1Context context;
+
+  Sha1Initialise(&context);
+  Sha1Update(&context, Buffer, BufferSize);
+  Sha1Finalise(&context, Digest);
+}
@@ -20,16 +20,11 @@
 #include <ctype.h>
 #include "json.h"
 
+// Returns the field's value, text is a view into the parsed string
 static bool json_get_field_value( json_t const *field, jsonType_t type, jsonValue_t *value )
 {
-    static char *textValue = NULL;
     bool result = false;
 
-    if ( textValue ) {
-        free( textValue );
-        textValue = NULL;
-    }
-
     if ( field != NULL ) {
         if ( type == JSON_REAL && json_getType( field ) == JSON_REAL ) {
             value->real = json_getReal( field );
@@ -48,9 +43,8 @@ static bool json_get_field_value( json_t const *field, jsonType_t type, jsonValu
             value->boolean = (int)boolValue;
             result = true;
         } else if ( type == JSON_TEXT && json_getType( field ) == JSON_TEXT ) {
-            textValue = strdup( json_getValue( field ) );
-            value->text = textValue;
-            //printf("textValue=[%s]\n",textValue);
+            value->text = (char *)json_getValue( field );
+            //printf("textValue=[%s]\n",value->text);
             result = true;
         } else if ( type == JSON_OBJ && json_getType( field ) == JSON_OBJ ) {
             //printf("JSON_OBJ[%s]=[%s]\n", field->name, json_getValue( field ) );
@@ -67,37 +61,320 @@ static bool json_get_field_value( json_t const *field, jsonType_t type, jsonValu
     return result;
 }
 
-static bool json_find_field( json_t const *root, const char *name, jsonType_t type, jsonValue_t *value )
+static json_t const *json_find_field( json_t const *root, const char *name, jsonType_t type )
 {
-    bool result = false;
+    json_t const *found = NULL;
     json_t const* item;
 
     //printf("json_find_field [%s] in [%s]\n", name, root->name );
 
-    for( item = json_getChild( root ); item != NULL && !result ; item = json_getSibling( item ) ) {
-        if ( JSON_OBJ == json_getType( item ) ) {
+    for( item = json_getChild( root ); item != NULL && found == NULL ; item = json_getSibling( item ) ) {
+        // items of a top level array have no name
+        if ( item->name != NULL && strcmp(item->name, name)==0 && json_getType( item ) == type  ) {
+            found = item;
+        } else if ( JSON_OBJ == json_getType( item ) ) {
             //printf("obj [%s] in [%s]\n", name, item->name );
-            if ( strcmp(item->name, name)==0 && json_getType( item ) == type  ) {
-                result = json_get_field_value( item, type, value );
-            } else {
-                result = json_find_field( item, name, type, value );
+            found = json_find_field( item, name, type );
+        }
+    }
+
+    return found;
+}
+
+/*! \brief Splits a path once so it can be looked up any number of times
+ *  \ingroup json.c
+ *
+ * The path is either dotted, "payload.value.powerLevel", or a JSON Pointer (RFC 6901),
+ * "/payload/value/powerLevel" where ~1 stands for '/' and ~0 for '~'. A name that is
+ * a number also picks that element of an array.
+ *
+ * \param path path to initialise
+ * \param text path to split
+ * \return true if the path fits in JSON_PATH_MAX_DEPTH names and JSON_PATH_SIZE bytes
+ */
+bool json_path_compile( json_path_t *path, const char *text )
+{
+    char separator = '.';
+    size_t used = 0;
+
+    path->count = 0;
+    if ( *text == '/' ) {
+        separator = '/';
+        text++;
+    } else if ( *text == '\0' ) {
+        return true;
+    }
+
+    for ( ;; ) {
+        if ( path->count == JSON_PATH_MAX_DEPTH ) {
+            printf("JSON path is nested too deeply\n");
+            return false;
+        }
+        path->offsets[path->count] = (uint8_t)used;
+        path->index[path->count] = -1;
+        for ( ; *text != separator && *text != '\0' ; text++ ) {
+            char ch = *text;
+            if ( separator == '/' && ch == '~' ) {
+                if ( text[1] != '0' && text[1] != '1' ) {
+                    printf("JSON path has an invalid escape\n");
+                    return false;
+                }
+                ch = *++text == '0' ? '~' : '/';
             }
-        } else {
-            //printf("item [%s] in [%s]\n", name, item->name );
-            if ( strcmp(item->name, name)==0 && json_getType( item ) == type  ) {
-                result = json_get_field_value( item, type, value );
+            // leaving room for the terminator
+            if ( used >= JSON_PATH_SIZE - 1 ) {
+                printf("JSON path is too long\n");
+                return false;
             }
+            path->names[used++] = ch;
+        }
+        if ( used >= JSON_PATH_SIZE ) {
+            printf("JSON path is too long\n");
+            return false;
+        }
+        path->names[used++] = '\0';
+
+        // array indexes are plain numbers, without leading zeros
+        const char *name = path->names + path->offsets[path->count];
+        if ( isdigit( (unsigned char)name[0] ) && ( name[0] != '0' || name[1] == '\0' ) && strlen( name ) < 5 ) {
+            char *end;
+            long index = strtol( name, &end, 10 );
+            if ( *end == '\0' ) {
+                path->index[path->count] = (int16_t)index;
+            }
+        }
+        path->count++;
+
+        if ( *text == '\0' ) {
+            return true;
         }
+        text++;
     }
+}
 
-    return result;
+// Follows the path from root, only down the branch it names
+static json_t const *json_path_find( json_t const *root, json_path_t const *path )
+{
+    json_t const *node = root;
+
+    for ( int i = 0 ; i < path->count && node != NULL ; i++ ) {
+        if ( json_getType( node ) == JSON_OBJ ) {
+            node = json_getProperty( node, path->names + path->offsets[i] );
+        } else if ( json_getType( node ) == JSON_ARRAY && path->index[i] >= 0 ) {
+            node = json_getChild( node );
+            for ( int index = path->index[i] ; index > 0 && node != NULL ; index-- ) {
+                node = json_getSibling( node );
+            }
+        } else {
+            node = NULL;
+        }
+    }
+
+    return node;
+}
+
+// paths last looked up as text, replaced round robin
+static struct {
+    char text[JSON_PATH_SIZE];
+    json_path_t path;
+} json_path_cache[JSON_PATH_CACHE];
+static int json_path_cache_next = 0;
+
+// The split path for text, split now only if it isn't one of the last few looked up
+static json_path_t const *json_path_cached( const char *text )
+{
+    for ( int i = 0 ; i < JSON_PATH_CACHE ; i++ ) {
+        if ( strcmp( json_path_cache[i].text, text ) == 0 ) {
+            return &json_path_cache[i].path;
+        }
+    }
+
+    if ( strlen( text ) >= JSON_PATH_SIZE ) {
+        printf("JSON path is too long\n");
+        return NULL;
+    }
+
+    int i = json_path_cache_next;
+    json_path_cache[i].text[0] = '\0';
+    if ( !json_path_compile( &json_path_cache[i].path, text ) ) {
+        return NULL;
+    }
+    strcpy( json_path_cache[i].text, text );
+    json_path_cache_next = ( i + 1 ) % JSON_PATH_CACHE;
+
+    return &json_path_cache[i].path;
+}
+
+/*  A name holding a '.' or starting with '/' is a path, found only where it leads.
+ *  Otherwise a top level field of that name, else the first of that name and type
+ *  at any depth.
+ */
+static json_t const *json_lookup( json_t const *root, const char *name, jsonType_t type )
+{
+    if ( name[0] == '/' || strchr( name, '.' ) != NULL ) {
+        json_path_t const *path = json_path_cached( name );
+        return path != NULL ? json_path_find( root, path ) : NULL;
+    }
+
+    json_t const *field = json_getProperty( root, name );
+
+    return field != NULL ? field : json_find_field( root, name, type );
 }
 
 //===============================================================================================================
 
-static json_t *internal_pool = NULL;
 static int max_pool_fields = MAX_POOL_FIELDS;
 
+/*  Counts the fields tiny-json will use to parse json, exact for well formed JSON:
+ *  one for the root, one per member (its colon) and one per array element. Returns
+ *  0 if it can't tell, the pool then grows as needed.
+ */
+static unsigned int json_count_fields( const char *json )
+{
+    uint32_t arrays = 0;            // bit per nesting level, set inside an array
+    int depth = 0;
+    unsigned int count = 1;
+
+    for ( const char *p = json ; *p != '\0' ; p++ ) {
+        switch ( *p ) {
+            case '"':
+                for ( p++ ; *p != '"' ; p++ ) {
+                    if ( *p == '\0' || ( *p == '\\' && *++p == '\0' ) ) {
+                        return 0;
+                    }
+                }
+                break;
+            case ':':
+                count++;
+                break;
+            case ',':
+                if ( depth > 0 && ( arrays >> (depth-1) ) & 1 ) {
+                    count++;
+                }
+                break;
+            case '[':
+                // the first element has no comma before it
+                for ( const char *q = p + 1 ; *q != '\0' && *q != ']' ; q++ ) {
+                    if ( *q != ' ' && *q != '\t' && *q != '\n' && *q != '\r' ) {
+                        count++;
+                        break;
+                    }
+                }
+                // fall through
+            case '{':
+                if ( depth == 32 ) {
+                    return 0;
+                }
+                arrays = *p == '[' ? arrays | 1u << depth : arrays & ~( 1u << depth );
+                depth++;
+                break;
+            case '}':
+            case ']':
+                if ( --depth < 0 ) {
+                    return 0;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    return depth == 0 ? count : 0;
+}
+
+// json_get parses a copy of the message and its fields here, the copy at the end
+static union {
+    json_t fields[1];
+    char bytes[JSON_ARENA_SIZE];
+} json_arena;
+
+/*  tiny-json pool for json_get, hands out fields from the arena then from heap chunks,
+ *  never more than max_pool_fields in all. A message that outgrows the arena is
+ *  counted so one chunk of the right size is added. Chunks are kept until the next
+ *  json_get as JSON_OBJ and JSON_ARRAY values point into them.
+ */
+typedef struct {
+    jsonPool_t pool;
+    const char *json;           // message being parsed, counted if the arena runs out
+    json_t *arena;
+    unsigned int arena_fields;
+    unsigned int want;          // fields the message was counted to need, 0 if not yet or it couldn't be
+    json_t *next;               // next field to hand out
+    unsigned int left;          // fields left after it in the block
+    unsigned int total;         // fields handed out so far
+    json_t *chunks[JSON_POOL_CHUNKS];
+    unsigned int chunk_count;
+} jsonArenaPool_t;
+
+static jsonArenaPool_t json_pool;
+
+static json_t *json_pool_alloc( jsonPool_t *pool )
+{
+    jsonArenaPool_t *arena_pool = (jsonArenaPool_t *)pool;
+
+    if ( arena_pool->left == 0 ) {
+        if ( arena_pool->want == 0 && arena_pool->json != NULL ) {
+            arena_pool->want = json_count_fields( arena_pool->json );
+            arena_pool->json = NULL;
+            if ( arena_pool->want > (unsigned int)max_pool_fields ) {
+                printf("JSON has %u fields, more than %d!\n", arena_pool->want, max_pool_fields);
+                return NULL;
+            }
+        }
+        // out of room, add a chunk exactly as big as still needed, or double up if that's unknown
+        unsigned int grow = arena_pool->total > 8 ? arena_pool->total : 8;
+        if ( arena_pool->want > arena_pool->total ) {
+            grow = arena_pool->want - arena_pool->total;
+        }
+        if ( grow > (unsigned int)max_pool_fields - arena_pool->total ) {
+            grow = (unsigned int)max_pool_fields - arena_pool->total;
+        }
+        if ( grow == 0 || arena_pool->chunk_count == JSON_POOL_CHUNKS ) {
+            return NULL;
+        }
+        json_t *chunk = (json_t *)malloc( grow * sizeof(json_t) );
+        if ( chunk == NULL ) {
+            return NULL;
+        }
+        arena_pool->chunks[arena_pool->chunk_count++] = chunk;
+        arena_pool->next = chunk;
+        arena_pool->left = grow;
+    }
+
+    arena_pool->left--;
+    arena_pool->total++;
+    return arena_pool->next++;
+}
+
+static json_t *json_pool_init( jsonPool_t *pool )
+{
+    jsonArenaPool_t *arena_pool = (jsonArenaPool_t *)pool;
+
+    arena_pool->next = arena_pool->arena;
+    arena_pool->left = arena_pool->arena_fields;
+    if ( arena_pool->left > (unsigned int)max_pool_fields ) {
+        arena_pool->left = (unsigned int)max_pool_fields;
+    }
+    arena_pool->total = 0;
+    return json_pool_alloc( pool );
+}
+
+static void json_pool_release( jsonArenaPool_t *arena_pool )
+{
+    while ( arena_pool->chunk_count > 0 ) {
+        free( arena_pool->chunks[--arena_pool->chunk_count] );
+    }
+}
+
+/*! \brief Sets the most fields json_get will parse a message into
+ *  \ingroup json.c
+ *
+ * Messages are parsed in a static arena of JSON_ARENA_SIZE bytes, the heap is only
+ * used for fields that don't fit, and a message with more fields than this fails.
+ *
+ * \param max_fields most fields in a message
+ * \return Nothing
+ */
 void json_set_max_pool_fields( int max_fields )
 {
     max_pool_fields = max_fields;
@@ -106,55 +383,497 @@ void json_set_max_pool_fields( int max_fields )
 /*! \brief Finds the named field within the JSON string and returns field value
  *  \ingroup json.c
  *
- * JSON_ARRAY's are not currently implemented.
+ * JSON_ARRAY's are not currently implemented. The message is copied into a static
+ * arena (or the heap if it doesn't fit) and parsed there, JSON_TEXT, JSON_OBJ and
+ * JSON_ARRAY values stay valid until the next call.
  * 
  * \param json null terminated JSON string
- * \param name name of field to find
+ * \param name name of field to find at any depth, or a dotted path ("payload.value.state")
+ *        or JSON Pointer ("/payload/value/state") to find it only there
  * \param type type of field (JSON_OBJ, JSON_ARRAY, JSON_TEXT, JSON_BOOLEAN, JSON_INTEGER, JSON_REAL)
  * \param value pointer to jsonValue_t to return value in
  * \return true if field found
  */
 bool json_get( const char *json, const char *name, jsonType_t type, jsonValue_t *value ) 
 {
+    static char *heap_copy = NULL;      // copy of a message too long for the arena
     bool result = false;
 
-    if ( internal_pool != NULL ) {
-        free( internal_pool );
-        internal_pool = NULL;
-    }
-    
-    internal_pool = (json_t *)malloc( sizeof(json_t)*max_pool_fields);
-
-    if ( internal_pool ) {
-        // duplicate as string is modified
-        if ( json ) {
-            json = strdup( json );
-            if ( json ) {
-                json_t const* root = json_create( (char *)json, internal_pool, max_pool_fields );
-                if ( root != NULL ) {
-                    //printf("Finding '%s'\n",name);
-                    json_t const *field = json_getProperty( root, name );
-                    if ( field != NULL ) {
-                        result = json_get_field_value( field, type, value );
-                    } else {
-                        result = json_find_field( root, name, type, value );
-                        if ( !result ) {
-                            //printf("Couldn't find JSON field '%s'!\n", name);
-                        }
-                    }
-                } else {
-                    printf("Couldn't create JSON parent object!, try increasing max_fields\n");
+    json_pool_release( &json_pool );
+    if ( heap_copy ) {
+        free( heap_copy );
+        heap_copy = NULL;
+    }
+    if ( json == NULL ) {
+        return false;
+    }
+
+    // duplicate as string is modified, at the end of the arena leaving the start for fields
+    size_t len = strlen( json ) + 1;
+    char *copy;
+    if ( len <= sizeof(json_arena) ) {
+        copy = json_arena.bytes + sizeof(json_arena) - len;
+        json_pool.arena_fields = ( sizeof(json_arena) - len ) / sizeof(json_t);
+    } else {
+        copy = heap_copy = (char *)malloc( len );
+        json_pool.arena_fields = sizeof(json_arena) / sizeof(json_t);
+        if ( copy == NULL ) {
+            printf("Couldn't allocate JSON string!\n");
+            return false;
+        }
+    }
+    memcpy( copy, json, len );
+
+    json_pool.pool.init = json_pool_init;
+    json_pool.pool.alloc = json_pool_alloc;
+    json_pool.arena = json_arena.fields;
+    json_pool.json = json;
+    json_pool.want = 0;
+
+    json_t const* root = json_createWithPool( copy, &json_pool.pool );
+    if ( root != NULL ) {
+        //printf("Finding '%s'\n",name);
+        json_t const *field = json_lookup( root, name, type );
+        if ( field != NULL ) {
+            result = json_get_field_value( field, type, value );
+        } else {
+            //printf("Couldn't find JSON field '%s'!\n", name);
+        }
+    } else {
+        printf("Couldn't create JSON parent object!, try increasing max_fields\n");
+    }
+
+    return result;
+}
+
+/*! \brief Parses a JSON string once so any number of fields can be read from it
+ *  \ingroup json.c
+ *
+ * The string is parsed in place, it is modified and must outlive the document, as must
+ * the pool the fields are kept in. Nothing is allocated, unlike json_get which parses
+ * a copy of the string for every field. Objects with JSON_INDEX_THRESHOLD fields or
+ * more are hash indexed, if the pool has fields to spare for it.
+ *
+ * \param doc document to initialise
+ * \param json null terminated JSON string, modified
+ * \param pool fields to parse into
+ * \param pool_fields number of fields in pool
+ * \return true if the string was parsed
+ */
+bool json_doc_parse( json_doc_t *doc, char *json, json_t *pool, int pool_fields )
+{
+    doc->root = NULL;
+    if ( json != NULL ) {
+        doc->root = json_createIndexed( json, pool, pool_fields, JSON_INDEX_THRESHOLD );
+        if ( doc->root == NULL ) {
+            printf("Couldn't create JSON parent object!, try increasing max_fields\n");
+        }
+    }
+
+    return doc->root != NULL;
+}
+
+/*! \brief Finds the named field within a parsed document and returns field value
+ *  \ingroup json.c
+ *
+ * Fields are found as json_get finds them. JSON_TEXT values point into the parsed string
+ * and stay valid for the life of the document. Use json_doc_get_path to look a path up
+ * repeatedly without splitting it each time.
+ *
+ * \param doc document from json_doc_parse
+ * \param name name of field to find, or a dotted path or JSON Pointer to it
+ * \param type type of field (JSON_OBJ, JSON_ARRAY, JSON_TEXT, JSON_BOOLEAN, JSON_INTEGER, JSON_REAL)
+ * \param value pointer to jsonValue_t to return value in
+ * \return true if field found
+ */
+bool json_doc_get( json_doc_t const *doc, const char *name, jsonType_t type, jsonValue_t *value )
+{
+    json_t const *field = NULL;
+
+    if ( doc->root != NULL ) {
+        field = json_lookup( doc->root, name, type );
+    }
+
+    return field != NULL && json_get_field_value( field, type, value );
+}
+
+/*! \brief Finds the field a compiled path leads to within a parsed document and returns field value
+ *  \ingroup json.c
+ *
+ * Only the branch the path names is searched. The path is split once by
+ * json_path_compile, so a path kept for repeated lookups is never split again.
+ *
+ * \param doc document from json_doc_parse
+ * \param path from json_path_compile
+ * \param type type of field (JSON_OBJ, JSON_ARRAY, JSON_TEXT, JSON_BOOLEAN, JSON_INTEGER, JSON_REAL)
+ * \param value pointer to jsonValue_t to return value in
+ * \return true if field found
+ */
+bool json_doc_get_path( json_doc_t const *doc, json_path_t const *path, jsonType_t type, jsonValue_t *value )
+{
+    json_t const *field = NULL;
+
+    if ( doc->root != NULL ) {
+        field = json_path_find( doc->root, path );
+    }
+
+    return field != NULL && json_get_field_value( field, type, value );
+}
+
+/*! \brief Prepares a set of fields to be extracted from messages with json_extract
+ *  \ingroup json.c
+ *
+ * The fields array is kept by the plan and must outlive it. A plain name is found at
+ * any depth down to JSON_EXTRACT_MAX_DEPTH, the shallowest match of the right type wins
+ * and the first of those in the message. A dotted path only matches at exactly that place.
+ *
+ * \param plan plan to initialise
+ * \param fields fields to look for, JSON_TEXT, JSON_BOOLEAN, JSON_INTEGER or JSON_REAL
+ * \param count number of fields, at most JSON_PLAN_MAX_FIELDS
+ * \return true if the plan can be used
+ */
+bool json_plan_compile( json_plan_t *plan, const json_field_t *fields, int count )
+{
+    plan->fields = fields;
+    plan->count = 0;
+
+    if ( count > JSON_PLAN_MAX_FIELDS ) {
+        printf("JSON plan has too many fields\n");
+        return false;
+    }
+    for ( int i = 0 ; i < count ; i++ ) {
+        if ( fields[i].type != JSON_TEXT && fields[i].type != JSON_BOOLEAN && fields[i].type != JSON_INTEGER && fields[i].type != JSON_REAL ) {
+            printf("JSON plan field '%s' has a type that can't be extracted\n", fields[i].path);
+            return false;
+        }
+        const char *name = fields[i].path;
+        plan->segments[i] = 1;
+        for ( const char *dot = strchr( name, '.' ) ; dot != NULL ; dot = strchr( name, '.' ) ) {
+            name = dot + 1;
+            plan->segments[i]++;
+        }
+        if ( plan->segments[i] > JSON_EXTRACT_MAX_DEPTH ) {
+            printf("JSON plan field '%s' is nested too deeply\n", fields[i].path);
+            return false;
+        }
+        plan->name_len[i] = (uint8_t)strlen( name );
+    }
+    plan->count = (uint8_t)count;
+
+    return true;
+}
+
+// State of one json_extract scan
+typedef struct {
+    const json_plan_t *plan;
+    jsonValue_t *values;
+    uint32_t found;
+    uint8_t found_depth[JSON_PLAN_MAX_FIELDS];
+    const char *keys[JSON_EXTRACT_MAX_DEPTH];   // names of the members being scanned, outermost first, NULL in an array
+    uint8_t key_len[JSON_EXTRACT_MAX_DEPTH];
+} json_scan_t;
+
+static char *json_skip_blank( char *p )
+{
+    while ( *p == ' ' || *p == '\t' || *p == '\n' || *p == '\r' ) {
+        p++;
+    }
+    return p;
+}
+
+// Finds the end of the string p starts in (after the quote), NULL if it doesn't end
+static char *json_skip_string( char *p )
+{
+    for ( ; *p != '\0' ; p++ ) {
+        if ( *p == '"' ) {
+            return p;
+        } else if ( *p == '\\' && *++p == '\0' ) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+// Replaces escapes in the string p starts in with what they stand for, as tiny-json does, and terminates it
+static bool json_unescape( char *p )
+{
+    static const char escapes[] = "\"\"\\\\//b\bf\fn\nr\rt\t";
+    char *tail = p;
+
+    for ( ; *p != '"' ; p++, tail++ ) {
+        if ( *p != '\\' ) {
+            *tail = *p;
+        } else if ( *++p == 'u' ) {
+            for ( int i = 1 ; i <= 4 ; i++ ) {
+                if ( !isxdigit( (unsigned char)p[i] ) ) {
+                    return false;
                 }
-                free( (void *)json );
-            } else {
-                printf("Couldn't allocate JSON string!\n");
             }
+            *tail = '?';
+            p += 4;
+        } else {
+            const char *escape = strchr( escapes, *p );
+            if ( *p == '\0' || escape == NULL || ( escape - escapes ) & 1 ) {
+                return false;
+            }
+            *tail = escape[1];
+        }
+    }
+    *tail = '\0';
+    return true;
+}
+
+// Which fields the member named by keys[depth] would be, as bits
+static uint32_t json_scan_match( json_scan_t *scan, int depth )
+{
+    const json_plan_t *plan = scan->plan;
+    const char *key = scan->keys[depth];
+    uint8_t key_len = scan->key_len[depth];
+    uint32_t match = 0;
+
+    for ( int i = 0 ; i < plan->count ; i++ ) {
+        if ( plan->name_len[i] != key_len ) {
+            continue;
+        }
+        const char *path = plan->fields[i].path;
+        if ( plan->segments[i] == 1 ) {
+            if ( memcmp( path, key, key_len ) == 0 ) {
+                match |= 1u << i;
+            }
+        } else if ( plan->segments[i] == depth + 1 ) {
+            int level = 0;
+            for ( ; level <= depth ; level++ ) {
+                if ( scan->keys[level] == NULL || strncmp( path, scan->keys[level], scan->key_len[level] ) != 0 ) {
+                    break;
+                }
+                path += scan->key_len[level];
+                if ( *path != ( level == depth ? '\0' : '.' ) ) {
+                    break;
+                }
+                path++;
+            }
+            if ( level > depth ) {
+                match |= 1u << i;
+            }
+        }
+    }
+
+    return match;
+}
+
+static void json_scan_store( json_scan_t *scan, uint32_t match, int depth, jsonType_t type, jsonValue_t value )
+{
+    for ( int i = 0 ; match != 0 ; i++, match >>= 1 ) {
+        jsonType_t wanted = scan->plan->fields[i].type;
+        if ( !( match & 1 ) || ( wanted != type && !( wanted == JSON_REAL && type == JSON_INTEGER ) ) ) {
+            continue;
+        }
+        if ( ( scan->found & 1u << i ) && scan->found_depth[i] <= depth ) {
+            continue;
+        }
+        scan->values[i] = value;
+        if ( wanted == JSON_REAL && type == JSON_INTEGER ) {
+            scan->values[i].real = (double)value.integer;
+        }
+        scan->found |= 1u << i;
+        scan->found_depth[i] = (uint8_t)depth;
+    }
+}
+
+static char *json_scan_value( json_scan_t *scan, char *p, int depth, uint32_t match );
+
+// Steps over the name of an object member and its colon, NULL if they're malformed
+static char *json_skip_name( char *p )
+{
+    char *end;
+
+    if ( *p != '"' || ( end = json_skip_string( p + 1 ) ) == NULL ) {
+        return NULL;
+    }
+    p = json_skip_blank( end + 1 );
+    if ( *p++ != ':' ) {
+        return NULL;
+    }
+    return json_skip_blank( p );
+}
+
+/*  Checks the object or array p points to is well formed without looking for fields in
+ *  it, it's deeper than any a plan can name. Levels are kept as bits rather than by
+ *  recursion, so a hostile message can't exhaust the stack. Returns what follows it,
+ *  NULL if it's malformed or more than 64 levels deep, which json_get's pool couldn't
+ *  parse either.
+ */
+static char *json_skip_nested( json_scan_t *scan, char *p )
+{
+    uint64_t arrays = 0;        // a bit for each level open, innermost lowest, set for an array
+    int open = 0;
+
+    for ( ;; ) {
+        bool empty = false;
+        if ( *p == '{' || *p == '[' ) {
+            if ( open == 64 ) {
+                return NULL;
+            }
+            arrays = arrays << 1 | ( *p == '[' );
+            open++;
+            p = json_skip_blank( p + 1 );
+            empty = ( *p == ( arrays & 1 ? ']' : '}' ) );
+            if ( !empty ) {
+                if ( !( arrays & 1 ) && ( p = json_skip_name( p ) ) == NULL ) {
+                    return NULL;
+                }
+                continue;
+            }
+        } else {
+            p = json_scan_value( scan, p, 0, 0 );
+            if ( p == NULL ) {
+                return NULL;
+            }
+            p = json_skip_blank( p );
+        }
+        // close every level that ends here, then on to the next member of the one left open
+        while ( empty || *p != ',' ) {
+            if ( *p != ( arrays & 1 ? ']' : '}' ) ) {
+                return NULL;
+            }
+            arrays >>= 1;
+            if ( --open == 0 ) {
+                return p + 1;
+            }
+            p = json_skip_blank( p + 1 );
+            empty = false;
         }
+        p = json_skip_blank( p + 1 );
+        if ( !( arrays & 1 ) && ( p = json_skip_name( p ) ) == NULL ) {
+            return NULL;
+        }
+    }
+}
+
+/*  Scans the value p points to, match is the fields it would be. Returns what follows
+ *  the value, NULL if the JSON is malformed.
+ */
+static char *json_scan_value( json_scan_t *scan, char *p, int depth, uint32_t match )
+{
+    jsonValue_t value;
+
+    if ( *p == '{' || *p == '[' ) {
+        if ( depth + 1 >= JSON_EXTRACT_MAX_DEPTH ) {
+            return json_skip_nested( scan, p );
+        }
+        char close = *p == '{' ? '}' : ']';
+        p = json_skip_blank( p + 1 );
+        if ( *p == close ) {
+            return p + 1;
+        }
+        // array elements have no name, so nothing below them matches a path
+        scan->keys[depth+1] = NULL;
+        for ( ;; ) {
+            uint32_t member = 0;
+            if ( close == '}' ) {
+                char *end;
+                if ( *p != '"' || ( end = json_skip_string( p + 1 ) ) == NULL ) {
+                    return NULL;
+                }
+                scan->keys[depth+1] = p + 1;
+                scan->key_len[depth+1] = (uint8_t)( end - p - 1 );
+                p = json_skip_blank( end + 1 );
+                if ( *p++ != ':' ) {
+                    return NULL;
+                }
+                p = json_skip_blank( p );
+                member = json_scan_match( scan, depth + 1 );
+            }
+            p = json_scan_value( scan, p, depth + 1, member );
+            if ( p == NULL ) {
+                return NULL;
+            }
+            p = json_skip_blank( p );
+            if ( *p == close ) {
+                return p + 1;
+            }
+            if ( *p++ != ',' ) {
+                return NULL;
+            }
+            p = json_skip_blank( p );
+        }
+    } else if ( *p == '"' ) {
+        char *end = json_skip_string( p + 1 );
+        if ( end == NULL ) {
+            return NULL;
+        }
+        if ( match != 0 ) {
+            if ( !json_unescape( p + 1 ) ) {
+                return NULL;
+            }
+            value.text = p + 1;
+            json_scan_store( scan, match, depth, JSON_TEXT, value );
+        }
+        return end + 1;
+    } else if ( strncmp( p, "true", 4 ) == 0 || strncmp( p, "false", 5 ) == 0 ) {
+        value.boolean = ( *p == 't' );
+        json_scan_store( scan, match, depth, JSON_BOOLEAN, value );
+        return p + ( *p == 't' ? 4 : 5 );
+    } else if ( strncmp( p, "null", 4 ) == 0 ) {
+        return p + 4;
     } else {
-        printf("Couldn't allocate internal field pool\n");
+        char *end = p;
+        bool real = false;
+        while ( *end != '\0' && strchr( "+-0123456789.eE", *end ) != NULL ) {
+            real |= ( *end == '.' || *end == 'e' || *end == 'E' );
+            end++;
+        }
+        if ( end == p ) {
+            return NULL;
+        }
+        if ( match != 0 ) {
+            char *parsed;
+            if ( real ) {
+                value.real = strtod( p, &parsed );
+            } else {
+                value.integer = strtoll( p, &parsed, 10 );
+            }
+            if ( parsed != end ) {
+                return NULL;
+            }
+            json_scan_store( scan, match, depth, real ? JSON_REAL : JSON_INTEGER, value );
+        }
+        return end;
     }
+}
 
-    return result;
+/*! \brief Extracts the fields of a plan from a JSON string in a single scan
+ *  \ingroup json.c
+ *
+ * No tree is built and nothing is allocated. The string is modified, JSON_TEXT values
+ * point into it, terminated where their closing quote was, and stay valid as long as
+ * the string does. Slots of fields that aren't found are left as they were.
+ *
+ * \param plan from json_plan_compile
+ * \param json null terminated JSON string, modified
+ * \param values slots for the values, one per field of the plan
+ * \param found bit i is set if field i was found
+ * \return true if the string is a well formed JSON object
+ */
+bool json_extract( const json_plan_t *plan, char *json, jsonValue_t values[], uint32_t *found )
+{
+    json_scan_t scan = { .plan = plan, .values = values, .found = 0 };
+
+    *found = 0;
+    if ( json == NULL ) {
+        return false;
+    }
+    char *p = json_skip_blank( json );
+    if ( *p != '{' ) {
+        return false;
+    }
+    p = json_scan_value( &scan, p, -1, 0 );
+    if ( p == NULL || *json_skip_blank( p ) != '\0' ) {
+        return false;
+    }
+    *found = scan.found;
+
+    return true;
 }
 
 //===============================================================================================================
@@ -233,3 +952,16 @@ bool json_put_end( void )
     return remaining_len>0;
 }
 
+/*! \brief Gets the length of the JSON string put so far
+ *  \ingroup json.c
+ *
+ * After json_put_end this is the length of the finished string, without the terminator.
+ *
+ * \param None
+ * \return length of the JSON string
+ */
+size_t json_put_len( void )
+{
+    return json_pointer - json_buffer;
+}
+
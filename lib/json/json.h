@@ -7,7 +7,14 @@ extern "C" {
 #include "tiny-json.h"
 #include "json-maker.h"
 
+// most fields json_get will parse a message into, see json_set_max_pool_fields
 #define MAX_POOL_FIELDS     50
+// bytes json_get parses in without touching the heap, a copy of the message and its fields
+#ifndef JSON_ARENA_SIZE
+#define JSON_ARENA_SIZE     2048
+#endif
+// most heap blocks json_get adds to the arena for a message that doesn't fit
+#define JSON_POOL_CHUNKS    4
 
 typedef union jsonValue_u {
     void *void_ptr;
@@ -18,11 +25,74 @@ typedef union jsonValue_u {
     json_t *json_obj;
 } jsonValue_t;
 
+// deepest path json_path_compile splits, and the most bytes of names it keeps
+#ifndef JSON_PATH_MAX_DEPTH
+#define JSON_PATH_MAX_DEPTH     8
+#endif
+#ifndef JSON_PATH_SIZE
+#define JSON_PATH_SIZE          64
+#endif
+#if JSON_PATH_SIZE > 256
+#error JSON_PATH_SIZE must fit the uint8_t offsets of json_path_t
+#endif
+
+// paths given to json_get and json_doc_get as text that are kept split
+#ifndef JSON_PATH_CACHE
+#define JSON_PATH_CACHE         4
+#endif
+
+// a path split once by json_path_compile, so looking it up doesn't split it again
+typedef struct {
+    uint8_t count;                              // names in the path, 0 for the root
+    uint8_t offsets[JSON_PATH_MAX_DEPTH];       // where each name starts in names
+    int16_t index[JSON_PATH_MAX_DEPTH];         // each name as an array index, -1 if it isn't one
+    char names[JSON_PATH_SIZE];                 // the names, each terminated, escapes undone
+} json_path_t;
+
+// objects of a document with this many fields or more are hash indexed when it's parsed,
+// from fields left over in its pool, 0 to always search them one by one
+#ifndef JSON_INDEX_THRESHOLD
+#define JSON_INDEX_THRESHOLD    16
+#endif
+
+// a JSON string parsed once, in place, fields are read from it with json_doc_get
+typedef struct {
+    json_t const *root;         // NULL if the string couldn't be parsed
+} json_doc_t;
+
+// most fields an extraction plan can have, json_extract reports them as bits of a uint32_t
+#define JSON_PLAN_MAX_FIELDS    32
+// deepest nesting json_extract looks for fields in, anything deeper is only checked
+#ifndef JSON_EXTRACT_MAX_DEPTH
+#define JSON_EXTRACT_MAX_DEPTH  8
+#endif
+
+// a field json_extract looks for, its value goes to the slot of the same index
+typedef struct {
+    const char *path;           // a name found at any depth, or a dotted path from the root e.g. "payload.value.state"
+    jsonType_t type;            // JSON_TEXT, JSON_BOOLEAN, JSON_INTEGER or JSON_REAL
+} json_field_t;
+
+// fields prepared once by json_plan_compile so each message is scanned once for all of them
+typedef struct {
+    const json_field_t *fields;
+    uint8_t count;
+    uint8_t segments[JSON_PLAN_MAX_FIELDS];     // names in the path, 1 matches at any depth
+    uint8_t name_len[JSON_PLAN_MAX_FIELDS];     // length of the last name in the path
+} json_plan_t;
+
 void json_set_max_pool_fields( int max_fields );
 bool json_get( const char *json, const char *name, jsonType_t type, jsonValue_t *value );
+bool json_doc_parse( json_doc_t *doc, char *json, json_t *pool, int pool_fields );
+bool json_doc_get( json_doc_t const *doc, const char *name, jsonType_t type, jsonValue_t *value );
+bool json_path_compile( json_path_t *path, const char *text );
+bool json_doc_get_path( json_doc_t const *doc, json_path_t const *path, jsonType_t type, jsonValue_t *value );
+bool json_plan_compile( json_plan_t *plan, const json_field_t *fields, int count );
+bool json_extract( const json_plan_t *plan, char *json, jsonValue_t values[], uint32_t *found );
 bool json_put_start( char *buffer, size_t buffer_len );
 bool json_put( char const* name, jsonValue_t value, jsonType_t type );
 bool json_put_end( void );
+size_t json_put_len( void );
 
 #ifdef __cplusplus
 }
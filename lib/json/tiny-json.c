@@ -39,8 +39,72 @@ typedef struct jsonStaticPool_s {
     jsonPool_t pool;
 } jsonStaticPool_t;
 
+/** Hash index of the properties of an object, an open addressing table
+  * laid over consecutive json properties taken from the pool. */
+typedef struct jsonIndex_s {
+    unsigned int mask;       /**< Number of slots less one, a power of two.  */
+    json_t const* slot[];    /**< Properties by hash of name, null if free.  */
+} jsonIndex_t;
+
+/** Objects to be indexed once parsing is done, and how large they have to be. */
+typedef struct jsonIndexing_s {
+    unsigned int from;       /**< Fewest properties an indexed object has.    */
+    json_t* pending;         /**< Objects to index, chained by last_child.    */
+} jsonIndexing_t;
+
+/** Hash of a property name, FNV-1a.
+  * @param str Null-terminated name.
+  * @return The hash. */
+static uint32_t nameHash( char const* str ) {
+    uint32_t hash = 2166136261u;
+    while( *str != '\0' ) {
+        hash ^= (unsigned char)*str++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/** Build the hash index of an object from the properties left in the pool.
+  * @param obj The handler of the JSON object.
+  * @param spool The pool it was parsed with.
+  * @retval The index if there was room for it.
+  * @retval Null pointer if its properties are to be searched one by one. */
+static jsonIndex_t* buildIndex( json_t const* obj, jsonStaticPool_t* spool ) {
+    unsigned int qty = 0;
+    json_t const* sibling;
+    for( sibling = obj->u.c.child; sibling; sibling = sibling->sibling )
+        ++qty;
+    unsigned int slots = 4;
+    while( slots < 2 * qty )
+        slots *= 2;
+    size_t const bytes = sizeof( jsonIndex_t ) + slots * sizeof( json_t const* );
+    unsigned int const nodes = ( bytes + sizeof( json_t ) - 1 ) / sizeof( json_t );
+    if ( spool->qty - spool->nextFree < nodes ) return 0;
+    jsonIndex_t* const index = (jsonIndex_t*)( spool->mem + spool->nextFree );
+    spool->nextFree += nodes;
+    index->mask = slots - 1;
+    memset( index->slot, 0, slots * sizeof( json_t const* ) );
+    for( sibling = obj->u.c.child; sibling; sibling = sibling->sibling ) {
+        unsigned int i = nameHash( sibling->name ) & index->mask;
+        // the first of properties with the same name is the one found, as without the index
+        while( index->slot[i] && strcmp( index->slot[i]->name, sibling->name ) )
+            i = ( i + 1 ) & index->mask;
+        if ( !index->slot[i] ) index->slot[i] = sibling;
+    }
+    return index;
+}
+
 /* Search a property by its name in a JSON object. */
 json_t const* json_getProperty( json_t const* obj, char const* property ) {
+    // once parsed, an object's last_child is its index if it was given one
+    if ( obj->type == JSON_OBJ && obj->u.c.last_child ) {
+        jsonIndex_t const* index = (jsonIndex_t const*)obj->u.c.last_child;
+        unsigned int i = nameHash( property ) & index->mask;
+        for( ; index->slot[i]; i = ( i + 1 ) & index->mask )
+            if ( !strcmp( index->slot[i]->name, property ) )
+                return index->slot[i];
+        return 0;
+    }
     json_t const* sibling;
     for( sibling = obj->u.c.child; sibling; sibling = sibling->sibling )
         if ( sibling->name && !strcmp( sibling->name, property ) )
@@ -62,23 +126,33 @@ static char* goBlank( char* str );
 static char* goNum( char* str );
 static json_t* poolInit( jsonPool_t* pool );
 static json_t* poolAlloc( jsonPool_t* pool );
-static char* objValue( char* ptr, json_t* obj, jsonPool_t* pool );
+static char* objValue( char* ptr, json_t* obj, jsonPool_t* pool, jsonIndexing_t* indexing );
 static char* setToNull( char* ch );
 static bool isEndOfPrimitive( char ch );
 
-/* Parse a string to get a json. */
-json_t const* json_createWithPool( char *str, jsonPool_t *pool ) {
+/** Parse a string to get a json.
+  * @param str String pointer with a JSON object. It will be modified.
+  * @param pool The handler of a json pool for creating json instances.
+  * @param indexing Where objects to be indexed are listed, null for none.
+  * @retval The handler of the root if success.
+  * @retval Null pointer if any error occur. */
+static json_t* parse( char* str, jsonPool_t* pool, jsonIndexing_t* indexing ) {
     char* ptr = goBlank( str );
     if ( !ptr || (*ptr != '{' && *ptr != '[') ) return 0;
     json_t* obj = pool->init( pool );
     obj->name    = 0;
     obj->sibling = 0;
     obj->u.c.child = 0;
-    ptr = objValue( ptr, obj, pool );
+    ptr = objValue( ptr, obj, pool, indexing );
     if ( !ptr ) return 0;
     return obj;
 }
 
+/* Parse a string to get a json. */
+json_t const* json_createWithPool( char *str, jsonPool_t *pool ) {
+    return parse( str, pool, 0 );
+}
+
 /* Parse a string to get a json. */
 json_t const* json_create( char* str, json_t mem[], unsigned int qty ) {
     jsonStaticPool_t spool;
@@ -89,6 +163,26 @@ json_t const* json_create( char* str, json_t mem[], unsigned int qty ) {
     return json_createWithPool( str, &spool.pool );
 }
 
+/* Parse a string to get a json, indexing its large objects. */
+json_t const* json_createIndexed( char* str, json_t mem[], unsigned int qty, unsigned int indexFrom ) {
+    jsonStaticPool_t spool;
+    spool.mem = mem;
+    spool.qty = qty;
+    spool.pool.init = poolInit;
+    spool.pool.alloc = poolAlloc;
+    jsonIndexing_t indexing = { indexFrom, 0 };
+    json_t const* const root = parse( str, &spool.pool, indexFrom ? &indexing : 0 );
+    if ( !root ) return 0;
+    // the objects closed last, the root among them, are first to get what is left of the pool
+    json_t* obj = indexing.pending;
+    while( obj ) {
+        json_t* const next = obj->u.c.last_child;
+        obj->u.c.last_child = (json_t*)buildIndex( obj, &spool );
+        obj = next;
+    }
+    return root;
+}
+
 /** Get a special character with its escape character. Examples:
   * 'b' -> '\\b', 'n' -> '\\n', 't' -> '\\t'
   * @param ch The escape character.
@@ -318,13 +412,29 @@ static void add( json_t* obj, json_t* property ) {
     }
 }
 
+/** Finish a JSON object or array once all of its properties are added.
+  * @param obj The handler of the JSON object or array.
+  * @param indexing Where it is listed if it's to be indexed, null for none. */
+static void closeObj( json_t* obj, jsonIndexing_t* indexing ) {
+    obj->u.c.last_child = 0;
+    if ( !indexing || obj->type != JSON_OBJ ) return;
+    unsigned int qty = 0;
+    json_t const* sibling;
+    for( sibling = obj->u.c.child; sibling; sibling = sibling->sibling )
+        ++qty;
+    if ( qty < indexing->from ) return;
+    obj->u.c.last_child = indexing->pending;
+    indexing->pending = obj;
+}
+
 /** Parser a string to get a json object value.
   * @param ptr Pointer to first character.
   * @param obj The handler of the JSON root object or array.
   * @param pool The handler of a json pool for creating json instances.
+  * @param indexing Where objects to be indexed are listed, null for none.
   * @retval Pointer to first character after the value. If success.
   * @retval Null pointer if any error occur. */
-static char* objValue( char* ptr, json_t* obj, jsonPool_t* pool ) {
+static char* objValue( char* ptr, json_t* obj, jsonPool_t* pool, jsonIndexing_t* indexing ) {
     obj->type    = *ptr == '{' ? JSON_OBJ : JSON_ARRAY;
     obj->u.c.child = 0;
     obj->sibling = 0;
@@ -339,6 +449,7 @@ static char* objValue( char* ptr, json_t* obj, jsonPool_t* pool ) {
         char const endchar = ( obj->type == JSON_OBJ )? '}': ']';
         if ( *ptr == endchar ) {
             *ptr = '\0';
+            closeObj( obj, indexing );
             json_t* parentObj = obj->sibling;
             if ( !parentObj ) return ++ptr;
             obj->sibling = 0;
@@ -74,6 +74,19 @@ typedef struct json_s {
   *         This property is always unnamed and its type is JSON_OBJ. */
 json_t const* json_create( char* str, json_t mem[], unsigned int qty );
 
+/** Parse a string to get a json, with a hash index of each large object.
+  * Objects with at least indexFrom properties are indexed once parsing is done,
+  * from the elements of mem left over, so json_getProperty needn't compare every
+  * name. An object is searched one by one if there was no room for its index.
+  * @param str String pointer with a JSON object. It will be modified.
+  * @param mem Array of json properties to allocate.
+  * @param qty Number of elements of mem.
+  * @param indexFrom Fewest properties an indexed object has, 0 for no index.
+  * @retval Null pointer if any was wrong in the parse process.
+  * @retval If the parser process was successfully a valid handler of a json.
+  *         This property is always unnamed and its type is JSON_OBJ. */
+json_t const* json_createIndexed( char* str, json_t mem[], unsigned int qty, unsigned int indexFrom );
+
 /** Get the name of a json property.
   * @param json A valid handler of a json property.
   * @retval Pointer to null-terminated if property has name.
@@ -106,6 +119,7 @@ static inline json_t const* json_getSibling( json_t const* json ) {
 }
 
 /** Search a property by its name in a JSON object.
+  * Uses the object's hash index if it was parsed with json_createIndexed.
   * @param obj A valid handler of a json object. Its type must be JSON_OBJ.
   * @param property The name of property to get.
   * @retval The handler of the json property if found.
@@ -48,10 +48,21 @@
 #define LWIP_UDP                    1
 #define LWIP_DNS                    1
 #define LWIP_TCP_KEEPALIVE          1
-#define LWIP_NETIF_TX_SINGLE_PBUF   1
+// tcp_write always copies when this is set, which would defeat the WebSocket zero-copy
+// transmit slots (WS_ZERO_COPY_TX), the cyw43 driver copies pbuf chains itself anyway
+#define LWIP_NETIF_TX_SINGLE_PBUF   0
+// lets frames the WebSocket transmit slots hold outlive the close, they are freed with the pcb
+#define LWIP_TCP_PCB_NUM_EXT_ARGS   1
 #define DHCP_DOES_ARP_CHECK         0
 #define LWIP_DHCP_DOES_ACD_CHECK    0
 
+// wss:// support, set by the WS_TLS CMake option
+#if WS_TLS
+#define LWIP_ALTCP                  1
+#define LWIP_ALTCP_TLS              1
+#define LWIP_ALTCP_TLS_MBEDTLS      1
+#endif
+
 #ifndef NDEBUG
 #define LWIP_DEBUG                  1
 #define LWIP_STATS                  1
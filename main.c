@@ -58,9 +58,13 @@
 
 #define FIRMWARE_VERSION    "0.1.1"
 
-#define SERVER_URL          "ws.sinric.pro"         // Use 'wss://ws.sinric.pro' for secure connection
+#define SERVER_URL          "ws.sinric.pro"
 #define SERVER_IP           "162.55.80.75"          // Sinric Pro
+#if WS_TLS
+#define TCP_PORT            443                     // wss://, build with -DWS_TLS=ON
+#else
 #define TCP_PORT            80                      // 8082
+#endif
 
 // WiFi connection details...
 #ifndef WIFI_SSID
@@ -0,0 +1,34 @@
+#pragma once
+
+/*  Checks and timing shared by the host tests. A failed CHECK prints where and
+ *  carries on, the test returns testResult() from main so ctest sees the failures.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+static int test_failures;
+
+#define CHECK(cond) do { \
+        if ( !(cond) ) { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            test_failures++; \
+        } \
+    } while (0)
+
+static inline double testNowNs( void )
+{
+    struct timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return (double)now.tv_sec * 1e9 + (double)now.tv_nsec;
+}
+
+// keeps a benchmark's result alive so the work isn't optimised away
+static volatile uintptr_t test_sink;
+
+static inline int testResult( void )
+{
+    printf("%s\n", test_failures ? "FAILED" : "OK");
+    return test_failures ? 1 : 0;
+}
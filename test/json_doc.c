@@ -0,0 +1,124 @@
+/*  Parse once with json_doc_parse and read with json_doc_get, against json_get which
+ *  parses a copy for every field: both must find the same fields with the same
+ *  values, and a document's text values must stay valid while it is read. Then the
+ *  time to read the fields of a request each way.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "json.h"
+#include "hostTest.h"
+#include "sinricMessages.h"
+
+#define POOL_FIELDS 64
+
+static void testSameAsGet( void )
+{
+    static json_t pool[POOL_FIELDS];
+    char buf[1024];
+
+    for ( size_t m = 0 ; m < SINRIC_MESSAGE_COUNT ; m++ ) {
+        json_doc_t doc;
+        jsonValue_t values[SINRIC_FIELD_COUNT];
+        bool found[SINRIC_FIELD_COUNT];
+
+        strcpy( buf, sinric_messages[m] );
+        CHECK( json_doc_parse( &doc, buf, pool, POOL_FIELDS ) );
+        for ( size_t f = 0 ; f < SINRIC_FIELD_COUNT ; f++ ) {
+            const sinricField_t *field = &sinric_fields[f];
+            jsonValue_t value;
+            found[f] = json_doc_get( &doc, field->name, field->type, &values[f] );
+            bool get = json_get( sinric_messages[m], field->name, field->type, &value );
+            CHECK( found[f] == get );
+            if ( found[f] && get ) {
+                CHECK( sinricSameValue( field->type, values[f], value ) );
+            }
+        }
+        // json_get has parsed other copies since, the document's values are untouched
+        for ( size_t f = 0 ; f < SINRIC_FIELD_COUNT ; f++ ) {
+            jsonValue_t value;
+            if ( found[f] ) {
+                CHECK( json_get( sinric_messages[m], sinric_fields[f].name, sinric_fields[f].type, &value ) );
+                CHECK( sinricSameValue( sinric_fields[f].type, values[f], value ) );
+            }
+        }
+    }
+}
+
+static void testFailures( void )
+{
+    json_t pool[POOL_FIELDS];
+    json_doc_t doc;
+    jsonValue_t value;
+    char buf[1024];
+
+    strcpy( buf, "{\"deviceId\":\"d}" );
+    CHECK( !json_doc_parse( &doc, buf, pool, POOL_FIELDS ) );
+    CHECK( !json_doc_get( &doc, "deviceId", JSON_TEXT, &value ) );
+
+    // a pool too small for the message
+    strcpy( buf, sinric_messages[1] );
+    CHECK( !json_doc_parse( &doc, buf, pool, 4 ) );
+    CHECK( !json_doc_get( &doc, "deviceId", JSON_TEXT, &value ) );
+
+    CHECK( !json_doc_parse( &doc, NULL, pool, POOL_FIELDS ) );
+
+    // the wrong type isn't found
+    strcpy( buf, sinric_messages[2] );
+    CHECK( json_doc_parse( &doc, buf, pool, POOL_FIELDS ) );
+    CHECK( !json_doc_get( &doc, "powerLevel", JSON_TEXT, &value ) );
+    CHECK( json_doc_get( &doc, "powerLevel", JSON_INTEGER, &value ) && value.integer == 42 );
+}
+
+// the fields a device reads to act on a request and answer it
+static const sinricField_t request_fields[] = {
+    { "timestamp", JSON_INTEGER },
+    { "deviceId", JSON_TEXT },
+    { "clientId", JSON_TEXT },
+    { "replyToken", JSON_TEXT },
+    { "createdAt", JSON_INTEGER },
+    { "action", JSON_TEXT },
+    { "powerLevel", JSON_INTEGER },
+};
+#define REQUEST_FIELDS ( sizeof(request_fields) / sizeof(request_fields[0]) )
+
+static void bench( void )
+{
+    enum { ROUNDS = 100000 };
+    static json_t pool[POOL_FIELDS];
+    const char *message = sinric_messages[2];
+    size_t len = strlen( message ) + 1;
+    char buf[1024];
+    jsonValue_t value;
+
+    double start = testNowNs();
+    for ( int i = 0 ; i < ROUNDS ; i++ ) {
+        for ( size_t f = 0 ; f < REQUEST_FIELDS ; f++ ) {
+            test_sink += json_get( message, request_fields[f].name, request_fields[f].type, &value );
+        }
+    }
+    double get = ( testNowNs() - start ) / ROUNDS;
+
+    start = testNowNs();
+    for ( int i = 0 ; i < ROUNDS ; i++ ) {
+        json_doc_t doc;
+        memcpy( buf, message, len );
+        json_doc_parse( &doc, buf, pool, POOL_FIELDS );
+        for ( size_t f = 0 ; f < REQUEST_FIELDS ; f++ ) {
+            test_sink += json_doc_get( &doc, request_fields[f].name, request_fields[f].type, &value );
+        }
+    }
+    double doc = ( testNowNs() - start ) / ROUNDS;
+
+    printf("%u fields of a %u byte request: json_get %.0f ns, json_doc_parse and json_doc_get %.0f ns, %.1fx\n",
+        (unsigned)REQUEST_FIELDS, (unsigned)len - 1, get, doc, get / doc );
+    CHECK( doc < get );
+}
+
+int main( void )
+{
+    testSameAsGet();
+    testFailures();
+    bench();
+    return testResult();
+}
@@ -0,0 +1,227 @@
+/*  One pass json_extract against json_get on Sinric Pro messages: the same fields
+ *  found with the same values, by name at any depth and by dotted path. Values nested
+ *  deeper than the scan looks must be stepped over, not refuse the message. Malformed
+ *  messages, including every truncation of the samples, must be refused. Then the
+ *  time to read the fields of a request with a plan, with json_get and with
+ *  json_doc_parse.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "json.h"
+#include "hostTest.h"
+#include "sinricMessages.h"
+
+static json_field_t plan_fields[SINRIC_FIELD_COUNT];
+static size_t plan_count;
+
+// the sample fields a plan can hold, JSON Pointers are json_get's alone
+static void makePlan( json_plan_t *plan )
+{
+    plan_count = 0;
+    for ( size_t f = 0 ; f < SINRIC_FIELD_COUNT ; f++ ) {
+        if ( sinric_fields[f].name[0] != '/' ) {
+            plan_fields[plan_count].path = sinric_fields[f].name;
+            plan_fields[plan_count].type = sinric_fields[f].type;
+            plan_count++;
+        }
+    }
+    CHECK( json_plan_compile( plan, plan_fields, (int)plan_count ) );
+}
+
+static void testSameAsGet( void )
+{
+    json_plan_t plan;
+    makePlan( &plan );
+
+    for ( size_t m = 0 ; m < SINRIC_MESSAGE_COUNT ; m++ ) {
+        char buf[1024];
+        jsonValue_t values[SINRIC_FIELD_COUNT];
+        uint32_t found;
+
+        strcpy( buf, sinric_messages[m] );
+        CHECK( json_extract( &plan, buf, values, &found ) );
+        for ( size_t f = 0 ; f < plan_count ; f++ ) {
+            jsonValue_t value;
+            bool get = json_get( sinric_messages[m], plan_fields[f].path, plan_fields[f].type, &value );
+            CHECK( get == ( ( found >> f & 1 ) != 0 ) );
+            if ( get && ( found >> f & 1 ) ) {
+                CHECK( sinricSameValue( plan_fields[f].type, values[f], value ) );
+            }
+        }
+    }
+}
+
+static void testMalformed( void )
+{
+    static const char *const malformed[] = {
+        "{\"deviceId\":\"unterminated}",
+        "{\"deviceId\":\"d\"} trailing",
+        "{\"deviceId\" \"d\"}",
+        "{\"deviceId\":tru}",
+        "[1,2]",
+        "",
+    };
+    json_plan_t plan;
+    makePlan( &plan );
+    jsonValue_t values[SINRIC_FIELD_COUNT];
+    uint32_t found;
+
+    for ( size_t i = 0 ; i < sizeof(malformed)/sizeof(malformed[0]) ; i++ ) {
+        char buf[64];
+        strcpy( buf, malformed[i] );
+        CHECK( !json_extract( &plan, buf, values, &found ) && found == 0 );
+    }
+    CHECK( !json_extract( &plan, NULL, values, &found ) );
+
+    // each cut short, in a buffer of exactly its size so reading past the end shows up under ASan
+    for ( size_t m = 0 ; m < SINRIC_MESSAGE_COUNT ; m++ ) {
+        size_t len = strlen( sinric_messages[m] );
+        for ( size_t cut = 0 ; cut < len ; cut++ ) {
+            char *buf = (char *)malloc( cut + 1 );
+            memcpy( buf, sinric_messages[m], cut );
+            buf[cut] = '\0';
+            CHECK( !json_extract( &plan, buf, values, &found ) );
+            free( buf );
+        }
+    }
+
+    // what a plan can't hold
+    json_field_t object = { "value", JSON_OBJ };
+    json_field_t deep = { "a.b.c.d.e.f.g.h.i", JSON_TEXT };
+    CHECK( !json_plan_compile( &plan, &object, 1 ) );
+    CHECK( !json_plan_compile( &plan, &deep, 1 ) );
+    CHECK( !json_plan_compile( &plan, plan_fields, JSON_PLAN_MAX_FIELDS + 1 ) );
+}
+
+// a request carrying state nested n levels below its value, objects and arrays in turn
+static char *deepRequest( char *p, int n, const char *inner )
+{
+    p += sprintf( p, "{\"payload\":{\"action\":\"setMode\",\"deviceId\":\"d\",\"value\":{\"restore\":" );
+    for ( int i = 0 ; i < n ; i++ ) {
+        p += sprintf( p, i % 2 ? "[1,\"]}\"," : "{\"state\":\"deep\",\"k\":" );
+    }
+    p += sprintf( p, "%s", inner );
+    for ( int i = n - 1 ; i >= 0 ; i-- ) {
+        p += sprintf( p, i % 2 ? "]" : "}" );
+    }
+    p += sprintf( p, ",\"state\":\"On\"}},\"replyToken\":\"r\"}" );
+    return p;
+}
+
+static void testDeep( void )
+{
+    static const json_field_t fields[] = {
+        { "payload.deviceId", JSON_TEXT },
+        { "payload.value.state", JSON_TEXT },
+        { "replyToken", JSON_TEXT },
+        { "action", JSON_TEXT },
+    };
+    json_plan_t plan;
+    CHECK( json_plan_compile( &plan, fields, 4 ) );
+    jsonValue_t values[4];
+    uint32_t found;
+    static char buf[4096], copy[4096];
+
+    // values deeper than the scan looks are read past
+    for ( int n = 0 ; n <= 40 ; n++ ) {
+        deepRequest( buf, n, "{\"x\":[true,null,-1.5e3,{}],\"y\":[]}" );
+        strcpy( copy, buf );
+        CHECK( json_extract( &plan, copy, values, &found ) );
+        CHECK( found == 0xF );
+        if ( found == 0xF ) {
+            CHECK( strcmp( values[0].text, "d" ) == 0 && strcmp( values[1].text, "On" ) == 0 );
+            CHECK( strcmp( values[2].text, "r" ) == 0 && strcmp( values[3].text, "setMode" ) == 0 );
+        }
+        // as json_get reads it, while the message fits its MAX_POOL_FIELDS
+        jsonValue_t value;
+        if ( n <= 12 ) {
+            CHECK( json_get( buf, "payload.value.state", JSON_TEXT, &value ) && strcmp( value.text, "On" ) == 0 );
+        }
+    }
+
+    // and must still be well formed, to the end
+    static const char *const broken[] = { "[1,}", "{\"x\" 1}", "{\"x\":1,}x", "{\"x\":tru}", "[\"open]" };
+    for ( size_t i = 0 ; i < sizeof(broken)/sizeof(broken[0]) ; i++ ) {
+        deepRequest( buf, 12, broken[i] );
+        CHECK( !json_extract( &plan, buf, values, &found ) );
+    }
+    deepRequest( buf, 12, "1" );
+    size_t len = strlen( buf );
+    for ( size_t cut = 0 ; cut < len ; cut++ ) {
+        char *short_buf = (char *)malloc( cut + 1 );
+        memcpy( short_buf, buf, cut );
+        short_buf[cut] = '\0';
+        CHECK( !json_extract( &plan, short_buf, values, &found ) );
+        free( short_buf );
+    }
+
+    // past what any pool could hold is refused rather than walked
+    deepRequest( buf, 200, "1" );
+    CHECK( !json_extract( &plan, buf, values, &found ) );
+}
+
+// the fields SinricPro.c extracts from every message
+static const json_field_t request_fields[] = {
+    { "timestamp", JSON_INTEGER },
+    { "payload.deviceId", JSON_TEXT },
+    { "payload.clientId", JSON_TEXT },
+    { "payload.replyToken", JSON_TEXT },
+    { "payload.createdAt", JSON_INTEGER },
+    { "payload.action", JSON_TEXT },
+    { "payload.value.powerLevel", JSON_INTEGER },
+};
+#define REQUEST_FIELDS ( sizeof(request_fields) / sizeof(request_fields[0]) )
+
+static void bench( void )
+{
+    enum { ROUNDS = 100000, POOL_FIELDS = 64 };
+    static json_t pool[POOL_FIELDS];
+    const char *message = sinric_messages[2];
+    size_t len = strlen( message ) + 1;
+    char buf[1024];
+    jsonValue_t values[REQUEST_FIELDS];
+    uint32_t found;
+    json_plan_t plan;
+    CHECK( json_plan_compile( &plan, request_fields, REQUEST_FIELDS ) );
+
+    double start = testNowNs();
+    for ( int i = 0 ; i < ROUNDS ; i++ ) {
+        for ( size_t f = 0 ; f < REQUEST_FIELDS ; f++ ) {
+            test_sink += json_get( message, request_fields[f].path, request_fields[f].type, &values[f] );
+        }
+    }
+    double get = ( testNowNs() - start ) / ROUNDS;
+
+    start = testNowNs();
+    for ( int i = 0 ; i < ROUNDS ; i++ ) {
+        json_doc_t doc;
+        memcpy( buf, message, len );
+        json_doc_parse( &doc, buf, pool, POOL_FIELDS );
+        for ( size_t f = 0 ; f < REQUEST_FIELDS ; f++ ) {
+            test_sink += json_doc_get( &doc, request_fields[f].path, request_fields[f].type, &values[f] );
+        }
+    }
+    double doc = ( testNowNs() - start ) / ROUNDS;
+
+    start = testNowNs();
+    for ( int i = 0 ; i < ROUNDS ; i++ ) {
+        memcpy( buf, message, len );
+        test_sink += json_extract( &plan, buf, values, &found );
+    }
+    double extract = ( testNowNs() - start ) / ROUNDS;
+    CHECK( found == ( 1u << REQUEST_FIELDS ) - 2 && values[REQUEST_FIELDS - 1].integer == 42 );
+
+    printf("%u fields of a %u byte request: json_get %.0f ns, json_doc %.0f ns, json_extract %.0f ns\n",
+        (unsigned)REQUEST_FIELDS, (unsigned)len - 1, get, doc, extract );
+    CHECK( extract < doc && extract < get );
+}
+
+int main( void )
+{
+    testSameAsGet();
+    testMalformed();
+    testDeep();
+    bench();
+    return testResult();
+}
@@ -0,0 +1,160 @@
+/*  tiny-json's hash index against the one by one search: objects of random sizes
+ *  with repeated names, nested, in pools with and without room for the index,
+ *  parsed with json_createIndexed must give json_getProperty the same answers, and
+ *  the same children in the same order, as json_create. Then the lookup and parse
+ *  cost either way by object size.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "tiny-json.h"
+#include "hostTest.h"
+
+#define POOL_FIELDS 4096
+
+static json_t linear_pool[POOL_FIELDS], indexed_pool[POOL_FIELDS];
+
+// the first child called name, as the JSON says
+static json_t const *firstNamed( json_t const *obj, const char *name )
+{
+    for ( json_t const *child = json_getChild( obj ) ; child != NULL ; child = json_getSibling( child ) ) {
+        if ( strcmp( json_getName( child ), name ) == 0 ) {
+            return child;
+        }
+    }
+    return NULL;
+}
+
+// compares two parses of the same text, object by object
+static void compare( json_t const *linear, json_t const *indexed, int names )
+{
+    CHECK( json_getType( linear ) == json_getType( indexed ) );
+    if ( json_getType( linear ) != JSON_OBJ && json_getType( linear ) != JSON_ARRAY ) {
+        return;
+    }
+    if ( json_getType( linear ) == JSON_OBJ ) {
+        for ( int i = 0 ; i <= names ; i++ ) {
+            char name[16];
+            snprintf( name, sizeof(name), "k%d", i );
+            json_t const *a = json_getProperty( linear, name ), *b = json_getProperty( indexed, name );
+            CHECK( a == firstNamed( linear, name ) );
+            CHECK( ( a == NULL ) == ( b == NULL ) );
+            if ( a != NULL && b != NULL ) {
+                // the same element of each pool
+                CHECK( a - linear_pool == b - indexed_pool );
+            }
+        }
+        CHECK( json_getProperty( indexed, "" ) == NULL && json_getProperty( indexed, "k" ) == NULL );
+    }
+    json_t const *a = json_getChild( linear ), *b = json_getChild( indexed );
+    for ( ; a != NULL && b != NULL ; a = json_getSibling( a ), b = json_getSibling( b ) ) {
+        compare( a, b, names );
+    }
+    CHECK( a == NULL && b == NULL );
+}
+
+static char *randomObject( char *p, int depth )
+{
+    int count = rand() % 40;
+    *p++ = '{';
+    for ( int i = 0 ; i < count ; i++ ) {
+        // names repeat, the first must win
+        p += sprintf( p, "%s\"k%d\":", i ? "," : "", rand() % ( count + 1 ) );
+        if ( depth < 2 && rand() % 8 == 0 ) {
+            p = randomObject( p, depth + 1 );
+        } else if ( rand() % 16 == 0 ) {
+            p += sprintf( p, "[1,{\"k0\":%d}]", i );
+        } else {
+            p += sprintf( p, "%d", i );
+        }
+    }
+    *p++ = '}';
+    *p = '\0';
+    return p;
+}
+
+// the smallest pool text parses in, buf is scratch space for it
+static unsigned fieldsNeeded( const char *text, char *buf )
+{
+    unsigned qty = 1;
+    for ( ;; qty++ ) {
+        strcpy( buf, text );
+        if ( json_create( buf, indexed_pool, qty ) != NULL ) {
+            return qty;
+        }
+    }
+}
+
+static void testSameAsLinear( void )
+{
+    static char text[32768], linear_buf[32768], indexed_buf[32768];
+    srand( 1 );
+    for ( int n = 0 ; n < 3000 ; n++ ) {
+        randomObject( text, 0 );
+        strcpy( linear_buf, text );
+        strcpy( indexed_buf, text );
+        json_t const *linear = json_create( linear_buf, linear_pool, POOL_FIELDS );
+        CHECK( linear != NULL );
+        // every third parse gets a pool with little or no room for indexes
+        unsigned qty = POOL_FIELDS;
+        if ( n % 3 == 0 ) {
+            qty = fieldsNeeded( text, indexed_buf ) + (unsigned)( rand() % 8 );
+            strcpy( indexed_buf, text );
+        }
+        json_t const *indexed = json_createIndexed( indexed_buf, indexed_pool, qty, (unsigned)( 1 + n % 20 ) );
+        CHECK( indexed != NULL );
+        if ( linear != NULL && indexed != NULL ) {
+            compare( linear, indexed, 40 );
+        }
+    }
+}
+
+static void bench( void )
+{
+    enum { ROUNDS = 2000 };
+    static const int sizes[] = { 4, 8, 16, 32, 64, 128 };
+    static char text[8192], buf[8192], names[128][24];
+
+    for ( size_t s = 0 ; s < sizeof(sizes)/sizeof(sizes[0]) ; s++ ) {
+        int n = sizes[s];
+        char *p = text;
+        p += sprintf( p, "{" );
+        for ( int i = 0 ; i < n ; i++ ) {
+            p += sprintf( p, "%s\"device%03d\":{\"state\":%d}", i ? "," : "", i, i );
+            snprintf( names[i], sizeof(names[i]), "device%03d", i * 7 % n );
+        }
+        sprintf( p, "}" );
+
+        double lookup[2], parse[2];
+        for ( int indexed = 0 ; indexed < 2 ; indexed++ ) {
+            json_t const *root = NULL;
+            double start = testNowNs();
+            for ( int r = 0 ; r < ROUNDS ; r++ ) {
+                strcpy( buf, text );
+                root = indexed ? json_createIndexed( buf, indexed_pool, POOL_FIELDS, 16 ) : json_create( buf, linear_pool, POOL_FIELDS );
+            }
+            parse[indexed] = ( testNowNs() - start ) / ROUNDS;
+
+            start = testNowNs();
+            for ( int r = 0 ; r < ROUNDS ; r++ ) {
+                for ( int i = 0 ; i < n ; i++ ) {
+                    test_sink += (uintptr_t)json_getProperty( root, names[i] );
+                }
+            }
+            lookup[indexed] = ( testNowNs() - start ) / ( (double)ROUNDS * n );
+            CHECK( json_getProperty( root, "device000" ) != NULL && json_getProperty( root, "device" ) == NULL );
+        }
+        printf("%3d fields: lookup one by one %6.1f ns, indexed %5.1f ns; parse %7.0f ns, with index %7.0f ns\n",
+            n, lookup[0], lookup[1], parse[0], parse[1] );
+        if ( n >= 64 ) {
+            CHECK( lookup[1] < lookup[0] );
+        }
+    }
+}
+
+int main( void )
+{
+    testSameAsLinear();
+    bench();
+    return testResult();
+}
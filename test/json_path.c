@@ -0,0 +1,153 @@
+/*  json_path_compile: paths of every length and depth around the limits, dotted and
+ *  as JSON Pointers, must be refused exactly when they don't fit and never write
+ *  past the path. Compiled paths must split, unescape and index as json_get reads
+ *  the same text. Then the cost of a lookup by compiled path, by path text and by
+ *  name at any depth.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "json.h"
+#include "hostTest.h"
+#include "sinricMessages.h"
+
+#define GUARD 64
+
+static void testBounds( void )
+{
+    struct {
+        json_path_t path;
+        uint8_t guard[GUARD];
+    } t;
+    char text[JSON_PATH_SIZE * 3];
+
+    for ( int first = 1 ; first <= JSON_PATH_SIZE + 4 ; first++ ) {
+        for ( int more = 0 ; more <= JSON_PATH_MAX_DEPTH + 2 ; more++ ) {
+            for ( int pointer = 0 ; pointer < 2 ; pointer++ ) {
+                // a long first name then more names of one or two characters, escaped in pointers
+                char *p = text;
+                int bytes = first + 1;
+                if ( pointer ) {
+                    *p++ = '/';
+                }
+                memset( p, 'a', (size_t)first );
+                p += first;
+                for ( int i = 0 ; i < more ; i++ ) {
+                    *p++ = pointer ? '/' : '.';
+                    if ( pointer ) {
+                        memcpy( p, "~1", 2 );
+                        p += 2;
+                    } else {
+                        *p++ = 'b';
+                    }
+                    bytes += 2;
+                    if ( i % 2 ) {
+                        *p++ = 'c';
+                        bytes++;
+                    }
+                }
+                *p = '\0';
+
+                memset( t.guard, 0x5A, GUARD );
+                bool fits = 1 + more <= JSON_PATH_MAX_DEPTH && bytes <= JSON_PATH_SIZE;
+                CHECK( json_path_compile( &t.path, text ) == fits );
+                for ( int i = 0 ; i < GUARD ; i++ ) {
+                    CHECK( t.guard[i] == 0x5A );
+                }
+                if ( fits ) {
+                    CHECK( t.path.count == 1 + more );
+                    CHECK( strlen( t.path.names ) == (size_t)first );
+                    if ( more > 0 ) {
+                        CHECK( strcmp( t.path.names + t.path.offsets[1], pointer ? "/" : "b" ) == 0 );
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void testSplit( void )
+{
+    json_path_t path;
+
+    CHECK( json_path_compile( &path, "" ) && path.count == 0 );
+    CHECK( json_path_compile( &path, "/a~0b/c~1d/12/012/0" ) && path.count == 5 );
+    CHECK( strcmp( path.names + path.offsets[0], "a~b" ) == 0 && path.index[0] == -1 );
+    CHECK( strcmp( path.names + path.offsets[1], "c/d" ) == 0 );
+    CHECK( path.index[2] == 12 && path.index[3] == -1 && path.index[4] == 0 );
+    CHECK( json_path_compile( &path, "payload.value.state" ) && path.count == 3 );
+    CHECK( strcmp( path.names + path.offsets[2], "state" ) == 0 );
+    CHECK( !json_path_compile( &path, "/a~2" ) );
+    CHECK( !json_path_compile( &path, "/a~" ) );
+}
+
+// every sample path, as compiled, finds what json_get finds with its text
+static void testLookup( void )
+{
+    enum { POOL_FIELDS = 64 };
+    static json_t pool[POOL_FIELDS];
+    char buf[1024];
+
+    for ( size_t m = 0 ; m < SINRIC_MESSAGE_COUNT ; m++ ) {
+        json_doc_t doc;
+        strcpy( buf, sinric_messages[m] );
+        CHECK( json_doc_parse( &doc, buf, pool, POOL_FIELDS ) );
+        for ( size_t f = 0 ; f < SINRIC_FIELD_COUNT ; f++ ) {
+            const sinricField_t *field = &sinric_fields[f];
+            if ( strchr( field->name, '.' ) == NULL && field->name[0] != '/' ) {
+                continue;
+            }
+            json_path_t path;
+            jsonValue_t value, expected;
+            CHECK( json_path_compile( &path, field->name ) );
+            bool found = json_doc_get_path( &doc, &path, field->type, &value );
+            CHECK( found == json_get( sinric_messages[m], field->name, field->type, &expected ) );
+            if ( found ) {
+                CHECK( sinricSameValue( field->type, value, expected ) );
+            }
+        }
+    }
+}
+
+static void bench( void )
+{
+    enum { ROUNDS = 1000000, POOL_FIELDS = 64 };
+    static json_t pool[POOL_FIELDS];
+    char buf[1024];
+    json_doc_t doc;
+    json_path_t path;
+    jsonValue_t value;
+
+    strcpy( buf, sinric_messages[2] );
+    CHECK( json_doc_parse( &doc, buf, pool, POOL_FIELDS ) );
+    CHECK( json_path_compile( &path, "payload.value.powerLevel" ) );
+
+    double start = testNowNs();
+    for ( int i = 0 ; i < ROUNDS ; i++ ) {
+        test_sink += json_doc_get_path( &doc, &path, JSON_INTEGER, &value );
+    }
+    double compiled = ( testNowNs() - start ) / ROUNDS;
+    start = testNowNs();
+    for ( int i = 0 ; i < ROUNDS ; i++ ) {
+        test_sink += json_doc_get( &doc, "payload.value.powerLevel", JSON_INTEGER, &value );
+    }
+    double text = ( testNowNs() - start ) / ROUNDS;
+    start = testNowNs();
+    for ( int i = 0 ; i < ROUNDS ; i++ ) {
+        test_sink += json_doc_get( &doc, "powerLevel", JSON_INTEGER, &value );
+    }
+    double name = ( testNowNs() - start ) / ROUNDS;
+    CHECK( value.integer == 42 );
+
+    printf("payload.value.powerLevel: compiled path %.1f ns, path text %.1f ns, name at any depth %.1f ns\n",
+        compiled, text, name );
+}
+
+int main( void )
+{
+    testBounds();
+    testSplit();
+    testLookup();
+    bench();
+    return testResult();
+}
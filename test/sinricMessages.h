@@ -0,0 +1,75 @@
+#pragma once
+
+/*  Messages shaped like the ones Sinric Pro sends a device, and the device's
+ *  responses, shared by the JSON tests.
+ */
+
+static const char *const sinric_messages[] = {
+    "{\"timestamp\":1700000000}",
+    "{\"header\":{\"payloadVersion\":2,\"signatureVersion\":1},\"payload\":{\"action\":\"setPowerState\","
+    "\"clientId\":\"alexa-skill\",\"createdAt\":1700000000,\"deviceAttributes\":[],\"deviceId\":"
+    "\"5fe1a2b3c4d5e6f708192a3b\",\"replyToken\":\"8d2f6c1e-3b4a-4f5e-9c8d-7a6b5c4d3e2f\",\"type\":"
+    "\"request\",\"value\":{\"state\":\"On\"}},\"signature\":{\"HMAC\":"
+    "\"n8q3W0m5bXkJtq1Vh3d1l7pY6Q2eS9fA0cR4uZ8xK1o=\"}}",
+    "{\"header\":{\"payloadVersion\":2,\"signatureVersion\":1},\"payload\":{\"action\":\"setPowerLevel\","
+    "\"clientId\":\"google-home\",\"createdAt\":1700000060,\"deviceAttributes\":[],\"deviceId\":"
+    "\"5fe1a2b3c4d5e6f708192a3b\",\"replyToken\":\"1a2b3c4d-5e6f-4a7b-8c9d-0e1f2a3b4c5d\",\"type\":"
+    "\"request\",\"value\":{\"powerLevel\":42}},\"signature\":{\"HMAC\":"
+    "\"Qw3Er5Ty7Ui9Op1As3Df5Gh7Jk9Lz1Xc3Vb5Nm7Qw9E=\"}}",
+    "{\"header\":{\"payloadVersion\":2,\"signatureVersion\":1},\"payload\":{\"action\":\"targetTemperature\","
+    "\"clientId\":\"portal\",\"createdAt\":1700000090,\"deviceAttributes\":[{\"name\":\"room\",\"value\":\"K\\u00fcche\"}],"
+    "\"deviceId\":\"5fe1a2b3c4d5e6f708192a3b\",\"replyToken\":\"3c4d5e6f-7a8b-4c9d-0e1f-2a3b4c5d6e7f\",\"type\":"
+    "\"request\",\"value\":{\"temperature\":21.5,\"duration\":\"\\\"1h\\\"\"}},\"signature\":{\"HMAC\":"
+    "\"Er5Ty7Ui9Op1As3Df5Gh7Jk9Lz1Xc3Vb5Nm7Qw9ErT0=\"}}",
+    "{\"header\":{\"payloadVersion\":2,\"signatureVersion\":1},\"payload\":{\"action\":\"setPowerState\","
+    "\"clientId\":\"alexa-skill\",\"createdAt\":1700000001,\"deviceId\":\"5fe1a2b3c4d5e6f708192a3b\","
+    "\"message\":\"OK\",\"replyToken\":\"8d2f6c1e-3b4a-4f5e-9c8d-7a6b5c4d3e2f\",\"success\":true,"
+    "\"type\":\"response\",\"value\":{\"state\":\"On\"}},\"signature\":{\"HMAC\":"
+    "\"Zt7R2kq9LmVb0xW3cN5yH8uJ1fD4sA6gE2iO7pQ9rTk=\"}}",
+    "{\"header\":{\"payloadVersion\":2,\"signatureVersion\":1},\"payload\":{\"action\":\"setPowerLevel\","
+    "\"cause\":{\"type\":\"PHYSICAL_INTERACTION\"},\"createdAt\":1700000120,\"deviceId\":"
+    "\"5fe1a2b3c4d5e6f708192a3b\",\"replyToken\":\"2b3c4d5e-6f7a-4b8c-9d0e-1f2a3b4c5d6e\",\"type\":"
+    "\"event\",\"value\":{\"powerLevel\":-57}},\"signature\":{\"HMAC\":"
+    "\"Lk8Jh6Gf4Ds2Ap0Oi9Uy7Tr5Ew3Qz1Xc9Vb7Nm5Lk3J=\"}}",
+};
+#define SINRIC_MESSAGE_COUNT ( sizeof(sinric_messages) / sizeof(sinric_messages[0]) )
+
+// what a device reads from them, plain names found at any depth and paths
+typedef struct {
+    const char *name;
+    jsonType_t type;
+} sinricField_t;
+
+static const sinricField_t sinric_fields[] = {
+    { "timestamp", JSON_INTEGER },
+    { "deviceId", JSON_TEXT },
+    { "clientId", JSON_TEXT },
+    { "replyToken", JSON_TEXT },
+    { "createdAt", JSON_INTEGER },
+    { "action", JSON_TEXT },
+    { "state", JSON_TEXT },
+    { "powerLevel", JSON_INTEGER },
+    { "temperature", JSON_REAL },
+    { "success", JSON_BOOLEAN },
+    { "message", JSON_TEXT },
+    { "duration", JSON_TEXT },
+    { "payload.value.state", JSON_TEXT },
+    { "payload.type", JSON_TEXT },
+    { "header.payloadVersion", JSON_INTEGER },
+    { "/payload/deviceAttributes/0/value", JSON_TEXT },
+    { "/payload/cause/type", JSON_TEXT },
+    { "missing", JSON_TEXT },
+};
+#define SINRIC_FIELD_COUNT ( sizeof(sinric_fields) / sizeof(sinric_fields[0]) )
+
+// two values of a type are the same, text compared as strings
+static inline bool sinricSameValue( jsonType_t type, jsonValue_t a, jsonValue_t b )
+{
+    switch ( type ) {
+        case JSON_TEXT:     return strcmp( a.text, b.text ) == 0;
+        case JSON_BOOLEAN:  return a.boolean == b.boolean;
+        case JSON_INTEGER:  return a.integer == b.integer;
+        case JSON_REAL:     return a.real == b.real;
+        default:            return a.json_obj == b.json_obj;
+    }
+}
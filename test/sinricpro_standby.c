@@ -0,0 +1,293 @@
+/*  Warm standby failover: a stand-in Sinric Pro server on threads of the test sends
+ *  a request every 10 ms to every connection it has, and cuts the first connection
+ *  a second in. Reports the commands lost and how long after the cut the first
+ *  command was answered, run once with SinricProSetStandby off (argument 0) and
+ *  once with it always on (argument 1). With the standby no command may be lost.
+ *  Every response must carry a valid signature.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "pico/stdlib.h"
+#include "SinricPro.h"
+#include "sha1.h"
+#include "hmac_sha256.h"
+#include "base64.h"
+#include "hostTest.h"
+
+#define RUN_MS          4000        // how long the client runs
+#define COMMAND_MS      10          // between requests
+#define FIRST_MS        300         // requests start once the client is up
+#define CUT_MS          1000        // the first connection is cut
+#define LAST_MS         ( RUN_MS - 300 )
+#define MAX_COMMANDS    ( RUN_MS / COMMAND_MS )
+#define MAX_CONNECTIONS 8
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static int live[MAX_CONNECTIONS];   // upgraded connections, oldest first
+static int live_count;
+static double sent_ms[MAX_COMMANDS];
+static double answered_ms[MAX_COMMANDS];    // 0 until answered
+static int commands;
+static double cut_ms;
+static int good_signatures, bad_signatures;
+static int listen_fd;
+static double start_ns;
+
+static double elapsedMs( void )
+{
+    return ( testNowNs() - start_ns ) / 1e6;
+}
+
+static bool recvAll( int fd, void *data, size_t len )
+{
+    uint8_t *p = (uint8_t *)data;
+    while ( len > 0 ) {
+        ssize_t n = recv( fd, p, len, 0 );
+        if ( n <= 0 ) {
+            return false;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+static void sendFrame( int fd, uint8_t opcode, const void *payload, size_t len )
+{
+    uint8_t frame[1024];
+    size_t header = 2;
+    frame[0] = 0x80 | opcode;
+    if ( len < 126 ) {
+        frame[1] = (uint8_t)len;
+    } else {
+        frame[1] = 126;
+        frame[2] = (uint8_t)( len >> 8 );
+        frame[3] = (uint8_t)len;
+        header = 4;
+    }
+    memcpy( frame + header, payload, len );
+    send( fd, frame, header + len, MSG_NOSIGNAL );
+}
+
+// checks a response's signature and notes which request it answers
+static void onResponse( char *message, size_t len )
+{
+    message[len] = '\0';
+    char *payload = strstr( message, "\"payload\":" );
+    char *signature = strstr( message, ",\"signature\":{\"HMAC\":\"" );
+    char *token = strstr( message, "\"replyToken\":\"" );
+    if ( payload == NULL || signature == NULL ) {
+        return;
+    }
+    payload += 10;
+    uint8_t hmac[32];
+    char expected[48];
+    hmac_sha256( "secret", 6, payload, (size_t)( signature - payload ), hmac, sizeof(hmac) );
+    base64_encode( (const char *)hmac, sizeof(hmac), expected );
+    bool good = strncmp( signature + 22, expected, strlen(expected) ) == 0;
+
+    pthread_mutex_lock( &lock );
+    *( good ? &good_signatures : &bad_signatures ) += 1;
+    if ( token != NULL ) {
+        int n = atoi( token + 14 );
+        if ( n >= 0 && n < commands && answered_ms[n] == 0 ) {
+            answered_ms[n] = elapsedMs();
+        }
+    }
+    pthread_mutex_unlock( &lock );
+}
+
+static void *connectionThread( void *arg )
+{
+    int fd = (int)(intptr_t)arg;
+    char request[2048];
+    size_t len = 0;
+
+    while ( len < sizeof(request) - 1 ) {
+        ssize_t n = recv( fd, request + len, sizeof(request) - 1 - len, 0 );
+        if ( n <= 0 ) {
+            close( fd );
+            return NULL;
+        }
+        len += (size_t)n;
+        request[len] = '\0';
+        if ( strstr( request, "\r\n\r\n" ) ) {
+            break;
+        }
+    }
+    const char *key = strstr( request, "Sec-WebSocket-Key: " );
+    if ( key == NULL ) {
+        close( fd );
+        return NULL;
+    }
+    char concat[24 + 36];
+    memcpy( concat, key + 19, 24 );
+    memcpy( concat + 24, "258EAFA5-E914-47DA-95CA-C5AB0DC85B11", 36 );
+    SHA1_HASH hash;
+    Sha1Calculate( concat, sizeof(concat), &hash );
+    char accept[32], response[256];
+    base64_encode( (const char *)hash.bytes, SHA1_HASH_SIZE, accept );
+    int response_len = snprintf( response, sizeof(response),
+        "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+        "Sec-WebSocket-Accept: %s\r\n\r\n", accept );
+    send( fd, response, (size_t)response_len, MSG_NOSIGNAL );
+
+    pthread_mutex_lock( &lock );
+    live[live_count++] = fd;
+    pthread_mutex_unlock( &lock );
+
+    for ( ;; ) {
+        uint8_t header[2], mask[4] = { 0 };
+        char payload[4096];
+        if ( !recvAll( fd, header, 2 ) ) {
+            break;
+        }
+        size_t payload_len = header[1] & 0x7F;
+        if ( payload_len == 126 ) {
+            uint8_t extended[2];
+            if ( !recvAll( fd, extended, 2 ) ) {
+                break;
+            }
+            payload_len = (size_t)extended[0] << 8 | extended[1];
+        }
+        if ( payload_len >= sizeof(payload) || ( ( header[1] & 0x80 ) && !recvAll( fd, mask, 4 ) ) ||
+             !recvAll( fd, payload, payload_len ) ) {
+            break;
+        }
+        for ( size_t i = 0 ; i < payload_len ; i++ ) {
+            payload[i] ^= (char)mask[i % 4];
+        }
+        uint8_t opcode = header[0] & 0x0F;
+        if ( opcode == 0x8 ) {
+            break;
+        } else if ( opcode == 0x9 ) {
+            sendFrame( fd, 0xA, payload, payload_len );
+        } else if ( opcode == 0x1 ) {
+            onResponse( payload, payload_len );
+        }
+    }
+
+    pthread_mutex_lock( &lock );
+    for ( int i = 0 ; i < live_count ; i++ ) {
+        if ( live[i] == fd ) {
+            memmove( live + i, live + i + 1, (size_t)( live_count - i - 1 ) * sizeof(int) );
+            live_count--;
+            break;
+        }
+    }
+    pthread_mutex_unlock( &lock );
+    close( fd );
+    return NULL;
+}
+
+static void *acceptThread( void *arg )
+{
+    (void)arg;
+    for ( ;; ) {
+        int fd = accept( listen_fd, NULL, NULL );
+        if ( fd < 0 ) {
+            break;
+        }
+        int nodelay = 1;
+        setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay) );
+        pthread_t thread;
+        pthread_create( &thread, NULL, connectionThread, (void *)(intptr_t)fd );
+        pthread_detach( thread );
+    }
+    return NULL;
+}
+
+static void *commandThread( void *arg )
+{
+    (void)arg;
+    usleep( FIRST_MS * 1000 );
+    while ( elapsedMs() < LAST_MS && commands < MAX_COMMANDS ) {
+        char message[512];
+        int len;
+
+        pthread_mutex_lock( &lock );
+        double now = elapsedMs();
+        if ( cut_ms == 0 && now >= CUT_MS && live_count > 0 ) {
+            // the connection drops without a close, as when the network goes
+            shutdown( live[0], SHUT_RDWR );
+            cut_ms = now;
+        }
+        len = snprintf( message, sizeof(message),
+            "{\"header\":{\"payloadVersion\":2,\"signatureVersion\":1},\"payload\":{\"action\":\"setPowerState\","
+            "\"clientId\":\"test\",\"createdAt\":1,\"deviceId\":\"device\",\"replyToken\":\"%d\",\"type\":\"request\","
+            "\"value\":{\"state\":\"On\"}},\"signature\":{\"HMAC\":\"x\"}}", commands );
+        sent_ms[commands++] = now;
+        for ( int i = 0 ; i < live_count ; i++ ) {
+            sendFrame( live[i], 0x1, message, (size_t)len );
+        }
+        pthread_mutex_unlock( &lock );
+        usleep( COMMAND_MS * 1000 );
+    }
+    return NULL;
+}
+
+static bool onAction( char *deviceID, char *action, jsonValue_t value, jsonType_t type )
+{
+    (void)deviceID;
+    (void)action;
+    (void)value;
+    (void)type;
+    return true;
+}
+
+int main( int argc, char **argv )
+{
+    SinricProStandby_t standby = argc > 1 && atoi( argv[1] ) ? SINRICPRO_STANDBY_ALWAYS : SINRICPRO_STANDBY_OFF;
+
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t addr_len = sizeof(addr);
+    listen_fd = socket( AF_INET, SOCK_STREAM, 0 );
+    bind( listen_fd, (struct sockaddr *)&addr, sizeof(addr) );
+    listen( listen_fd, 4 );
+    getsockname( listen_fd, (struct sockaddr *)&addr, &addr_len );
+
+    start_ns = testNowNs();
+    pthread_t acceptor, commander;
+    pthread_create( &acceptor, NULL, acceptThread, NULL );
+    pthread_create( &commander, NULL, commandThread, NULL );
+
+    CHECK( SinricProInit( "127.0.0.1", "localhost", ntohs(addr.sin_port), "key", "secret", "device", "1.0", "127.0.0.1", "00:00:00:00:00:00" ) );
+    CHECK( SinricProSetStandby( standby ) );
+    CHECK( SinricProConnect( onAction ) );
+    while ( elapsedMs() < RUN_MS ) {
+        SinricProHandler();
+        usleep( 200 );
+    }
+    pthread_join( commander, NULL );
+    shutdown( listen_fd, SHUT_RDWR );
+    pthread_join( acceptor, NULL );
+    close( listen_fd );
+
+    pthread_mutex_lock( &lock );
+    int lost = 0;
+    double window = -1;
+    for ( int n = 0 ; n < commands ; n++ ) {
+        lost += answered_ms[n] == 0;
+        if ( window < 0 && cut_ms > 0 && sent_ms[n] >= cut_ms && answered_ms[n] != 0 ) {
+            window = sent_ms[n] - cut_ms;
+        }
+    }
+    printf("standby %s: %d commands, %d lost, first answered %.0f ms after the cut, signatures %d good %d bad\n",
+        standby ? "on" : "off", commands, lost, window, good_signatures, bad_signatures );
+    CHECK( cut_ms > 0 );
+    CHECK( bad_signatures == 0 && good_signatures > 0 );
+    CHECK( window >= 0 );
+    if ( standby ) {
+        CHECK( lost == 0 );
+    }
+    pthread_mutex_unlock( &lock );
+    return testResult();
+}
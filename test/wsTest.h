@@ -0,0 +1,218 @@
+#pragma once
+
+/*  In-memory transport for host tests of the WebSocket client. Including this
+ *  builds WebSocket.c into the test, so its static functions can be reached, with
+ *  wsTransportTest in place of the network. The test plays the server, it feeds
+ *  the client bytes with wsTestFeed and reads the frames written with wsTestSent.
+ */
+
+#define WS_TRANSPORT wsTransportTest
+#include "wsTransport.h"
+extern const wsTransport_t wsTransportTest;
+#include "WebSocket.c"
+#include "hostTest.h"
+
+typedef struct {
+    WebSocketClient_p client;
+    uint8_t *sent;                  // everything the client wrote, back to back
+    uint32_t sent_len;
+    uint32_t sent_size;
+} wsTest_t;
+
+static void *wsTestCreate( WebSocketClient_p client, const char *server, uint16_t port )
+{
+    (void)server;
+    (void)port;
+    wsTest_t *test = (wsTest_t *)calloc(1, sizeof(wsTest_t));
+    if ( test ) {
+        test->client = client;
+    }
+    return test;
+}
+
+static void wsTestDestroy( void *transport )
+{
+    wsTest_t *test = (wsTest_t *)transport;
+    free( test->sent );
+    free( test );
+}
+
+static bool wsTestConnect( void *transport )
+{
+    (void)transport;
+    return true;
+}
+
+static bool wsTestWritable( void *transport, uint32_t len )
+{
+    (void)transport;
+    (void)len;
+    return true;
+}
+
+static void wsTestAppend( wsTest_t *test, const void *data, uint32_t len )
+{
+    if ( test->sent_len + len > test->sent_size ) {
+        test->sent_size = ( test->sent_len + len ) * 2;
+        test->sent = (uint8_t *)realloc( test->sent, test->sent_size );
+    }
+    memcpy( test->sent + test->sent_len, data, len );
+    test->sent_len += len;
+}
+
+static bool wsTestWrite( void *transport, uint8_t *frame, uint32_t len, bool copy )
+{
+    (void)copy;
+    wsTestAppend( (wsTest_t *)transport, frame, len );
+    free( frame );
+    return true;
+}
+
+static bool wsTestWritev( void *transport, const wsIovec_t *iov, int iovcnt )
+{
+    for ( int i = 0 ; i < iovcnt ; i++ ) {
+        wsTestAppend( (wsTest_t *)transport, iov[i].base, (uint32_t)iov[i].len );
+    }
+    return true;
+}
+
+static uint32_t wsTestFlush( void *transport )
+{
+    (void)transport;
+    return 0;
+}
+
+static void wsTestClose( void *transport )
+{
+    (void)transport;
+}
+
+static void wsTestPoll( void *transport )
+{
+    wsTransportService( ((wsTest_t *)transport)->client );
+}
+
+const wsTransport_t wsTransportTest = {
+    .name = "test",
+    .max_frame = UINT32_MAX,
+    .state_size = sizeof(wsTest_t),
+    .create = wsTestCreate,
+    .destroy = wsTestDestroy,
+    .connect = wsTestConnect,
+    .writable = wsTestWritable,
+    .write = wsTestWrite,
+    .writev = wsTestWritev,
+    .flush = wsTestFlush,
+    .close = wsTestClose,
+    .poll = wsTestPoll,
+};
+
+static inline wsTest_t *wsTestOf( WebSocketClient_t *state )
+{
+    return (wsTest_t *)state->transport_state;
+}
+
+/*  Passes bytes from the server to the client as one receive. They are copied, with
+ *  tail_room spare bytes after them that the client may borrow.
+ */
+static inline void wsTestFeed( WebSocketClient_t *state, const void *data, uint32_t len, uint32_t tail_room )
+{
+    uint8_t *copy = (uint8_t *)malloc( len + tail_room + 1 );
+    memcpy( copy, data, len );
+    wsTransportReceive( state, copy, len, tail_room );
+    wsTransportReceiveDone( state );
+    free( copy );
+}
+
+/*  Builds an unmasked frame as the server sends it, first is the FIN, RSV and
+ *  opcode byte. Returns its length.
+ */
+static inline uint32_t wsTestFrame( uint8_t *out, uint8_t first, const void *payload, uint32_t len )
+{
+    uint32_t i = 0;
+    out[i++] = first;
+    if ( len < 126 ) {
+        out[i++] = (uint8_t)len;
+    } else if ( len <= 0xFFFF ) {
+        out[i++] = 126;
+        out[i++] = (uint8_t)( len >> 8 );
+        out[i++] = (uint8_t)len;
+    } else {
+        out[i++] = 127;
+        for ( int shift = 56 ; shift >= 0 ; shift -= 8 ) {
+            out[i++] = (uint8_t)( (uint64_t)len >> shift );
+        }
+    }
+    memcpy( out + i, payload, len );
+    return i + len;
+}
+
+/*  Reads the next frame the client sent, from *pos in what it wrote, unmasking the
+ *  payload into payload. Returns false if there isn't a whole frame left.
+ */
+static inline bool wsTestSent( WebSocketClient_t *state, uint32_t *pos, uint8_t *first, uint8_t *payload, uint32_t *len )
+{
+    wsTest_t *test = wsTestOf( state );
+    const uint8_t *frame = test->sent + *pos;
+    uint32_t left = test->sent_len - *pos;
+
+    if ( left < 2 || !( frame[1] & 0x80 ) ) {
+        return false;
+    }
+    uint32_t i = 2;
+    uint64_t payload_len = frame[1] & 0x7F;
+    if ( payload_len == 126 ) {
+        payload_len = (uint32_t)frame[2] << 8 | frame[3];
+        i = 4;
+    } else if ( payload_len == 127 ) {
+        payload_len = 0;
+        for ( i = 2 ; i < 10 ; i++ ) {
+            payload_len = payload_len << 8 | frame[i];
+        }
+    }
+    if ( left < i + 4 + payload_len ) {
+        return false;
+    }
+    const uint8_t *mask = frame + i;
+    i += 4;
+    for ( uint32_t n = 0 ; n < payload_len ; n++ ) {
+        payload[n] = frame[i + n] ^ mask[n % 4];
+    }
+    *first = frame[0];
+    *len = (uint32_t)payload_len;
+    *pos += i + (uint32_t)payload_len;
+    return true;
+}
+
+/*  Connects a client and takes it through the upgrade, extensions is the
+ *  Sec-WebSocket-Extensions the server accepts with, NULL for none. What the
+ *  client wrote for the upgrade is dropped.
+ */
+static inline void wsTestUpgrade( WebSocketClient_t *state, const char *extensions )
+{
+    wsConnect( state );
+    wsTransportConnected( state );
+
+    char response[512];
+    int len = snprintf( response, sizeof(response),
+        "HTTP/1.1 101 Switching Protocols\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Accept: %s\r\n"
+        "%s%s%s"
+        "\r\n",
+        state->upgrade.accept,
+        extensions ? "Sec-WebSocket-Extensions: " : "", extensions ? extensions : "", extensions ? "\r\n" : "" );
+    wsTestFeed( state, response, (uint32_t)len, 0 );
+    wsTestOf( state )->sent_len = 0;
+}
+
+// creates a client and upgrades it without extensions
+static inline WebSocketClient_t *wsTestOpen( wsMessagehandler handler, const wsConfig_t *config )
+{
+    WebSocketClient_t *state = (WebSocketClient_t *)wsCreate( "127.0.0.1", NULL, 80, handler, NULL, false, config );
+    if ( state != NULL ) {
+        wsTestUpgrade( state, NULL );
+    }
+    return state;
+}
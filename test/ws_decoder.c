@@ -0,0 +1,158 @@
+/*  Frame decoder: frames split across receives at every byte, coalesced frames,
+ *  the first frame arriving with the upgrade response, fragmented messages with a
+ *  control frame between the fragments, and oversized frames. Then the decode rate
+ *  for a stream of small frames in TCP sized segments.
+ */
+
+#include "wsTest.h"
+
+static int messages;
+static uint32_t last_len;
+static uint8_t last[4096];
+
+static void onMessage( WebSocketClient_p client, char *message, int len )
+{
+    (void)client;
+    messages++;
+    last_len = (uint32_t)len;
+    memcpy( last, message, (size_t)len );
+}
+
+static void onBinary( WebSocketClient_p client, uint8_t *data, int len )
+{
+    (void)client;
+    (void)data;
+    messages++;
+    last_len = (uint32_t)len;
+}
+
+static void testUpgradeWithFrame( void )
+{
+    WebSocketClient_t *state = (WebSocketClient_t *)wsCreate( "127.0.0.1", NULL, 80, onMessage, NULL, false, NULL );
+    wsConnect( state );
+    wsTransportConnected( state );
+
+    uint8_t buf[512];
+    uint32_t len = (uint32_t)sprintf( (char *)buf,
+        "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+        "Sec-WebSocket-Accept: %s\r\n\r\n", state->upgrade.accept );
+    len += wsTestFrame( buf + len, 0x81, "{\"a\":1}", 7 );
+    messages = 0;
+    wsTestFeed( state, buf, len, 0 );
+    CHECK( state->upgraded );
+    CHECK( messages == 1 && last_len == 7 && memcmp( last, "{\"a\":1}", 7 ) == 0 );
+    wsDestroy( state );
+}
+
+static void testSplitAndCoalesced( void )
+{
+    WebSocketClient_t *state = wsTestOpen( onMessage, NULL );
+    uint8_t big[1000];
+    memset( big, 'x', sizeof(big) );
+    big[0] = '{';
+
+    // a text frame, a PING and a text frame with a 16 bit length, in one stream
+    uint8_t buf[1200];
+    uint32_t len = wsTestFrame( buf, 0x81, "{\"b\":2}", 7 );
+    len += wsTestFrame( buf + len, 0x89, "", 0 );
+    len += wsTestFrame( buf + len, 0x81, big, sizeof(big) );
+
+    for ( uint32_t split = 0 ; split <= len ; split++ ) {
+        messages = 0;
+        wsTestOf( state )->sent_len = 0;
+        wsTestFeed( state, buf, split, 0 );
+        wsTestFeed( state, buf + split, len - split, 0 );
+        CHECK( messages == 2 && last_len == sizeof(big) && memcmp( last, big, sizeof(big) ) == 0 );
+
+        uint32_t pos = 0, pong_len;
+        uint8_t first, pong[16];
+        CHECK( wsTestSent( state, &pos, &first, pong, &pong_len ) && first == 0x8A );
+    }
+
+    messages = 0;
+    for ( uint32_t i = 0 ; i < len ; i++ ) {
+        wsTestFeed( state, buf + i, 1, 0 );
+    }
+    CHECK( messages == 2 && last_len == sizeof(big) );
+    CHECK( wsConnectState( state ) == TCP_CONNECTED );
+    wsDestroy( state );
+}
+
+static void testFragmented( void )
+{
+    WebSocketClient_t *state = wsTestOpen( onMessage, NULL );
+    uint8_t buf[256];
+    uint32_t len = wsTestFrame( buf, 0x01, "{\"first\":", 9 );
+    len += wsTestFrame( buf + len, 0x89, "ping", 4 );
+    len += wsTestFrame( buf + len, 0x00, "\"second\"", 8 );
+    len += wsTestFrame( buf + len, 0x80, "}", 1 );
+
+    for ( uint32_t split = 0 ; split <= len ; split++ ) {
+        messages = 0;
+        wsTestFeed( state, buf, split, 0 );
+        wsTestFeed( state, buf + split, len - split, 0 );
+        CHECK( messages == 1 && last_len == 18 && memcmp( last, "{\"first\":\"second\"}", 18 ) == 0 );
+    }
+    wsDestroy( state );
+}
+
+static void testTooBig( void )
+{
+    wsConfig_t config = { .rx_capacity = 256 };
+    WebSocketClient_t *state = wsTestOpen( onMessage, &config );
+    uint8_t buf[600];
+    memset( buf, '{', sizeof(buf) );
+    uint32_t len = wsTestFrame( buf, 0x81, buf + 300, 257 );
+
+    messages = 0;
+    wsTestFeed( state, buf, len, 0 );
+    CHECK( messages == 0 );
+    CHECK( wsConnectState( state ) == TCP_DISCONNECTED );
+
+    uint32_t pos = 0, close_len;
+    uint8_t first, close[WS_MAX_CONTROL_SIZE];
+    CHECK( wsTestSent( state, &pos, &first, close, &close_len ) && first == 0x88 );
+    CHECK( close_len >= 2 && ( close[0] << 8 | close[1] ) == WS_CLOSE_TOO_BIG );
+    wsDestroy( state );
+}
+
+static void benchDecode( void )
+{
+    enum { FRAMES = 2000, PAYLOAD = 200, SEGMENT = 1460, ROUNDS = 20 };
+    WebSocketClient_t *state = wsTestOpen( onMessage, NULL );
+    wsSetBinaryHandler( state, onBinary );
+
+    uint8_t payload[PAYLOAD];
+    memset( payload, 'x', sizeof(payload) );
+    uint8_t *stream = (uint8_t *)malloc( FRAMES * ( PAYLOAD + 4 ) );
+    uint32_t len = 0;
+    for ( int i = 0 ; i < FRAMES ; i++ ) {
+        len += wsTestFrame( stream + len, 0x82, payload, PAYLOAD );
+    }
+
+    messages = 0;
+    double start = testNowNs();
+    for ( int round = 0 ; round < ROUNDS ; round++ ) {
+        for ( uint32_t offset = 0 ; offset < len ; offset += SEGMENT ) {
+            uint32_t segment = len - offset < SEGMENT ? len - offset : SEGMENT;
+            wsTransportReceive( state, stream + offset, segment, 0 );
+            wsTransportReceiveDone( state );
+        }
+    }
+    double elapsed = testNowNs() - start;
+    CHECK( messages == FRAMES * ROUNDS );
+    printf("decode %d byte frames in %d byte segments: %.2f M frames/s, %.0f MB/s\n",
+        PAYLOAD, SEGMENT, messages / elapsed * 1e3, (double)len * ROUNDS / elapsed * 1e3 );
+    free( stream );
+    wsDestroy( state );
+}
+
+int main( void )
+{
+    testUpgradeWithFrame();
+    testSplitAndCoalesced();
+    testFragmented();
+    testTooBig();
+    benchDecode();
+    return testResult();
+}
@@ -0,0 +1,165 @@
+/*  permessage-deflate against zlib: messages the client compresses are inflated by
+ *  zlib, messages zlib compresses are inflated by the client, with and without
+ *  context takeover and for several window sizes. The state is only allocated once a
+ *  server accepts the offer, and is freed when the connection closes. Reports the
+ *  compression ratio on Sinric Pro requests and responses.
+ */
+
+#include <zlib.h>
+#include "wsTest.h"
+
+static const char *const messages[] = {
+    "{\"header\":{\"payloadVersion\":2,\"signatureVersion\":1},\"payload\":{\"action\":\"setPowerState\","
+    "\"clientId\":\"alexa-skill\",\"createdAt\":1700000000,\"deviceAttributes\":[],\"deviceId\":"
+    "\"5fe1a2b3c4d5e6f708192a3b\",\"replyToken\":\"8d2f6c1e-3b4a-4f5e-9c8d-7a6b5c4d3e2f\",\"type\":"
+    "\"request\",\"value\":{\"state\":\"On\"}},\"signature\":{\"HMAC\":"
+    "\"n8q3W0m5bXkJtq1Vh3d1l7pY6Q2eS9fA0cR4uZ8xK1o=\"}}",
+    "{\"header\":{\"payloadVersion\":2,\"signatureVersion\":1},\"payload\":{\"action\":\"setPowerState\","
+    "\"clientId\":\"alexa-skill\",\"createdAt\":1700000001,\"deviceId\":\"5fe1a2b3c4d5e6f708192a3b\","
+    "\"message\":\"OK\",\"replyToken\":\"8d2f6c1e-3b4a-4f5e-9c8d-7a6b5c4d3e2f\",\"success\":true,"
+    "\"type\":\"response\",\"value\":{\"state\":\"On\"}},\"signature\":{\"HMAC\":"
+    "\"Zt7R2kq9LmVb0xW3cN5yH8uJ1fD4sA6gE2iO7pQ9rTk=\"}}",
+    "{\"header\":{\"payloadVersion\":2,\"signatureVersion\":1},\"payload\":{\"action\":\"setPowerLevel\","
+    "\"clientId\":\"google-home\",\"createdAt\":1700000060,\"deviceAttributes\":[],\"deviceId\":"
+    "\"5fe1a2b3c4d5e6f708192a3b\",\"replyToken\":\"1a2b3c4d-5e6f-4a7b-8c9d-0e1f2a3b4c5d\",\"type\":"
+    "\"request\",\"value\":{\"powerLevel\":42}},\"signature\":{\"HMAC\":"
+    "\"Qw3Er5Ty7Ui9Op1As3Df5Gh7Jk9Lz1Xc3Vb5Nm7Qw9E=\"}}",
+    "{\"header\":{\"payloadVersion\":2,\"signatureVersion\":1},\"payload\":{\"action\":\"setPowerLevel\","
+    "\"cause\":{\"type\":\"PHYSICAL_INTERACTION\"},\"createdAt\":1700000120,\"deviceId\":"
+    "\"5fe1a2b3c4d5e6f708192a3b\",\"replyToken\":\"2b3c4d5e-6f7a-4b8c-9d0e-1f2a3b4c5d6e\",\"type\":"
+    "\"event\",\"value\":{\"powerLevel\":57}},\"signature\":{\"HMAC\":"
+    "\"Lk8Jh6Gf4Ds2Ap0Oi9Uy7Tr5Ew3Qz1Xc9Vb7Nm5Lk3J=\"}}",
+};
+#define MESSAGE_COUNT ( sizeof(messages) / sizeof(messages[0]) )
+
+static int received;
+static char last[2048];
+static uint32_t last_len;
+
+static void onMessage( WebSocketClient_p client, char *message, int len )
+{
+    (void)client;
+    received++;
+    last_len = (uint32_t)len;
+    memcpy( last, message, (size_t)len );
+}
+
+static WebSocketClient_t *openDeflate( int bits, bool takeover )
+{
+    WebSocketClient_t *state = (WebSocketClient_t *)wsCreate( "127.0.0.1", NULL, 80, onMessage, NULL, false, NULL );
+    CHECK( wsSetDeflate( state, (uint8_t)bits, takeover ) );
+
+    char extensions[160];
+    snprintf( extensions, sizeof(extensions), "permessage-deflate; client_max_window_bits=%d; server_max_window_bits=%d%s",
+        bits, bits, takeover ? "" : "; client_no_context_takeover; server_no_context_takeover" );
+    wsTestUpgrade( state, extensions );
+    CHECK( state->deflate_active );
+    return state;
+}
+
+// messages the client sends, inflated by zlib
+static void testSend( int bits, bool takeover )
+{
+    WebSocketClient_t *state = openDeflate( bits, takeover );
+    z_stream zs = { 0 };
+    CHECK( inflateInit2( &zs, -bits ) == Z_OK );
+
+    uint32_t plain = 0, compressed = 0, pos = 0;
+    for ( int round = 0 ; round < 3 ; round++ ) {
+        for ( size_t i = 0 ; i < MESSAGE_COUNT ; i++ ) {
+            uint32_t len = (uint32_t)strlen( messages[i] );
+            CHECK( wsSendMessage( state, (char *)messages[i], len ) );
+            wsTransportWritable( state );
+
+            uint8_t first, payload[2048 + 4], out[2048];
+            uint32_t payload_len;
+            CHECK( wsTestSent( state, &pos, &first, payload, &payload_len ) );
+            CHECK( first == ( 0x80 | WS_RSV1 << 4 | WEBSOCKET_OPCODE_TEXT ) );
+            memcpy( payload + payload_len, "\x00\x00\xff\xff", 4 );
+
+            zs.next_in = payload;
+            zs.avail_in = payload_len + 4;
+            zs.next_out = out;
+            zs.avail_out = sizeof(out);
+            CHECK( inflate( &zs, Z_SYNC_FLUSH ) == Z_OK );
+            CHECK( sizeof(out) - zs.avail_out == len && memcmp( out, messages[i], len ) == 0 );
+            if ( round == 0 ) {
+                // later rounds repeat the messages, which would flatter the history
+                plain += len;
+                compressed += payload_len;
+            }
+        }
+    }
+    printf("send %2d bit window, context takeover %-3s: %u bytes to %u, ratio %.2f\n",
+        bits, takeover ? "on" : "off", plain, compressed, (double)plain / compressed );
+    inflateEnd( &zs );
+    wsDestroy( state );
+}
+
+// messages zlib compresses, inflated by the client, split between receives
+static void testReceive( int bits, bool takeover )
+{
+    WebSocketClient_t *state = openDeflate( bits, takeover );
+    z_stream zs = { 0 };
+    CHECK( deflateInit2( &zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -bits, 8, Z_DEFAULT_STRATEGY ) == Z_OK );
+
+    for ( int round = 0 ; round < 3 ; round++ ) {
+        for ( size_t i = 0 ; i < MESSAGE_COUNT ; i++ ) {
+            uint32_t len = (uint32_t)strlen( messages[i] );
+            uint8_t payload[2048], frame[2048 + 16];
+            zs.next_in = (uint8_t *)messages[i];
+            zs.avail_in = len;
+            zs.next_out = payload;
+            zs.avail_out = sizeof(payload);
+            CHECK( deflate( &zs, Z_SYNC_FLUSH ) == Z_OK );
+            uint32_t payload_len = (uint32_t)( sizeof(payload) - zs.avail_out ) - 4;
+            if ( !takeover ) {
+                deflateReset( &zs );
+            }
+
+            uint32_t frame_len = wsTestFrame( frame, 0x80 | WS_RSV1 << 4 | WEBSOCKET_OPCODE_TEXT, payload, payload_len );
+            uint32_t split = frame_len * (uint32_t)( round + 1 ) / 4;
+            received = 0;
+            wsTestFeed( state, frame, split, 0 );
+            wsTestFeed( state, frame + split, frame_len - split, 0 );
+            CHECK( received == 1 && last_len == len && memcmp( last, messages[i], len ) == 0 );
+        }
+    }
+    CHECK( wsConnectState( state ) == TCP_CONNECTED );
+    deflateEnd( &zs );
+    wsDestroy( state );
+}
+
+// nothing is allocated for an offer the server declines, nor kept past the close
+static void testAllocation( void )
+{
+    WebSocketClient_t *state = (WebSocketClient_t *)wsCreate( "127.0.0.1", NULL, 80, onMessage, NULL, false, NULL );
+    CHECK( wsSetDeflate( state, 12, true ) );
+    CHECK( state->deflater == NULL && state->inflater == NULL && state->inflate_buffer == NULL );
+
+    wsTestUpgrade( state, NULL );
+    CHECK( state->upgraded && !state->deflate_active );
+    CHECK( state->deflater == NULL && state->inflater == NULL && state->inflate_buffer == NULL );
+    wsClose( state );
+
+    wsTestUpgrade( state, "permessage-deflate; client_max_window_bits=9; server_max_window_bits=12" );
+    CHECK( state->deflate_active && state->deflate_tx_bits == 9 );
+    CHECK( state->deflater != NULL && state->inflater != NULL && state->inflate_buffer != NULL );
+    wsClose( state );
+    CHECK( !state->deflate_active );
+    CHECK( state->deflater == NULL && state->inflater == NULL && state->inflate_buffer == NULL );
+    wsDestroy( state );
+}
+
+int main( void )
+{
+    testAllocation();
+    static const int windows[] = { 9, 10, 12, 15 };
+    for ( size_t i = 0 ; i < sizeof(windows)/sizeof(windows[0]) ; i++ ) {
+        testSend( windows[i], true );
+        testSend( windows[i], false );
+        testReceive( windows[i], true );
+        testReceive( windows[i], false );
+    }
+    return testResult();
+}
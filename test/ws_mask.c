@@ -0,0 +1,93 @@
+/*  Masking kernel: wsMask against the byte at a time masking it replaced, for every
+ *  length up to 80, source and destination alignment, starting offset and in place,
+ *  and a frame built by wsBuildPacket unmasked back. Then its rate on 64 byte, 512
+ *  byte and 2 KB payloads next to the byte at a time loop.
+ */
+
+#include "wsTest.h"
+
+static void maskBytewise( uint8_t *dst, const uint8_t *src, uint32_t len, const uint8_t maskBytes[4], uint32_t offset )
+{
+    for ( uint32_t i = 0 ; i < len ; i++ ) {
+        dst[i] = src[i] ^ maskBytes[(offset + i) % 4];
+    }
+}
+
+static void testVectors( void )
+{
+    static const uint8_t maskBytes[4] = { 0x37, 0xFA, 0x21, 0x3D };
+    uint8_t src[96 + 8], expected[96 + 8], copied[96 + 8], in_place[96 + 8];
+
+    for ( uint32_t i = 0 ; i < sizeof(src) ; i++ ) {
+        src[i] = (uint8_t)( i * 151 + 7 );
+    }
+    for ( uint32_t len = 0 ; len <= 80 ; len++ ) {
+        for ( uint32_t src_align = 0 ; src_align < 4 ; src_align++ ) {
+            for ( uint32_t dst_align = 0 ; dst_align < 4 ; dst_align++ ) {
+                for ( uint32_t offset = 0 ; offset < 8 ; offset++ ) {
+                    maskBytewise( expected, src + src_align, len, maskBytes, offset );
+
+                    memset( copied, 0xEE, sizeof(copied) );
+                    wsMask( copied + dst_align, src + src_align, len, maskBytes, offset );
+                    CHECK( memcmp( copied + dst_align, expected, len ) == 0 );
+                    CHECK( copied[dst_align + len] == 0xEE );
+
+                    memcpy( in_place + src_align, src + src_align, len );
+                    wsMask( in_place + src_align, in_place + src_align, len, maskBytes, offset );
+                    CHECK( memcmp( in_place + src_align, expected, len ) == 0 );
+                }
+            }
+        }
+    }
+}
+
+static void testBuildPacket( void )
+{
+    char payload[300], frame[320];
+    for ( int i = 0 ; i < (int)sizeof(payload) ; i++ ) {
+        payload[i] = (char)( 'a' + i % 26 );
+    }
+    uint64_t len = wsBuildPacket( frame, sizeof(frame), WEBSOCKET_OPCODE_TEXT, payload, sizeof(payload), 1 );
+    CHECK( len == 4 + 4 + sizeof(payload) );
+
+    uint8_t unmasked[sizeof(payload)];
+    maskBytewise( unmasked, (uint8_t *)frame + 8, sizeof(payload), (uint8_t *)frame + 4, 0 );
+    CHECK( memcmp( unmasked, payload, sizeof(payload) ) == 0 );
+}
+
+static void benchMask( void )
+{
+    static const uint32_t sizes[] = { 64, 512, 2048 };
+    static const uint8_t maskBytes[4] = { 1, 2, 3, 4 };
+    static uint8_t src[2048], dst[2048];
+
+    for ( size_t i = 0 ; i < sizeof(sizes)/sizeof(sizes[0]) ; i++ ) {
+        uint32_t len = sizes[i];
+        uint32_t rounds = ( 64u << 20 ) / len;
+
+        double start = testNowNs();
+        for ( uint32_t round = 0 ; round < rounds ; round++ ) {
+            wsMask( dst, src, len, maskBytes, round );
+            test_sink += dst[round % len];
+        }
+        double word = testNowNs() - start;
+
+        start = testNowNs();
+        for ( uint32_t round = 0 ; round < rounds ; round++ ) {
+            maskBytewise( dst, src, len, maskBytes, round );
+            test_sink += dst[round % len];
+        }
+        double bytewise = testNowNs() - start;
+
+        printf("mask %4u bytes: wsMask %.2f bytes/ns, byte at a time %.2f bytes/ns\n",
+            len, (double)len * rounds / word, (double)len * rounds / bytewise );
+    }
+}
+
+int main( void )
+{
+    testVectors();
+    testBuildPacket();
+    benchMask();
+    return testResult();
+}
@@ -0,0 +1,255 @@
+/*  wss:// over the POSIX transport against a local TLS WebSocket server run on a
+ *  thread of the test. Each round sets TLS up afresh, so its first connection
+ *  makes a full handshake, then reconnects resuming the session. Resumed connects
+ *  must be counted and faster than full ones. A server the CA doesn't vouch for
+ *  must be refused.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <openssl/ssl.h>
+#include <openssl/pem.h>
+#include <openssl/x509v3.h>
+
+#include "WebSocket.h"
+#include "sha1.h"
+#include "base64.h"
+#include "hostTest.h"
+
+#define ROUNDS      5
+#define RESUMES     4
+
+typedef struct {
+    EVP_PKEY *key;
+    X509 *cert;
+    char *pem;                      // the certificate as PEM, NUL terminated
+    size_t pem_len;                 // including the NUL
+} testCert_t;
+
+static SSL_CTX *server_ctx;
+static int listen_fd;
+static uint16_t server_port;
+
+// a self-signed certificate for localhost, its own CA
+static void makeCert( testCert_t *cert )
+{
+    cert->key = EVP_RSA_gen( 2048 );
+    cert->cert = X509_new();
+    X509_set_version( cert->cert, 2 );
+    ASN1_INTEGER_set( X509_get_serialNumber(cert->cert), 1 );
+    X509_gmtime_adj( X509_getm_notBefore(cert->cert), -60 );
+    X509_gmtime_adj( X509_getm_notAfter(cert->cert), 3600 );
+    X509_set_pubkey( cert->cert, cert->key );
+    X509_NAME *name = X509_get_subject_name( cert->cert );
+    X509_NAME_add_entry_by_txt( name, "CN", MBSTRING_ASC, (const unsigned char *)"localhost", -1, -1, 0 );
+    X509_set_issuer_name( cert->cert, name );
+    X509_EXTENSION *san = X509V3_EXT_conf_nid( NULL, NULL, NID_subject_alt_name, "DNS:localhost" );
+    X509_add_ext( cert->cert, san, -1 );
+    X509_EXTENSION_free( san );
+    X509_sign( cert->cert, cert->key, EVP_sha256() );
+
+    BIO *bio = BIO_new( BIO_s_mem() );
+    PEM_write_bio_X509( bio, cert->cert );
+    char *data;
+    long len = BIO_get_mem_data( bio, &data );
+    cert->pem = (char *)calloc( 1, (size_t)len + 1 );
+    memcpy( cert->pem, data, (size_t)len );
+    cert->pem_len = (size_t)len + 1;
+    BIO_free( bio );
+}
+
+static void freeCert( testCert_t *cert )
+{
+    X509_free( cert->cert );
+    EVP_PKEY_free( cert->key );
+    free( cert->pem );
+}
+
+// answers one client: the upgrade, a greeting message, then waits for it to close
+static void serveClient( SSL *ssl )
+{
+    char request[2048];
+    int len = 0;
+    while ( len < (int)sizeof(request) - 1 ) {
+        int n = SSL_read( ssl, request + len, (int)sizeof(request) - 1 - len );
+        if ( n <= 0 ) {
+            return;
+        }
+        len += n;
+        request[len] = '\0';
+        if ( strstr( request, "\r\n\r\n" ) ) {
+            break;
+        }
+    }
+    const char *key = strstr( request, "Sec-WebSocket-Key: " );
+    if ( key == NULL ) {
+        return;
+    }
+
+    char concat[24 + 36 + 1];
+    memcpy( concat, key + 19, 24 );
+    memcpy( concat + 24, "258EAFA5-E914-47DA-95CA-C5AB0DC85B11", 36 );
+    SHA1_HASH hash;
+    Sha1Calculate( concat, 24 + 36, &hash );
+    char accept[32];
+    base64_encode( (const char *)hash.bytes, SHA1_HASH_SIZE, accept );
+
+    char response[256];
+    len = snprintf( response, sizeof(response),
+        "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+        "Sec-WebSocket-Accept: %s\r\n\r\n\x81\x0b{\"hello\":1}", accept );
+    SSL_write( ssl, response, len );
+
+    while ( SSL_read( ssl, request, sizeof(request) ) > 0 ) {
+    }
+}
+
+static void *serverThread( void *arg )
+{
+    (void)arg;
+    for ( ;; ) {
+        int fd = accept( listen_fd, NULL, NULL );
+        if ( fd < 0 ) {
+            break;
+        }
+        // the handshake and the greeting are several small writes, don't hold them back
+        int nodelay = 1;
+        setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay) );
+        SSL *ssl = SSL_new( server_ctx );
+        SSL_set_fd( ssl, fd );
+        if ( SSL_accept( ssl ) == 1 ) {
+            serveClient( ssl );
+            SSL_shutdown( ssl );
+        }
+        SSL_free( ssl );
+        close( fd );
+    }
+    return NULL;
+}
+
+static void startServer( testCert_t *cert, pthread_t *thread )
+{
+    server_ctx = SSL_CTX_new( TLS_server_method() );
+    SSL_CTX_use_certificate( server_ctx, cert->cert );
+    SSL_CTX_use_PrivateKey( server_ctx, cert->key );
+
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t addr_len = sizeof(addr);
+    listen_fd = socket( AF_INET, SOCK_STREAM, 0 );
+    bind( listen_fd, (struct sockaddr *)&addr, sizeof(addr) );
+    listen( listen_fd, 4 );
+    getsockname( listen_fd, (struct sockaddr *)&addr, &addr_len );
+    server_port = ntohs( addr.sin_port );
+    pthread_create( thread, NULL, serverThread, NULL );
+}
+
+static int messages;
+
+static void onMessage( WebSocketClient_p client, char *message, int len )
+{
+    (void)client;
+    (void)message;
+    (void)len;
+    messages++;
+}
+
+// services the client until the greeting arrives or the connection is gone, ns taken
+static double connectAndGreet( WebSocketClient_p client )
+{
+    int want = messages + 1;
+    double start = testNowNs();
+
+    wsConnect( client );
+    while ( messages < want && wsConnectState( client ) != TCP_DISCONNECTED && testNowNs() - start < 5e9 ) {
+        wsHandler( client );
+    }
+    double elapsed = testNowNs() - start;
+    CHECK( messages == want );
+    return elapsed;
+}
+
+static void disconnect( WebSocketClient_p client )
+{
+    wsDisconnect( client );
+    while ( wsConnectState( client ) != TCP_DISCONNECTED ) {
+        wsHandler( client );
+    }
+}
+
+static int compareDouble( const void *a, const void *b )
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return ( x > y ) - ( x < y );
+}
+
+static void testResume( testCert_t *ca )
+{
+    WebSocketClient_p client = wsCreate( "127.0.0.1", "localhost", server_port, onMessage, NULL, false, NULL );
+    double full[ROUNDS], resumed[ROUNDS * RESUMES];
+
+    for ( int round = 0 ; round < ROUNDS ; round++ ) {
+        CHECK( wsSetTls( client, (const uint8_t *)ca->pem, ca->pem_len ) );
+        full[round] = connectAndGreet( client );
+        disconnect( client );
+        for ( int i = 0 ; i < RESUMES ; i++ ) {
+            resumed[round * RESUMES + i] = connectAndGreet( client );
+            disconnect( client );
+        }
+    }
+
+    wsTlsStats_t stats;
+    CHECK( wsGetTlsStats( client, &stats ) );
+    CHECK( stats.handshakes == ROUNDS * ( 1 + RESUMES ) );
+    CHECK( stats.resumed == ROUNDS * RESUMES );
+    CHECK( stats.last_resumed );
+
+    qsort( full, ROUNDS, sizeof(double), compareDouble );
+    qsort( resumed, ROUNDS * RESUMES, sizeof(double), compareDouble );
+    double full_ms = full[ROUNDS / 2] / 1e6, resumed_ms = resumed[ROUNDS * RESUMES / 2] / 1e6;
+    printf("connect to first message, median: full handshake %.2f ms, resumed %.2f ms\n", full_ms, resumed_ms );
+    CHECK( resumed_ms < full_ms );
+    wsDestroy( client );
+}
+
+static void testUntrusted( void )
+{
+    testCert_t other;
+    makeCert( &other );
+    WebSocketClient_p client = wsCreate( "127.0.0.1", "localhost", server_port, onMessage, NULL, false, NULL );
+    CHECK( wsSetTls( client, (const uint8_t *)other.pem, other.pem_len ) );
+
+    double start = testNowNs();
+    wsConnect( client );
+    while ( wsConnectState( client ) != TCP_DISCONNECTED && testNowNs() - start < 5e9 ) {
+        wsHandler( client );
+    }
+    wsTlsStats_t stats;
+    wsGetTlsStats( client, &stats );
+    CHECK( !wsIsUpgraded( client ) && stats.handshakes == 0 );
+    wsDestroy( client );
+    freeCert( &other );
+}
+
+int main( void )
+{
+    testCert_t cert;
+    pthread_t thread;
+
+    makeCert( &cert );
+    startServer( &cert, &thread );
+    testResume( &cert );
+    testUntrusted();
+
+    shutdown( listen_fd, SHUT_RDWR );
+    pthread_join( thread, NULL );
+    close( listen_fd );
+    SSL_CTX_free( server_ctx );
+    freeCert( &cert );
+    return testResult();
+}
@@ -0,0 +1,235 @@
+/*  UTF-8 validator against a plain code point decoder: every string of up to three
+ *  bytes, four byte forms around each boundary, random strings, all split at every
+ *  byte and at each alignment. Then text messages through the decoder, where invalid
+ *  UTF-8 must fail the connection with 1007. Reports the validation rate on Sinric
+ *  Pro messages for both.
+ */
+
+#include "wsTest.h"
+
+// decodes each code point and checks its range, the whole string at once
+static bool refValidate( const uint8_t *s, uint32_t len )
+{
+    static const uint32_t min[] = { 0, 0x80, 0x800, 0x10000 };
+    uint32_t i = 0;
+    while ( i < len ) {
+        uint8_t c = s[i];
+        uint32_t n = c < 0x80 ? 0 : c < 0xC0 ? 4 : c < 0xE0 ? 1 : c < 0xF0 ? 2 : c < 0xF8 ? 3 : 4;
+        if ( n == 4 || i + n >= len ) {
+            return false;
+        }
+        uint32_t cp = n == 0 ? c : c & ( 0x3F >> n );
+        for ( uint32_t k = 1 ; k <= n ; k++ ) {
+            if ( ( s[i + k] & 0xC0 ) != 0x80 ) {
+                return false;
+            }
+            cp = cp << 6 | ( s[i + k] & 0x3F );
+        }
+        if ( cp < min[n] || cp > 0x10FFFF || ( cp >= 0xD800 && cp <= 0xDFFF ) ) {
+            return false;
+        }
+        i += n + 1;
+    }
+    return true;
+}
+
+static bool validate( const uint8_t *s, uint32_t len )
+{
+    uint32_t state = 0;
+    return wsUtf8Validate( &state, s, len ) && state == 0;
+}
+
+// the answer must not depend on where the string is split or how it is aligned
+static void checkSplits( const uint8_t *s, uint32_t len )
+{
+    static uint8_t buf[256 + 8];
+    bool expect = refValidate( s, len );
+    for ( uint32_t offset = 0 ; offset < 4 ; offset++ ) {
+        memcpy( buf + offset, s, len );
+        for ( uint32_t split = 0 ; split <= len ; split++ ) {
+            uint32_t state = 0;
+            bool valid = wsUtf8Validate( &state, buf + offset, split ) &&
+                         wsUtf8Validate( &state, buf + offset + split, len - split ) && state == 0;
+            CHECK( valid == expect );
+        }
+    }
+}
+
+static void testShort( void )
+{
+    uint8_t s[4];
+    int mismatches = 0;
+    for ( uint32_t n = 0 ; n < 1u << 24 ; n++ ) {
+        s[0] = (uint8_t)( n >> 16 );
+        s[1] = (uint8_t)( n >> 8 );
+        s[2] = (uint8_t)n;
+        mismatches += validate( s, 3 ) != refValidate( s, 3 );
+        if ( n < 1u << 16 ) {
+            mismatches += validate( s + 1, 2 ) != refValidate( s + 1, 2 );
+        }
+        if ( n < 1u << 8 ) {
+            mismatches += validate( s + 2, 1 ) != refValidate( s + 2, 1 );
+        }
+    }
+    CHECK( mismatches == 0 );
+
+    // four byte forms: each lead byte from F0 with the interesting second bytes
+    static const uint8_t second[] = { 0x7F, 0x80, 0x8F, 0x90, 0xBF, 0xC0 };
+    for ( uint32_t lead = 0xEF ; lead <= 0xF8 ; lead++ ) {
+        for ( size_t i = 0 ; i < sizeof(second) ; i++ ) {
+            const uint8_t tail[] = { 0x80, 0xBF, 0x7F };
+            for ( size_t j = 0 ; j < sizeof(tail) ; j++ ) {
+                uint8_t four[] = { (uint8_t)lead, second[i], 0x80, tail[j] };
+                CHECK( validate( four, 4 ) == refValidate( four, 4 ) );
+                checkSplits( four, 4 );
+            }
+        }
+    }
+}
+
+static void testNamed( void )
+{
+    static const struct { const char *s; bool valid; } cases[] = {
+        { "{\"name\":\"K\xC3\xBC" "che\"}", true },
+        { "\xE2\x82\xAC 100", true },                       // U+20AC
+        { "\xF0\x9F\x92\xA1 on", true },                    // U+1F4A1
+        { "\xEF\xBF\xBF\xF4\x8F\xBF\xBF", true },           // U+FFFF, U+10FFFF
+        { "\xED\x9F\xBF\xEE\x80\x80", true },               // either side of the surrogates
+        { "\xC0\xAF", false },                              // overlong '/'
+        { "\xE0\x80\xAF", false },
+        { "\xF0\x80\x80\xAF", false },
+        { "\xED\xA0\x80", false },                          // U+D800
+        { "\xED\xBF\xBF", false },                          // U+DFFF
+        { "\xF4\x90\x80\x80", false },                      // U+110000
+        { "\xF5\x80\x80\x80", false },
+        { "\xFF", false },
+        { "\x80", false },
+        { "ok \xE2\x82", false },                           // ends inside a character
+        { "\xE2\x28\xA1", false },
+    };
+    for ( size_t i = 0 ; i < sizeof(cases)/sizeof(cases[0]) ; i++ ) {
+        uint32_t len = (uint32_t)strlen( cases[i].s );
+        CHECK( refValidate( (const uint8_t *)cases[i].s, len ) == cases[i].valid );
+        CHECK( validate( (const uint8_t *)cases[i].s, len ) == cases[i].valid );
+        checkSplits( (const uint8_t *)cases[i].s, len );
+    }
+}
+
+// mostly ASCII with the odd multibyte or stray byte, as the fast path has to find them
+static void testRandom( void )
+{
+    static const uint8_t pieces[][4] = {
+        { 0xC3, 0xBC }, { 0xE2, 0x82, 0xAC }, { 0xF0, 0x9F, 0x92, 0xA1 }, { 0xED, 0xA0, 0x80 }, { 0xC0 }, { 0xBF },
+    };
+    static const uint8_t piece_len[] = { 2, 3, 4, 3, 1, 1 };
+    uint8_t s[200];
+    srand( 1 );
+    for ( int n = 0 ; n < 2000 ; n++ ) {
+        uint32_t len = 0, target = (uint32_t)( rand() % 190 );
+        while ( len < target ) {
+            if ( rand() % 16 ) {
+                s[len++] = (uint8_t)( 0x20 + rand() % 0x5F );
+            } else {
+                int p = rand() % ( n % 2 ? 6 : 3 );
+                memcpy( s + len, pieces[p], piece_len[p] );
+                len += piece_len[p];
+            }
+        }
+        checkSplits( s, len );
+    }
+}
+
+static int messages;
+
+static void onMessage( WebSocketClient_p client, char *message, int len )
+{
+    (void)client;
+    (void)message;
+    (void)len;
+    messages++;
+}
+
+static uint16_t closeCode( WebSocketClient_t *state )
+{
+    uint32_t pos = 0, len;
+    uint8_t first, payload[WS_MAX_CONTROL_SIZE];
+    while ( wsTestSent( state, &pos, &first, payload, &len ) ) {
+        if ( first == 0x88 && len >= 2 ) {
+            return (uint16_t)( payload[0] << 8 | payload[1] );
+        }
+    }
+    return 0;
+}
+
+static void testDecoder( void )
+{
+    // a valid message fragmented inside its multibyte characters
+    WebSocketClient_t *state = wsTestOpen( onMessage, NULL );
+    uint8_t buf[256];
+    uint32_t len = wsTestFrame( buf, 0x01, "{\"name\":\"K\xC3", 11 );
+    len += wsTestFrame( buf + len, 0x00, "\xBC" "che \xF0\x9F", 7 );
+    len += wsTestFrame( buf + len, 0x80, "\x92\xA1\"}", 4 );
+    messages = 0;
+    wsTestFeed( state, buf, len, 0 );
+    CHECK( messages == 1 && wsConnectState( state ) == TCP_CONNECTED );
+    wsDestroy( state );
+
+    // a surrogate
+    state = wsTestOpen( onMessage, NULL );
+    len = wsTestFrame( buf, 0x81, "{\"name\":\"\xED\xA0\x80\"}", 14 );
+    messages = 0;
+    wsTestFeed( state, buf, len, 0 );
+    CHECK( messages == 0 && wsConnectState( state ) == TCP_DISCONNECTED );
+    CHECK( closeCode( state ) == WS_CLOSE_INVALID_DATA );
+    wsDestroy( state );
+
+    // a message that ends inside a character
+    state = wsTestOpen( onMessage, NULL );
+    len = wsTestFrame( buf, 0x01, "{\"name\":\"ok\"}", 13 );
+    len += wsTestFrame( buf + len, 0x80, "\xE2\x82", 2 );
+    messages = 0;
+    wsTestFeed( state, buf, len, 0 );
+    CHECK( messages == 0 && closeCode( state ) == WS_CLOSE_INVALID_DATA );
+    wsDestroy( state );
+}
+
+static void bench( const char *name, const char *message )
+{
+    enum { ROUNDS = 200000 };
+    uint32_t len = (uint32_t)strlen( message );
+    static uint8_t buf[1024] __attribute__((aligned(4)));
+    memcpy( buf, message, len );
+
+    double start = testNowNs();
+    for ( int i = 0 ; i < ROUNDS ; i++ ) {
+        test_sink += refValidate( buf, len );
+    }
+    double ref = testNowNs() - start;
+    start = testNowNs();
+    for ( int i = 0 ; i < ROUNDS ; i++ ) {
+        test_sink += validate( buf, len );
+    }
+    double fast = testNowNs() - start;
+    printf("%-10s %3u bytes: per character %.2f bytes/ns, wsUtf8Validate %.2f bytes/ns\n",
+        name, len, (double)len * ROUNDS / ref, (double)len * ROUNDS / fast );
+}
+
+int main( void )
+{
+    testShort();
+    testNamed();
+    testRandom();
+    testDecoder();
+
+    bench( "request", "{\"header\":{\"payloadVersion\":2,\"signatureVersion\":1},\"payload\":{\"action\":\"setPowerState\","
+        "\"clientId\":\"alexa-skill\",\"createdAt\":1700000000,\"deviceAttributes\":[],\"deviceId\":"
+        "\"5fe1a2b3c4d5e6f708192a3b\",\"replyToken\":\"8d2f6c1e-3b4a-4f5e-9c8d-7a6b5c4d3e2f\",\"type\":"
+        "\"request\",\"value\":{\"state\":\"On\"}},\"signature\":{\"HMAC\":"
+        "\"n8q3W0m5bXkJtq1Vh3d1l7pY6Q2eS9fA0cR4uZ8xK1o=\"}}" );
+    bench( "non-ASCII", "{\"header\":{\"payloadVersion\":2,\"signatureVersion\":1},\"payload\":{\"action\":\"setPowerState\","
+        "\"clientId\":\"alexa-skill\",\"createdAt\":1700000000,\"deviceAttributes\":[{\"name\":\"K\xC3\xBC" "che\"}],"
+        "\"deviceId\":\"5fe1a2b3c4d5e6f708192a3b\",\"replyToken\":\"8d2f6c1e-3b4a-4f5e-9c8d-7a6b5c4d3e2f\",\"type\":"
+        "\"request\",\"value\":{\"state\":\"On\",\"label\":\"\xE2\x82\xAC \xF0\x9F\x92\xA1\"}},\"signature\":{\"HMAC\":"
+        "\"n8q3W0m5bXkJtq1Vh3d1l7pY6Q2eS9fA0cR4uZ8xK1o=\"}}" );
+    return testResult();
+}